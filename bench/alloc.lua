@@ -0,0 +1,32 @@
+--[[
+
+    Allocator benchmark
+
+    > Churns through the small tables, strings and closures Lua code
+    > allocates all the time, keeping a window of them alive.
+    > Compare the allocators with the counts printed by `--debug` and the
+    > peak RSS, e.g.
+    > `/usr/bin/time -v reflex run bench/alloc.lua --debug --allocator pool -- 2000000`
+    > `/usr/bin/time -v reflex run bench/alloc.lua --debug --allocator system -- 2000000`
+
+]]
+
+local iterations = tonumber(process.argv[1]) or 2000000
+local window = tonumber(process.argv[2]) or 10000
+
+local live = {}
+local start = process.hrtime()
+
+for i = 1, iterations do
+    local slot = i % window + 1
+    local value = i
+    live[slot] = {
+        id = i,
+        name = "item" .. i,
+        point = { x = i, y = -i },
+        get = function() return value end
+    }
+end
+
+local seconds = (process.hrtime() - start) / 1e9
+print(string.format("%d iterations in %.2fs (%.0f/s)", iterations, seconds, iterations / seconds))
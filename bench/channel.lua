@@ -0,0 +1,43 @@
+--[[
+
+    Channel benchmark
+
+    > Starts `producers` workers that all send into one channel while the
+    > main state receives, then reports messages/sec and the time messages
+    > spent in the channel.
+    > Example: `reflex run bench/channel.lua -- 4 250000 4096`
+
+]]
+
+local producers = tonumber(process.argv[1]) or 4
+local count = tonumber(process.argv[2]) or 250000
+local capacity = tonumber(process.argv[3]) or 4096
+
+local channel = reflex.channel.new(capacity)
+local started = process.hrtime()
+
+for _ = 1, producers do
+    reflex.worker.spawn("bench/channel_producer.lua", channel, count)
+end
+
+reflex.async(function()
+    local total = producers * count
+    local latencies = {}
+
+    for i = 1, total do
+        local sent = channel:receive()
+        latencies[i] = process.hrtime() - sent
+    end
+
+    local elapsed = (process.hrtime() - started) / 1e9
+    table.sort(latencies)
+    local function percentile(p)
+        return string.format("%.3f ms", latencies[math.max(1, math.ceil(total * p))] / 1e6)
+    end
+
+    print(string.format("%d producers, %d messages, capacity %d", producers, total, capacity))
+    print(string.format("Messages/sec: %.0f", total / elapsed))
+    print("Latency p50:  " .. percentile(0.50))
+    print("Latency p99:  " .. percentile(0.99))
+    print("Latency max:  " .. percentile(1))
+end)
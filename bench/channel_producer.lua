@@ -0,0 +1,18 @@
+--[[
+
+    Producer used by `bench/channel.lua`
+
+    > Sends `count` timestamps into the channel, backing off for a loop
+    > iteration whenever the channel is full.
+
+]]
+
+local channel, count = ...
+
+reflex.async(function()
+    for _ = 1, count do
+        while not channel:send(process.hrtime()) do
+            reflex.sleep(0)
+        end
+    end
+end)
@@ -0,0 +1,94 @@
+--[[
+
+    HTTP load generator
+
+    > Keeps `connections` keep-alive connections busy for `seconds` and
+    > reports requests/sec and latency percentiles. With a `pipeline` depth
+    > above 1 every batch of requests is written at once.
+    > Example: `reflex run bench/http_client.lua -- 127.0.0.1 8080 64 10 1`
+    > Expects every response to have the same size, like `bench/http_server.lua`.
+
+]]
+
+local host = process.argv[1] or "127.0.0.1"
+local port = tonumber(process.argv[2]) or 8080
+local connections = tonumber(process.argv[3]) or 64
+local seconds = tonumber(process.argv[4]) or 10
+local pipeline = tonumber(process.argv[5]) or 1
+
+local request = "GET / HTTP/1.1\r\nHost: " .. host .. "\r\n\r\n"
+local batch = string.rep(request, pipeline)
+
+local latencies = {}
+local completed = 0
+local running = connections
+local deadline = process.hrtime() + seconds * 1e9
+local started = process.hrtime()
+
+-- Reads until `count` complete responses of `size` bytes arrived
+local function await_responses(client, count, size, buffered)
+    while buffered < count * size do
+        local data = client:read()
+        if not data then error("connection closed by the server") end
+        buffered = buffered + #data
+    end
+    return buffered - count * size
+end
+
+-- The first response tells the size of all the others
+local function measure(client)
+    client:write(request)
+    local head = ""
+    while true do
+        head = head .. client:read():tostring()
+        local head_end = head:find("\r\n\r\n", 1, true)
+        if head_end then
+            local length = tonumber(head:match("[Cc]ontent%-[Ll]ength: *(%d+)"))
+            local size = head_end + 3 + length
+            await_responses(client, 1, size, #head)
+            return size
+        end
+    end
+end
+
+local function report()
+    local elapsed = (process.hrtime() - started) / 1e9
+    table.sort(latencies)
+    local function percentile(p)
+        local value = latencies[math.max(1, math.ceil(#latencies * p))] or 0
+        return string.format("%.3f ms", value / 1e6)
+    end
+
+    print(string.format("%d connections, pipeline %d, %.1f seconds", connections, pipeline, elapsed))
+    print(string.format("Requests:     %d", completed))
+    print(string.format("Requests/sec: %.0f", completed / elapsed))
+    print("Latency p50:  " .. percentile(0.50))
+    print("Latency p99:  " .. percentile(0.99))
+    print("Latency max:  " .. percentile(1))
+end
+
+for _ = 1, connections do
+    reflex.async(function()
+        local client = reflex.tcp.connect(host, port)
+        client:setNoDelay(true)
+        local size = measure(client)
+        local leftover = 0
+
+        while process.hrtime() < deadline do
+            local sent = process.hrtime()
+            client:write(batch)
+            leftover = await_responses(client, pipeline, size, leftover)
+            local latency = process.hrtime() - sent
+            for _ = 1, pipeline do
+                latencies[#latencies + 1] = latency
+            end
+            completed = completed + pipeline
+        end
+
+        client:close()
+        running = running - 1
+        if running == 0 then
+            report()
+        end
+    end)
+end
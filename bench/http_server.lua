@@ -0,0 +1,20 @@
+--[[
+
+    HTTP server benchmark target
+
+    > Answers every request with a small plain text body.
+    > Example: `reflex run bench/http_server.lua -- 8080`
+    > Then load it with `wrk -t4 -c64 -d10s --latency http://127.0.0.1:8080/`
+    > or with the bundled client in `bench/http_client.lua`.
+
+]]
+
+local port = tonumber(process.argv[1]) or 8080
+
+local server = reflex.http.createServer(function(req, res)
+    res:setHeader("Content-Type", "text/plain")
+    res:send("Hello, World!")
+end)
+server:listen(port, "127.0.0.1")
+
+print("Listening on http://127.0.0.1:" .. port)
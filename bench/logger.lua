@@ -0,0 +1,31 @@
+--[[
+
+    Logger level benchmark
+
+    > Calls a disabled reflex.logger.debug, which does nothing but return,
+    > next to an empty Lua function as the floor. The enabled count writes
+    > every record, redirect stdout to keep the terminal out of it, e.g.
+    > `reflex run bench/logger.lua -- 5000000 > /dev/null`
+
+]]
+
+local iterations = tonumber(process.argv[1]) or 5000000
+local logger = reflex.logger
+
+local function measure(name, count, fn)
+    local start = process.hrtime()
+    for i = 1, count do
+        fn("request handled", i)
+    end
+    local seconds = (process.hrtime() - start) / 1e9
+    io.stderr:write(string.format("%-10s %d calls in %.2fs (%.0f/s)\n", name, count, seconds, count / seconds))
+end
+
+measure("empty", iterations, function() end)
+
+logger.setLevel("info")
+measure("disabled", iterations, logger.debug)
+
+logger.setLevel("debug")
+measure("enabled", iterations // 10, logger.debug)
+logger.flush()
@@ -0,0 +1,78 @@
+/*
+
+    State lifecycle benchmark
+
+    > Creates a state with the builtins, runs a small request-like chunk and
+    > frees the state, over and over, with reflex_new and reflex_new_arena,
+    > then the same work on states taken from and returned to a pool.
+    > Built against the objects of the default distribution and run by
+    > `make bench_states CYCLES=20000`.
+
+*/
+
+#include "lua_api.h"
+#include "reflex_api.h"
+#include "alloc.h"
+#include "state_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *chunk =
+    "local request = { method = 'GET', path = '/items', headers = {} }\n"
+    "for i = 1, 20 do request.headers['x-header-' .. i] = tostring(i) end\n"
+    "local items = {}\n"
+    "for i = 1, 200 do items[i] = { id = i, name = 'item' .. i } end\n"
+    "return #items\n";
+
+static double run(int cycles, int arena) {
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < cycles; i++) {
+        LuaAPI *api = arena ? reflex_new_arena(0) : reflex_new();
+        if (!api) {
+            fprintf(stderr, "Failed to create state\n");
+            exit(1);
+        }
+        define_reflex_builtin(api);
+        if (luaL_dostring(api->L, chunk) != 0) {
+            fprintf(stderr, "%s\n", lua_tostring(api->L, -1));
+            exit(1);
+        }
+        reflex_free(api);
+    }
+    return (double)(uv_hrtime() - start) / 1e9;
+}
+
+static double run_pool(int cycles) {
+    ReflexStatePool *pool = reflex_state_pool_new(4);
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < cycles; i++) {
+        LuaAPI *api = reflex_state_pool_acquire(pool);
+        if (luaL_dostring(api->L, chunk) != 0) {
+            fprintf(stderr, "%s\n", lua_tostring(api->L, -1));
+            exit(1);
+        }
+        reflex_state_pool_release(pool, api);
+    }
+    double seconds = (double)(uv_hrtime() - start) / 1e9;
+    reflex_state_pool_free(pool);
+    return seconds;
+}
+
+int main(int argc, char *argv[]) {
+    int cycles = argc > 1 ? atoi(argv[1]) : 20000;
+
+    reflex_set_allocator(REFLEX_ALLOC_SYSTEM);
+    double system = run(cycles, 0);
+    reflex_set_allocator(REFLEX_ALLOC_POOL);
+    run(cycles / 10, 0); // Warms up the free lists
+    double pool = run(cycles, 0);
+    double arena = run(cycles, 1);
+    double pooled = run_pool(cycles);
+
+    printf("%d cycles\n", cycles);
+    printf("reflex_new (system): %.0f cycles/s\n", cycles / system);
+    printf("reflex_new (pool):   %.0f cycles/s\n", cycles / pool);
+    printf("reflex_new_arena:    %.0f cycles/s\n", cycles / arena);
+    printf("ReflexStatePool:     %.0f cycles/s\n", cycles / pooled);
+    return 0;
+}
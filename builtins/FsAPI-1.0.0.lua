@@ -0,0 +1,67 @@
+--- # Filesystem API
+--- 
+--- Non-blocking filesystem access. Inside `reflex.async` every call runs on the
+--- libuv threadpool and suspends the task until it completes, outside of a task
+--- the call completes synchronously. Failures raise an error such as
+--- `ENOENT: no such file or directory, open 'file.txt'`.
+--- 
+--- The threadpool size is set with `reflex run <file> --threadpool-size <n>`.
+fs = {}
+
+--- Opens a file and returns its descriptor
+---@param path string Path of the file
+---@param flags? string One of `r`, `r+`, `w`, `w+`, `a`, `a+` (default `r`)
+---@param mode? integer Permissions used when the file is created (default `0644`)
+---@return integer fd File descriptor
+function fs.open(path, flags, mode) return 0 end
+
+--- Closes a file descriptor
+---@param fd integer File descriptor
+---@return true
+function fs.close(fd) return true end
+
+--- Reads from a file descriptor
+---@param fd integer File descriptor
+---@param length? integer Maximum number of bytes to read (default 65536)
+---@param offset? integer Position to read from, current position if omitted
+---@return string|nil data The data read, nil at the end of the file
+function fs.read(fd, length, offset) return "" end
+
+--- Writes to a file descriptor
+---@param fd integer File descriptor
+---@param data string Data to write
+---@param offset? integer Position to write at, current position if omitted
+---@return integer written Number of bytes written
+function fs.write(fd, data, offset) return 0 end
+
+--- Returns information about a file
+---@param path string Path of the file
+---@return Stat stat
+function fs.stat(path) return {} end
+
+--- Lists the entries of a directory
+---@param path string Path of the directory
+---@return string[] entries Entry names
+function fs.readdir(path) return {} end
+
+--- Reads a whole file
+---@param path string Path of the file
+---@return string contents
+function fs.readFile(path) return "" end
+
+--- Writes a whole file, replacing it if it exists
+---@param path string Path of the file
+---@param data string Contents to write
+---@return true
+function fs.writeFile(path, data) return true end
+
+--- File information returned by `fs#stat`
+--- @class Stat
+--- @field size integer Size in bytes
+--- @field mode integer Mode bits
+--- @field atime number Last access time in seconds
+--- @field mtime number Last modification time in seconds
+--- @field ctime number Last status change time in seconds
+--- @field isFile boolean True for regular files
+--- @field isDirectory boolean True for directories
+local stat = {}
@@ -16,6 +16,20 @@ function process.pid() return 0 end
 ---@return nil nil Returns nil since the application ends and doesnt continue
 function process.exit(code) return nil end
 
+--- Returns a monotonic timestamp in nanoseconds, useful for measuring durations
+---@return integer Time Nanoseconds since an arbitrary point in the past
+function process.hrtime() return 0 end
+
+---@class MemoryUsage
+---@field live integer Bytes currently allocated by this Lua state
+---@field peak integer Highest `live` so far
+---@field limit integer|nil The `--max-memory` limit, allocations past it raise "not enough memory"
+---@field rss integer Resident memory of the whole process in bytes
+
+--- Returns the memory used by this state and the process
+---@return MemoryUsage
+function process.memoryUsage() return {} end
+
 --- Returns the reflex version, also can be found at `reflex#version()`
 ---@return string The resulted version of reflex
 function process.version() return "" end
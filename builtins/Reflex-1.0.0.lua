@@ -42,32 +42,376 @@ package.reflex_path = ""
 --- 
 --- Provides logging materials other than print. 
 --- Print can be overriden using `reflex.logger#overridePrint` to use `reflex.logger#info` instead of normal print.
+--- Messages are written by a background thread; everything logged is out
+--- before the process ends, use `reflex.logger#flush` to wait for it sooner.
+--- In the json format (`--log-format json`) every record is one line like
+--- `{"time":"2026-01-31T12:00:00.123Z","level":"info","msg":"...","key":"value"}`.
 reflex.logger = {}
 
 --- Prints a information message to the console
---- `INFO: <message>`
+--- `INFO: <message> key=value ...`
 ---@param message string
+---@param fields? table Extra fields of the record
 ---@return true
-function reflex.logger.info(message) return true end
+function reflex.logger.info(message, fields) return true end
 
 --- Prints a warning message to the console
---- `WARN: <message>`
+--- `WARN: <message> key=value ...`
 ---@param message string
+---@param fields? table Extra fields of the record
 ---@return true
-function reflex.logger.warn(message) return true end
+function reflex.logger.warn(message, fields) return true end
 
 --- Prints a error message to the console
---- `ERROR: <message>`
+--- `ERROR: <message> key=value ...`
 ---@param message string
+---@param fields? table Extra fields of the record
 ---@return true
-function reflex.logger.error(message) return true end
+function reflex.logger.error(message, fields) return true end
 
 --- Prints a debugging message to the console
---- `DEBUG: <message>`
+--- `DEBUG: <message> key=value ...`
 ---@param message string
+---@param fields? table Extra fields of the record
 ---@return true
-function reflex.logger.debug(message) return true end
+function reflex.logger.debug(message, fields) return true end
+
+--- Waits until every message logged so far has been written
+---@return true
+function reflex.logger.flush() return true end
+
+--- Switches the output of every logger in the process
+---@param format "text"|"json"
+---@return true
+function reflex.logger.setFormat(format) return true end
+
+--- Disables the levels below `level` in this state, `--log-level` sets the
+--- default of every state. Disabled levels become functions that do nothing,
+--- references taken from reflex.logger earlier are not changed.
+---@param level "debug"|"info"|"warn"|"error"
+---@return true
+function reflex.logger.setLevel(level) return true end
+
+--- Returns the level of this state
+---@return "debug"|"info"|"warn"|"error"
+function reflex.logger.getLevel() return "debug" end
+
+---@class ReflexLogFileOptions
+---@field bufferSize? integer Records are written in blocks of this many bytes, 65536 by default
+---@field flushInterval? integer Milliseconds a partial block waits at most, 1000 by default
+---@field maxSize? integer Rotates before the file grows past this many bytes
+---@field rotateEvery? integer Seconds a file is written before it rotates
+---@field compress? string Command run on each rotated file, e.g. "gzip"
+
+--- Appends every later record of the process to `path` as well. Rotated
+--- files are renamed to `<path>.<yyyymmdd-hhmmss>`.
+---@param path string
+---@param options? ReflexLogFileOptions
+---@return true
+function reflex.logger.addFile(path, options) return true end
+
+--- Stops or resumes writing records to stdout, for every logger in the process
+---@param enabled boolean
+---@return true
+function reflex.logger.setStdout(enabled) return true end
 
 --- Overrides the print method globally so it uses `logger#info`
 ---@return boolean result Returns true if successful, false if not.
-function reflex.logger.overridePrint() return true end
\ No newline at end of file
+function reflex.logger.overridePrint() return true end
+--- # Reflex Timer API
+--- 
+--- Schedules callbacks on the event loop. Timers keep the process alive
+--- until they fire or are cleared.
+reflex.timer = {}
+
+--- Runs a callback once after the given delay
+---@param callback function Function to run
+---@param ms integer Delay in milliseconds (minimum 1)
+---@return integer id Timer id used by `reflex.timer#clearTimer`
+function reflex.timer.setTimeout(callback, ms) return 0 end
+
+--- Runs a callback repeatedly every `ms` milliseconds
+---@param callback function Function to run
+---@param ms integer Interval in milliseconds (minimum 1)
+---@return integer id Timer id used by `reflex.timer#clearTimer`
+function reflex.timer.setInterval(callback, ms) return 0 end
+
+--- Cancels a timeout or interval
+---@param id integer Timer id returned by `setTimeout` or `setInterval`
+---@return boolean result True if the timer was still pending
+function reflex.timer.clearTimer(id) return true end
+
+--- Runs a function as an asynchronous task on the event loop.
+--- The task runs right away until it awaits, then resumes when the awaited
+--- operation completes. Errors inside a task end the process.
+---@param fn function Task body
+---@param ... any Arguments passed to `fn`
+function reflex.async(fn, ...) end
+
+--- Suspends the current task for `ms` milliseconds without blocking the loop.
+--- Must be called from within `reflex#async`.
+---@param ms integer Time to sleep in milliseconds
+function reflex.sleep(ms) end
+
+--- # Reflex TCP API
+---
+--- TCP servers and clients on the event loop. Reads and connects suspend the
+--- current task, so they must run inside `reflex#async`.
+reflex.tcp = {}
+
+--- Received bytes. A Buffer points into pooled read memory instead of
+--- copying it into a Lua string; call `tostring` when a string is needed.
+---@class Buffer
+local Buffer = {}
+
+--- Copies the bytes (or the range `i`..`j`) into a Lua string
+---@param i? integer First byte, negative values count from the end
+---@param j? integer Last byte, negative values count from the end
+---@return string
+function Buffer:tostring(i, j) return "" end
+
+--- Same as `Buffer#tostring`
+---@param i? integer
+---@param j? integer
+---@return string
+function Buffer:sub(i, j) return "" end
+
+--- Returns the numeric code of the byte at `i`
+---@param i? integer
+---@return integer
+function Buffer:byte(i) return 0 end
+
+--- Plain text search, no patterns
+---@param text string
+---@param init? integer Position to start at
+---@return integer|nil first
+---@return integer|nil last
+function Buffer:find(text, init) return 0, 0 end
+
+--- Returns the number of bytes
+---@return integer
+function Buffer:len() return 0 end
+
+--- Returns the memory to the pool before the buffer is collected
+function Buffer:release() end
+
+---@class TcpSocket
+local TcpSocket = {}
+
+--- Waits for the next chunk of data
+---@return Buffer|nil data Nil once the peer closed the connection
+function TcpSocket:read() return nil end
+
+--- Sends every argument in one batched write
+---@param ... string|Buffer
+---@return true
+function TcpSocket:write(...) return true end
+
+--- Flushes pending writes and closes the connection
+function TcpSocket:close() end
+
+--- Enables or disables Nagle's algorithm
+---@param enable? boolean Defaults to true
+function TcpSocket:setNoDelay(enable) end
+
+---@class TcpServer
+local TcpServer = {}
+
+--- Starts accepting connections
+---@param port integer
+---@param host? string IP address to bind, defaults to `0.0.0.0`
+---@param backlog? integer Defaults to 511
+---@return true
+function TcpServer:listen(port, host, backlog) return true end
+
+--- Stops accepting connections
+function TcpServer:close() end
+
+--- Creates a server, `handler` runs as a new task for every connection
+---@param handler fun(socket: TcpSocket)
+---@return TcpServer
+function reflex.tcp.createServer(handler) return TcpServer end
+
+--- Connects to an IP address. Must be called from within `reflex#async`.
+---@param host string
+---@param port integer
+---@return TcpSocket
+function reflex.tcp.connect(host, port) return TcpSocket end
+
+--- # Reflex HTTP API
+---
+--- HTTP/1.1 server with keep-alive and pipelining. Every request runs its
+--- handler as a task, so handlers can await timers, files and sockets.
+reflex.http = {}
+
+--- An incoming request. Fields are read lazily from the received bytes, so
+--- only what a handler touches is turned into Lua strings.
+---@class HttpRequest
+---@field method string Request method, e.g. `GET`
+---@field url string Request target including the query string
+---@field path string Request target without the query string
+---@field query string|nil Query string without the leading `?`
+---@field version string `HTTP/1.1` or `HTTP/1.0`
+---@field body string Request body, empty when there is none
+---@field headers table<string, string> All headers with lowercased names, built on first access
+local HttpRequest = {}
+
+--- Looks up a single header without building `headers`
+---@param name string Case-insensitive header name
+---@return string|nil value
+function HttpRequest:header(name) return nil end
+
+--- The response to a request. `Content-Length`, `Date` and `Connection` are
+--- set by the server. If the handler returns without sending, an empty
+--- response is sent; if it errors, a 500 is sent.
+---@class HttpResponse
+local HttpResponse = {}
+
+--- Sets the status code, 200 by default
+---@param code integer
+---@return HttpResponse self
+function HttpResponse:setStatus(code) return self end
+
+--- Sets a response header
+---@param name string
+---@param value string
+---@return HttpResponse self
+function HttpResponse:setHeader(name, value) return self end
+
+--- Sends the response, headers and body go out in one batched write
+---@param body? string|Buffer
+function HttpResponse:send(body) end
+
+---@class HttpServer
+local HttpServer = {}
+
+--- Starts accepting connections
+---@param port integer
+---@param host? string IP address to bind, defaults to `0.0.0.0`
+---@param backlog? integer Defaults to 511
+---@return true
+function HttpServer:listen(port, host, backlog) return true end
+
+--- Stops accepting connections, open connections finish their requests
+function HttpServer:close() end
+
+--- Creates a server, `handler` runs as a new task for every request
+---@param handler fun(req: HttpRequest, res: HttpResponse)
+---@return HttpServer
+function reflex.http.createServer(handler) return HttpServer end
+
+--- # Reflex Worker API
+---
+--- Runs scripts on other threads. Every worker has its own state, builtins
+--- and event loop, so nothing is shared: values sent between them are
+--- copied. Only nil, booleans, numbers, strings, Buffers, channels and
+--- tables of those (without cycles) can be sent.
+reflex.worker = {}
+
+--- Connection to another state
+---@class WorkerPort
+local WorkerPort = {}
+
+--- Sends a copy of the values as one message
+---@param ... any
+---@return boolean sent False once the other side stopped receiving or the queue is full
+function WorkerPort:send(...) return true end
+
+--- Waits for the next message. Must be called from within `reflex#async`.
+---@return any ... The values of the message, nil once the other side is done
+function WorkerPort:receive() return nil end
+
+--- Stops sending, the other side receives nil after the queued messages
+function WorkerPort:close() end
+
+--- Port to the state that spawned this worker, nil on the main thread.
+--- It does not keep the worker alive unless a task is receiving from it.
+---@type WorkerPort|nil
+reflex.worker.parent = nil
+
+--- Starts `script` on a new thread. The extra arguments are copied and
+--- passed to the script as `...`. The process stays alive until every
+--- worker has finished.
+---@param script string Path of the script
+---@param ... any Arguments for the script
+---@return WorkerPort worker Port to the new worker
+function reflex.worker.spawn(script, ...) return WorkerPort end
+
+--- # Reflex Channel API
+---
+--- Bounded queues between states. Any state holding a channel can send to
+--- it; channels sent to a worker are shared, not copied. Only one state
+--- receives from a channel, and it wakes up once for a whole batch of
+--- messages.
+reflex.channel = {}
+
+---@class Channel
+local Channel = {}
+
+--- Sends a copy of the values as one message, without waiting
+---@param ... any
+---@return boolean sent False when the channel is full or closed
+function Channel:send(...) return true end
+
+--- Waits for the next message. Must be called from within `reflex#async`.
+--- The first state to receive becomes the only receiver.
+---@return any ... The values of the message, nil once the channel is closed and empty
+function Channel:receive() return nil end
+
+--- Stops accepting messages, the receiver still gets the queued ones
+function Channel:close() end
+
+--- Creates a channel
+---@param capacity? integer Messages the channel holds, rounded up to a power of two (default 1024)
+---@return Channel
+function reflex.channel.new(capacity) return Channel end
+
+--- # Reflex Parallel API
+---
+--- Runs a function over a list on a pool of threads, one per CPU. The pool
+--- starts with the first call and keeps its states for the next ones.
+--- The function is copied to the pool: its upvalues must be values a
+--- channel can send, and globals are the worker state's own builtins.
+--- Outside of a task the call blocks until the pool is done.
+reflex.parallel = {}
+
+--- Calls `fn(item, index)` for every item and returns the first result of
+--- each call, in order
+---@param list any[]
+---@param fn fun(item: any, index: integer): any
+---@return any[] results
+function reflex.parallel.map(list, fn) return {} end
+
+--- Folds the list with `fn`. Chunks of the list are folded in parallel and
+--- then combined in order, so `fn` must be associative.
+---@param list any[]
+---@param fn fun(a: any, b: any): any
+---@param init? any Folded in before the first item
+---@return any result Nil for an empty list without `init`
+function reflex.parallel.reduce(list, fn, init) return nil end
+
+--- # Reflex Modules API
+---
+--- `require` remembers where each module was found in `reflex_deps`,
+--- `package.path` and `package.cpath`, and which names were not found, so
+--- requiring a name again skips the search. Changing either path starts
+--- over, and long-running scripts start over whenever `reflex_deps` changes.
+---
+--- `reflex_deps/<name>.so`, `.dll` on Windows, is loaded as a native module
+--- when there is no `<name>.lua`, see `reflex_module.h` for how to build one.
+reflex.modules = {}
+
+--- Forgets where `name` was found, or every module without a name. Modules
+--- already in `package.loaded` stay loaded.
+---@param name? string Module name
+function reflex.modules.invalidate(name) end
+
+--- Requires `name` again and puts the new module in `package.loaded`.
+--- When the new module has a `__reload` function it is called with the
+--- old module first, to carry state over. On any error the old module
+--- stays. Run with `--hot-reload`, long-running scripts do this whenever the
+--- file of a loaded module is saved, in `reflex_deps` or wherever else it
+--- was found.
+---@param name string Module name
+---@return any module The new module
+function reflex.modules.reload(name) return nil end
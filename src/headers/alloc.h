@@ -0,0 +1,66 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <lua.h>
+#include <stddef.h>
+
+typedef enum {
+    REFLEX_ALLOC_SYSTEM,   // malloc/realloc/free, like luaL_newstate
+    REFLEX_ALLOC_POOL      // Thread-local free lists for blocks up to 256 bytes,
+                           // their slabs are kept for the life of the process
+} ReflexAllocator;
+
+// Allocation counters of the calling thread
+typedef struct {
+    size_t allocations;         // Blocks requested by Lua
+    size_t system_allocations;  // Calls that went to malloc/realloc
+    size_t cached_blocks;       // Free small blocks waiting for reuse
+} ReflexAllocStats;
+
+// Bytes held by one state, counted by reflex_memory_alloc in front of the
+// allocator doing the work
+typedef struct {
+    lua_Alloc alloc;
+    void *ud;
+    size_t live;
+    size_t peak;
+    size_t limit;      // Allocations past it fail, 0 for no limit
+    int headroom;      // Set while a memory error is reported, the limit is not applied
+} ReflexMemory;
+
+// Allocator used by the states created afterwards, the system one by default
+void reflex_set_allocator(ReflexAllocator allocator);
+ReflexAllocator reflex_get_allocator(void);
+
+// Parses "system" or "pool", returns 0 or -1 for an unknown name
+int reflex_allocator_parse(const char *name, ReflexAllocator *allocator);
+const char* reflex_allocator_name(ReflexAllocator allocator);
+
+// lua_Alloc implementing the allocator
+lua_Alloc reflex_allocator_function(ReflexAllocator allocator);
+
+// Bump allocator for disposable states. Freed blocks are only reused when
+// they are the most recent one, everything is released with the arena.
+typedef struct ReflexArena ReflexArena;
+
+// `chunk_size` of 0 picks the default of 64KB
+ReflexArena* reflex_arena_new(size_t chunk_size);
+void reflex_arena_free(ReflexArena *arena);
+
+// lua_Alloc taking a ReflexArena as `ud`
+void* reflex_arena_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+// Memory limit of the states created afterwards, 0 for none
+void reflex_set_memory_limit(size_t limit);
+size_t reflex_get_memory_limit(void);
+
+// lua_Alloc taking a ReflexMemory as `ud`
+void* reflex_memory_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+void reflex_alloc_stats(ReflexAllocStats *stats);
+
+// Hands the blocks cached by the calling thread to the other threads, call
+// once its states are closed
+void reflex_alloc_release_thread(void);
+
+#endif // ALLOC_H
@@ -0,0 +1,37 @@
+#ifndef ASYNC_API_H
+#define ASYNC_API_H
+
+#include "lua_api.h"
+
+// A coroutine started through `reflex.async` (or `reflex_async_spawn`)
+typedef struct ReflexTask ReflexTask;
+
+// Starts the function below `nargs` arguments as a new task. The task runs
+// synchronously until its first await. Pops the function and arguments.
+int reflex_async_spawn(lua_State *L, int nargs);
+
+// Returns the task running on `L`, or NULL outside of a task and when `L`
+// cannot yield (e.g. inside a metamethod called from C)
+ReflexTask* reflex_async_current(lua_State *L);
+
+// Returns the coroutine of the task, completions push their results here
+lua_State* reflex_async_thread(ReflexTask *task);
+
+// Suspends the task with `lua_yieldk`. Must be returned from the C function
+// that started the operation: `return reflex_async_await(L, task);`
+int reflex_async_await(lua_State *L, ReflexTask *task);
+
+// Queues the task to be resumed with the `nresults` values pushed on its thread
+void reflex_async_resume(ReflexTask *task, int nresults);
+
+// Queues the task to be resumed by raising `message` inside of it
+void reflex_async_reject(ReflexTask *task, const char *message);
+
+// Lua functions exposed under `reflex`
+int async_run(lua_State *L);
+int async_sleep(lua_State *L);
+
+// Register `reflex.async`, `reflex.sleep` and the task scheduler
+void define_async_api(LuaAPI *api);
+
+#endif // ASYNC_API_H
@@ -0,0 +1,43 @@
+#ifndef CHANNEL_API_H
+#define CHANNEL_API_H
+
+#include "lua_api.h"
+#include "channel.h"
+#include "apis/async_api.h"
+
+#define CHANNEL_METATABLE "reflex.channel"
+
+// The receiving end of a channel on the loop of one state. Drains every
+// message on a wakeup and hands them out one at a time.
+typedef struct ChannelReceiver ChannelReceiver;
+
+// Called on the loop once the channel is closed and fully drained
+typedef void (*ChannelClosedCallback)(ChannelReceiver *receiver, void *data);
+
+// Binds `channel` to the loop of `L`. Returns NULL when the channel already
+// has a receiver. With `keep_alive` the loop stays open until the channel
+// closes, otherwise only while a task waits in `channel_receiver_receive`.
+ChannelReceiver* channel_receiver_new(lua_State *L, ReflexChannel *channel, int keep_alive,
+    ChannelClosedCallback on_closed, void *data);
+
+// Body of the Lua `receive` methods: returns the values of the next
+// message, nil once the channel is done, or awaits the next message
+int channel_receiver_receive(lua_State *L, ChannelReceiver *receiver);
+
+// Unbinds and frees the receiver, queued messages are dropped
+void channel_receiver_free(ChannelReceiver *receiver);
+
+// Pushes a Channel userdata sharing `channel`, so host code can hand a
+// channel to a state and keep sending to it from its own threads
+void reflex_channel_push(lua_State *L, ReflexChannel *channel);
+
+// Returns the channel of the Channel userdata at `index` or NULL
+ReflexChannel* reflex_channel_test(lua_State *L, int index);
+
+// Functions exposed under `reflex.channel`
+int channel_new(lua_State *L);
+
+// Register the `reflex.channel` table and the Channel metatable
+void define_channel_api(LuaAPI *api);
+
+#endif // CHANNEL_API_H
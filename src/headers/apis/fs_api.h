@@ -0,0 +1,24 @@
+#ifndef FS_API_H
+#define FS_API_H
+
+#include "lua_api.h"
+
+// Filesystem functions exposed under the global `fs` table. Inside a
+// `reflex.async` task they run on the libuv threadpool and resume the task,
+// anywhere else they complete synchronously.
+int fs_api_open(lua_State *L);
+int fs_api_close(lua_State *L);
+int fs_api_read(lua_State *L);
+int fs_api_write(lua_State *L);
+int fs_api_stat(lua_State *L);
+int fs_api_readdir(lua_State *L);
+int fs_api_read_file(lua_State *L);
+int fs_api_write_file(lua_State *L);
+
+// Sets the number of threadpool workers, must run before the first request
+void fs_set_threadpool_size(unsigned int size);
+
+// Register the global `fs` table
+void define_fs_api(LuaAPI *api);
+
+#endif // FS_API_H
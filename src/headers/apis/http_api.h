@@ -0,0 +1,16 @@
+#ifndef HTTP_API_H
+#define HTTP_API_H
+
+#include "lua_api.h"
+
+#define HTTP_SERVER_METATABLE   "reflex.http.server"
+#define HTTP_REQUEST_METATABLE  "reflex.http.request"
+#define HTTP_RESPONSE_METATABLE "reflex.http.response"
+
+// Functions exposed under `reflex.http`
+int http_create_server(lua_State *L);
+
+// Register the `reflex.http` table and the server, request and response metatables
+void define_http_api(LuaAPI *api);
+
+#endif // HTTP_API_H
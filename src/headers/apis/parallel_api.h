@@ -0,0 +1,17 @@
+#ifndef PARALLEL_API_H
+#define PARALLEL_API_H
+
+#include "lua_api.h"
+
+// Number of pool threads, must be called before the first parallel job.
+// Defaults to the number of CPUs.
+void parallel_set_pool_size(unsigned int size);
+
+// Functions exposed under `reflex.parallel`
+int parallel_map(lua_State *L);
+int parallel_reduce(lua_State *L);
+
+// Register the `reflex.parallel` table
+void define_parallel_api(LuaAPI *api);
+
+#endif // PARALLEL_API_H
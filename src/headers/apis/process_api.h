@@ -7,6 +7,8 @@
 // Function declarations for process-related functionalities
 int process_platform(lua_State *L);
 int process_pid(lua_State *L);
+int process_hrtime(lua_State *L);
+int process_memory_usage(lua_State *L);
 
 void define_program_arguments(LuaAPI *api, Args args);
 // Register process global table
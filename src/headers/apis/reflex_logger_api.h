@@ -1,6 +1,9 @@
 #ifndef REFLEX_LOGGER_H
 #define REFLEX_LOGGER_H
 
+// Registry key of the state's level name, set by setLevel
+#define LOGGER_LEVEL_KEY "reflex.logger.level"
+
 void define_logger_api();
 
 #endif
\ No newline at end of file
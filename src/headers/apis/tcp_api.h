@@ -0,0 +1,21 @@
+#ifndef TCP_API_H
+#define TCP_API_H
+
+#include "lua_api.h"
+
+#define TCP_SERVER_METATABLE "reflex.tcp.server"
+#define TCP_SOCKET_METATABLE "reflex.tcp.socket"
+
+// Writes the buffers through `uv_try_write`, queueing whatever the socket
+// did not take with one `uv_write`. The Lua values at `first`..`last` are
+// pinned until the queued write finishes, so nothing is copied.
+int tcp_write_values(lua_State *L, uv_stream_t *stream, int first, int last);
+
+// Functions exposed under `reflex.tcp`
+int tcp_create_server(lua_State *L);
+int tcp_connect(lua_State *L);
+
+// Register the `reflex.tcp` table and the server and socket metatables
+void define_tcp_api(LuaAPI *api);
+
+#endif // TCP_API_H
@@ -0,0 +1,14 @@
+#ifndef TIMER_API_H
+#define TIMER_API_H
+
+#include "lua_api.h"
+
+// Timer functions exposed under `reflex.timer`
+int timer_set_timeout(lua_State *L);
+int timer_set_interval(lua_State *L);
+int timer_clear(lua_State *L);
+
+// Register the `reflex.timer` table and the timer wheel of the state
+void define_timer_api(LuaAPI *api);
+
+#endif // TIMER_API_H
@@ -0,0 +1,14 @@
+#ifndef WORKER_API_H
+#define WORKER_API_H
+
+#include "lua_api.h"
+
+#define WORKER_PORT_METATABLE "reflex.worker.port"
+
+// Functions exposed under `reflex.worker`
+int worker_spawn(lua_State *L);
+
+// Register the `reflex.worker` table and the port metatable
+void define_worker_api(LuaAPI *api);
+
+#endif // WORKER_API_H
@@ -0,0 +1,46 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "lua_api.h"
+#include <stddef.h>
+
+#define BUFFER_METATABLE "reflex.buffer"
+
+// Fixed size slab that incoming data is read into. Reads are carved out of
+// the current block one after another and every Buffer keeps a reference,
+// so the block goes back to the pool once the last view of it is released.
+typedef struct BufferBlock BufferBlock;
+typedef struct BufferPool BufferPool;
+
+// A view of received bytes. `block` is NULL when the view owns nothing.
+typedef struct {
+    BufferBlock *block;
+    const char *data;
+    size_t length;
+} BufferChunk;
+
+// Returns the pool of the state, creating it on first use
+BufferPool* buffer_pool_get(lua_State *L);
+
+// Hands out the free tail of the current block for a read
+void buffer_pool_reserve(BufferPool *pool, char **base, size_t *length);
+
+// Claims `length` bytes at `data` (returned by the last reserve) as a chunk
+BufferChunk buffer_pool_commit(BufferPool *pool, const char *data, size_t length);
+
+// Drops the reference a chunk holds on its block
+void buffer_chunk_release(BufferChunk *chunk);
+
+// Pushes a Buffer userdata that takes over the reference of `chunk`
+void buffer_push(lua_State *L, BufferChunk chunk);
+
+// Returns the Buffer at `index` or raises an argument error
+BufferChunk* buffer_check(lua_State *L, int index);
+
+// Returns the Buffer at `index` or NULL
+BufferChunk* buffer_test(lua_State *L, int index);
+
+// Returns the bytes of a string or Buffer argument, raising for anything else
+const char* buffer_check_bytes(lua_State *L, int index, size_t *length);
+
+#endif // BUFFER_H
@@ -0,0 +1,36 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "lua_api.h"
+
+// Name the entry script is stored under, module names never start with '@'
+#define REFLEX_BUNDLE_MAIN "@main"
+
+// Precompiled chunks that `reflex build` appends to a copy of the
+// executable, indexed by module name
+typedef struct ReflexBundle ReflexBundle;
+
+// Maps the bundle appended to the running executable, once per process.
+// Returns NULL when there is none.
+const ReflexBundle* reflex_bundle_open(void);
+
+// The bundle found by reflex_bundle_open, or NULL
+const ReflexBundle* reflex_bundle_current(void);
+
+// Loads the chunk stored under `name`, LUA_ERRFILE when it is not bundled
+int reflex_bundle_load(lua_State *L, const ReflexBundle *bundle, const char *name);
+
+// Inserts a searcher serving the current bundle into the searchers table
+// at `searchers`, right after package.preload. Does nothing without one.
+void reflex_bundle_install_searcher(lua_State *L, int searchers);
+
+// Called for every module the entry requires, `bundled` is 0 for modules
+// left to the normal search (not in reflex_deps)
+typedef void (*BundleModuleCallback)(const char *name, int bundled, void *data);
+
+// Writes a copy of the running executable to `output` with `entry` and the
+// modules it requires appended. Returns 0, or -1 with `error` set.
+int reflex_bundle_build(const char *entry, const char *output, BundleModuleCallback on_module,
+    void *data, char *error, size_t size);
+
+#endif // BUNDLE_H
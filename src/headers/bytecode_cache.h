@@ -0,0 +1,19 @@
+#ifndef BYTECODE_CACHE_H
+#define BYTECODE_CACHE_H
+
+#include "lua_api.h"
+
+// Turns the cache on or off for the whole process, on by default
+void reflex_cache_set_enabled(int enabled);
+
+// Loads the Lua file at `path` like luaL_loadfile, naming the chunk
+// `chunkname`. The compiled chunk is kept in the user's cache directory,
+// $XDG_CACHE_HOME/reflex or ~/.cache/reflex, keyed by the absolute path,
+// mtime, size and Lua release, and loaded from there while it is fresh.
+// Lua does not verify bytecode, so the directory must be private to the
+// user and entries owned by someone else are ignored. Pipes and devices
+// are streamed and never cached. Returns LUA_ERRFILE with a message when
+// the file cannot be read.
+int reflex_load_cached(lua_State *L, const char *path, const char *chunkname);
+
+#endif // BYTECODE_CACHE_H
@@ -0,0 +1,46 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <uv.h>
+#include <stddef.h>
+
+#define REFLEX_CHANNEL_CAPACITY 1024
+
+// A message queued on a channel, `data` holds serialized values
+typedef struct ReflexMessage {
+    struct ReflexMessage *next;
+    size_t length;
+    char data[];
+} ReflexMessage;
+
+// Bounded lock-free queue of messages between threads. Any number of
+// threads may send, a single loop receives: it binds a `uv_async_t` that
+// is signalled once per batch of messages and when the channel closes.
+//
+// Host code embedding a LuaAPI can create a channel, hand it to a state
+// with `reflex_channel_push` and send from any of its own threads.
+typedef struct ReflexChannel ReflexChannel;
+
+// Creates a channel holding one reference, `capacity` is rounded up to a
+// power of two
+ReflexChannel* reflex_channel_new(size_t capacity);
+void reflex_channel_retain(ReflexChannel *channel);
+void reflex_channel_release(ReflexChannel *channel);
+
+// Copies `data` into a new message. Returns 0, UV_EAGAIN when the channel
+// is full, UV_EPIPE once it is closed or UV_ENOMEM.
+int reflex_channel_send(ReflexChannel *channel, const char *data, size_t length);
+
+// No more messages can be sent, the receiver still drains what is queued
+void reflex_channel_close(ReflexChannel *channel);
+
+// Sets the handle signalled for the receiver, NULL before closing the
+// handle. Returns UV_EBUSY when another handle is already bound.
+int reflex_channel_bind(ReflexChannel *channel, uv_async_t *async);
+
+// Takes every queued message in order, the caller frees them. Only the
+// bound receiver may call this. `closed` is set once the channel is closed
+// and nothing more will arrive.
+ReflexMessage* reflex_channel_drain(ReflexChannel *channel, int *closed);
+
+#endif // CHANNEL_H
@@ -0,0 +1,25 @@
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include "lua_api.h"
+
+// Read-only view of a whole regular file, mapped instead of copied
+typedef struct {
+    const char *data;
+    size_t length;
+} ReflexFileMap;
+
+// Returns 0, or -1 when the file cannot be opened or is not a regular file
+int reflex_file_map(const char *path, ReflexFileMap *map);
+void reflex_file_unmap(ReflexFileMap *map);
+
+// Loads a Lua chunk from `data` through lua_load, skipping a leading
+// `#!` line like luaL_loadfile does
+int reflex_load_mapped(lua_State *L, const char *data, size_t length, const char *chunkname, const char *mode);
+
+// Loads the file at `path` through lua_load without a copy of it in memory:
+// regular files are mapped, pipes and devices (e.g. /dev/stdin) are read in
+// blocks. Returns LUA_ERRFILE with a message when it cannot be read.
+int reflex_load_file(lua_State *L, const char *path, const char *chunkname, const char *mode);
+
+#endif // FILE_LOADER_H
@@ -0,0 +1,45 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include "lua_api.h"
+
+typedef enum {
+    REFLEX_LOG_DEBUG,
+    REFLEX_LOG_INFO,
+    REFLEX_LOG_WARN,
+    REFLEX_LOG_ERROR
+} ReflexLogLevel;
+
+typedef enum {
+    REFLEX_LOG_TEXT,       // Colored "INFO: message key=value" lines
+    REFLEX_LOG_JSON        // One JSON object per line
+} ReflexLogFormat;
+
+// Lowest level new states log, debug by default. Each state's
+// reflex.logger gets no-op functions for the levels below it.
+void reflex_log_set_level(ReflexLogLevel level);
+ReflexLogLevel reflex_log_get_level(void);
+
+// Parses "debug", "info", "warn" or "error", returns 0 or -1
+int reflex_log_level_parse(const char *name, ReflexLogLevel *level);
+const char* reflex_log_level_name(ReflexLogLevel level);
+
+// "INFO: " for text records, with color escapes when `color` is set
+const char* reflex_log_level_label(ReflexLogLevel level, int color);
+
+// Format of the records written afterwards by every thread, text by default
+void reflex_log_set_format(ReflexLogFormat format);
+ReflexLogFormat reflex_log_get_format(void);
+
+// Parses "text" or "json", returns 0 or -1 for an unknown name
+int reflex_log_format_parse(const char *name, ReflexLogFormat *format);
+
+// Formats the message at `message` with the fields of the table at
+// `fields` (0 for none) into the thread's record buffer and queues it for
+// the log writer. Strings, numbers and booleans are written in place.
+void reflex_log_record(lua_State *L, ReflexLogLevel level, int message, int fields);
+
+// Frees the calling thread's record buffer, for threads that are done
+void reflex_log_release_thread(void);
+
+#endif // LOG_FORMAT_H
@@ -0,0 +1,45 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Log records go through a process-wide ring that any thread writes into
+// without locking or allocating. A background thread with its own loop
+// drains it to stdout with batched writev and into the file sinks, so
+// logging never waits for the terminal, pipe or disk unless the ring is full.
+
+typedef struct {
+    size_t block_size;           // Records are grouped into blocks this large
+    unsigned int flush_interval; // Milliseconds a partial block waits at most
+    unsigned long long max_size; // Rotates before the file grows past it, 0 never
+    unsigned int rotate_every;   // Seconds a file is written before it rotates, 0 never
+    const char *compress;        // Command run with each rotated file as last argument, or NULL
+} ReflexLogFileOptions;
+
+#define REFLEX_LOG_BLOCK_SIZE (64 * 1024)
+#define REFLEX_LOG_FLUSH_INTERVAL 1000
+
+#define REFLEX_LOG_UNLABELED -1
+
+// Queues the `count` pieces as one record, started on the first record.
+// `level` is a ReflexLogLevel whose label goes in front of the record,
+// colored on a terminal stdout only, or REFLEX_LOG_UNLABELED.
+void reflex_log_writev(int level, const struct iovec *parts, int count);
+
+// Waits until every record queued before the call has been written
+void reflex_log_flush(void);
+
+// Waits until the records queued by the calling thread have reached
+// stdout, so what the thread prints next comes out after them. Returns
+// at once when they already have.
+void reflex_log_sync(void);
+
+// Also writes every record to `path`, appending to it. Returns 0, or a
+// negative uv error code such as UV_EEXIST when the file is already a sink.
+int reflex_log_add_file(const char *path, const ReflexLogFileOptions *options);
+
+// Stops or resumes writing records to stdout
+void reflex_log_set_stdout(int enabled);
+
+#endif // LOG_WRITER_H
@@ -0,0 +1,17 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "lua_api.h"
+
+// Returns the event loop owned by the state
+uv_loop_t* reflex_get_loop(lua_State *L);
+
+// Runs the event loop until no active handles or requests remain.
+// Returns 0 on a clean drain, 1 if a callback raised an uncaught error.
+int reflex_loop_run(LuaAPI *api);
+
+// Calls the function below `nargs` arguments from a loop callback.
+// Errors are reported through `lua_error_handler` and stop the loop.
+int reflex_loop_call(lua_State *L, int nargs, int nresults);
+
+#endif // LOOP_H
@@ -4,11 +4,24 @@
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <uv.h>
+#include "alloc.h"
 
 typedef struct {
     lua_State *L;
+    uv_loop_t *loop;     // Event loop driven after the main chunk returns
+    int loop_error;      // Set when a callback raised an error inside the loop
+    ReflexMemory memory; // Bytes allocated by the state
+    ReflexArena *arena;  // Backs the state when created by reflex_new_arena
 } LuaAPI;
 
+// `data` of every handle on a state's loop is NULL or points to a struct
+// starting with this. reflex_free closes the handles still open with
+// `close`, so their owner releases them as it would have.
+typedef struct {
+    uv_close_cb close;   // NULL when the handle's memory belongs to the state
+} ReflexHandle;
+
 typedef enum {
     REFLEX_TYPE_NUMBER,
     REFLEX_TYPE_STRING,
@@ -20,9 +33,20 @@ typedef enum {
 
 // API management functions
 LuaAPI* reflex_new();
+// Disposable state for short-lived work, see ReflexArena. A chunk_size of 0
+// picks the default.
+LuaAPI* reflex_new_arena(size_t chunk_size);
 LuaAPI* reflex_from(lua_State* L);
 void reflex_free(LuaAPI *api);
 
+// Returns the LuaAPI that owns the state (or any coroutine created from it)
+LuaAPI* reflex_get_api(lua_State *L);
+
+// Replaces the memory error on top of the stack with one naming the limit
+// and lifts the limit until reflex_memory_restore, so the error can be reported
+void reflex_memory_error(lua_State *L);
+void reflex_memory_restore(lua_State *L);
+
 // Registration functions
 void reflex_register_function(LuaAPI *api, const char *name, lua_CFunction func);
 void reflex_register_function_L(lua_State *L, const char *name, lua_CFunction func);
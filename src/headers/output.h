@@ -0,0 +1,23 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "lua_api.h"
+
+// Every state prints to the same stdout stream. Buffered, it is written in
+// large blocks instead of once per line, and flushed at exit, whenever a
+// loop is about to wait for events and before errors and log records.
+
+// Picks the mode before anything is printed: buffered when `force` is set
+// or stdout is not a terminal
+void reflex_output_configure(int force);
+int reflex_output_buffered(void);
+
+// Writes out whatever is buffered
+void reflex_output_flush(void);
+
+// Replaces `print` with one that does not flush every line, and that like
+// io.write comes out after the records the thread logged before. In
+// buffered mode, also flushes when the state's loop goes idle.
+void reflex_output_init(LuaAPI *api);
+
+#endif // OUTPUT_H
@@ -0,0 +1,13 @@
+#ifndef PRECOMPILE_H
+#define PRECOMPILE_H
+
+#include "lua_api.h"
+
+// Finds every module in reflex_deps that the script at `entry` requires,
+// directly or through other modules, by scanning for require("...")
+// literals, and compiles them on a pool of threads. Each require of one of
+// them then only runs the compiled chunk. Modules that fail to compile are
+// left for require to report. Returns how many modules were compiled.
+int reflex_precompile(lua_State *L, const char *entry);
+
+#endif // PRECOMPILE_H
@@ -0,0 +1,55 @@
+#ifndef REFLEX_MODULE_H
+#define REFLEX_MODULE_H
+
+#include "lua_api.h"
+
+// Native modules are shared objects in reflex_deps: require("name") loads
+// reflex_deps/name.so (name.dll on Windows) when there is no name.lua. A
+// module is built against this header and linked with `-shared -fPIC`, plus
+// `-undefined dynamic_lookup` on macOS or the executable's import library
+// binout/libreflex.a on Windows, the Lua and Reflex functions are resolved
+// from the running executable:
+//
+//     #include "reflex_module.h"
+//
+//     static int add(lua_State *L) {
+//         lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+//         return 1;
+//     }
+//
+//     REFLEX_MODULE_INIT {
+//         lua_newtable(api->L);
+//         lua_pushcfunction(api->L, add);
+//         lua_setfield(api->L, -2, "add");
+//         return 1;
+//     }
+
+// Bumped whenever LuaAPI or the helpers in lua_api.h change incompatibly,
+// modules built for another version are refused
+#define REFLEX_MODULE_ABI 1
+
+// Called with the state's LuaAPI, which stays valid as long as the state
+// and may be kept. During the call api->L is the requiring thread, later
+// it is the state's main thread again. Pushes the value of the module,
+// like the return value of a Lua module, and returns how many values it
+// pushed.
+typedef int (*ReflexModuleInit)(LuaAPI *api);
+
+#if defined(_WIN32)
+#define REFLEX_MODULE_EXPORT __declspec(dllexport)
+#else
+#define REFLEX_MODULE_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+#define REFLEX_MODULE_LINKAGE extern "C" REFLEX_MODULE_EXPORT
+#else
+#define REFLEX_MODULE_LINKAGE REFLEX_MODULE_EXPORT
+#endif
+
+// Defines the entry point and the ABI version it was built for
+#define REFLEX_MODULE_INIT \
+    REFLEX_MODULE_LINKAGE const int reflex_module_abi = REFLEX_MODULE_ABI; \
+    REFLEX_MODULE_LINKAGE int reflex_module_init(LuaAPI *api)
+
+#endif // REFLEX_MODULE_H
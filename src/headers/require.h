@@ -2,6 +2,11 @@
 #define REQUIRE_H
 
 #include "lua_api.h"
+#include <stddef.h>
+
+// Registry keys of the module lookups and of the precompiled chunks
+#define REQUIRE_CACHE_KEY "reflex.require.cache"
+#define REQUIRE_COMPILED_KEY "reflex.require.compiled"
 
 // Initializes the package system (modifies `package` to support custom modules)
 void reflex_require_init(LuaAPI *api);
@@ -15,4 +20,34 @@ int reflex_register_package(lua_State *L, const char *package_name, const char *
 // Sets the package search path
 void reflex_set_package_path(const char *path);
 
+// Calls `found` with every module name passed to require as a string
+// literal: require("a"), require "a" or require 'a'. Names built at runtime
+// are not seen.
+typedef void (*RequireFound)(const char *name, size_t length, void *data);
+void reflex_scan_requires(const char *source, size_t length, RequireFound found, void *data);
+
+// Forgets where module `name` was found or that it was not, every module
+// when `name` is NULL. Changing package.path or package.cpath does the same.
+void reflex_require_invalidate(lua_State *L, const char *name);
+
+// Requires module `name` again and swaps it into package.loaded. When the
+// new module has a __reload function it is called with the old module
+// first, to carry state over. Pushes the new module, or the error message
+// with the old module left in place.
+int reflex_require_reload(lua_State *L, const char *name);
+
+// Drops the cached lookups whenever something in reflex_deps, or in another
+// directory a module was found in, changes and, with `reload`, reloads the
+// loaded modules whose files changed. Meant for long-running scripts, the
+// watch does not keep the loop alive. Returns 0 or a libuv error, e.g.
+// when there is no reflex_deps.
+int reflex_require_watch(LuaAPI *api, int reload);
+
+// Hands require the bytecode of reflex_deps module `name`, compiled ahead
+// of time. The next require of the name runs it instead of reading the file.
+void reflex_require_add_compiled(lua_State *L, const char *name, const char *code, size_t length);
+
+// Path of module `name` in reflex_deps, returns 0 or -1 when it does not fit
+int reflex_module_path(const char *name, char *path, size_t size);
+
 #endif // REQUIRE_H
@@ -0,0 +1,37 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "lua_api.h"
+#include <stddef.h>
+
+// Values copied between states are flattened into this buffer. Supported are
+// nil, booleans, numbers, strings, Buffers (sent as strings), channels (sent
+// by reference) and tables of those, without cycles. The data holds a
+// reference on every channel in it until serial_release_channels.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int channels;       // Channel references written
+    char error[128];    // Set when serializing fails
+} SerialBuffer;
+
+void serial_buffer_init(SerialBuffer *buffer);
+void serial_buffer_free(SerialBuffer *buffer);
+
+// Appends raw bytes, returns 0 or -1 with `error` set
+int serial_buffer_append(SerialBuffer *buffer, const void *data, size_t length);
+
+// Appends the values `first`..`last` of `L`. Returns 0, or -1 with `error` set.
+int reflex_serialize(lua_State *L, int first, int last, SerialBuffer *buffer);
+
+// Pushes every value in `data` onto `L`. Returns how many were pushed, or -1
+// when the data is malformed. The channels pushed hold references of their
+// own, the data can be read again.
+int reflex_deserialize(lua_State *L, const char *data, size_t length);
+
+// Gives back the channel references of serialized data that is dropped,
+// also when it was cut short by a failed reflex_serialize
+void serial_release_channels(const char *data, size_t length);
+
+#endif // SERIALIZE_H
@@ -0,0 +1,23 @@
+#ifndef STATE_POOL_H
+#define STATE_POOL_H
+
+#include "lua_api.h"
+
+// States with the builtins loaded, handed out for one unit of work (e.g. a
+// request) and reset on return instead of being rebuilt
+typedef struct ReflexStatePool ReflexStatePool;
+
+// Builds `size` states up front, the pool keeps at most that many
+ReflexStatePool* reflex_state_pool_new(int size);
+void reflex_state_pool_free(ReflexStatePool *pool);
+
+// Takes an idle state, or builds a new one when none is left. Thread safe.
+LuaAPI* reflex_state_pool_acquire(ReflexStatePool *pool);
+
+// Gives the state's loop one turn without waiting, resets its globals, every
+// builtin table, its logger level and its module lookups to how they were
+// after the builtins were defined, and keeps it for the next acquire. A state whose loop still has work (timers,
+// servers, sockets, pending tasks) is freed instead. Thread safe.
+void reflex_state_pool_release(ReflexStatePool *pool, LuaAPI *api);
+
+#endif // STATE_POOL_H
@@ -5,7 +5,18 @@
 #include "apis/process_api.h"
 #include "reflex_api.h"
 #include "logger.h"
+#include "loop.h"
+#include "apis/fs_api.h"
+#include "alloc.h"
+#include "bytecode_cache.h"
+#include "bundle.h"
+#include "require.h"
+#include "precompile.h"
+#include "log_writer.h"
+#include "log_format.h"
+#include "output.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -52,10 +63,20 @@ void print_help() {
     
     printlogf(BOLD "COMMANDS:\n" RESET);
     printlogf("  %srun%s <file.lua>     %sExecutes the specified Lua file%s\n", GREEN, RESET, DIM, RESET);
+    printlogf("  %sbuild%s <file.lua> -o <output>  %sBundles the file and its modules into one executable%s\n", GREEN, RESET, DIM, RESET);
     printlogf("  %shelp%s               %sShow this help message%s\n\n", GREEN, RESET, DIM, RESET);
     
     printlogf(BOLD "OPTIONS:\n" RESET);
     printlogf("  %s--debug%s            Enable debug mode (additional info)\n", YELLOW, RESET);
+    printlogf("  %s--threadpool-size%s <n>  Number of threads serving async fs requests\n", YELLOW, RESET);
+    printlogf("  %s--allocator%s <name>  Lua allocator: system (default) or pool\n", YELLOW, RESET);
+    printlogf("  %s--max-memory%s <size>  Memory limit of each Lua state, e.g. 512K, 64M or 2G\n", YELLOW, RESET);
+    printlogf("  %s--no-cache%s         Always compile scripts instead of using the bytecode cache\n", YELLOW, RESET);
+    printlogf("  %s--precompile%s       Compile the modules the script requires on every core before it runs\n", YELLOW, RESET);
+    printlogf("  %s--hot-reload%s       Reload required modules when their files change\n", YELLOW, RESET);
+    printlogf("  %s--log-format%s <name>  reflex.logger output: text (default) or json, one object per line\n", YELLOW, RESET);
+    printlogf("  %s--buffer-output%s    Write stdout in large blocks on a terminal too, it always is when piped\n", YELLOW, RESET);
+    printlogf("  %s--log-level%s <name>  Lowest reflex.logger level written: debug (default), info, warn or error\n", YELLOW, RESET);
     printlogf("  %s--%s                 Separate Reflex arguments from Lua script arguments\n\n", YELLOW, RESET);
     
     printlogf(BOLD "EXAMPLES:\n" RESET);
@@ -91,6 +112,7 @@ void print_execution_start(const char *filename) {
 }
 
 void print_execution_end(bool success) {
+    reflex_log_flush();
     printlogf("%s\n", DIM SEPARATOR RESET);
     if (success) {
         print_success("Execution completed successfully");
@@ -122,6 +144,78 @@ void split_args_at_double_dash(Args *args, Args *reflex_args, Args *lua_args) {
     lua_args->values = &args->values[split_index + 1];
 }
 
+// Parses a byte count with an optional K, M or G suffix, returns 0 when invalid
+static size_t parse_size(const char *value) {
+    char *end;
+    unsigned long long size = strtoull(value, &end, 10);
+    if (end == value) {
+        return 0;
+    }
+
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    return *end == '\0' ? (size_t)size : 0;
+}
+
+static void print_bundled_module(const char *name, int bundled, void *data) {
+    (void)data;
+    if (bundled) {
+        printlogf("  %s %s\n", GREEN CHECK_MARK RESET, name);
+    } else {
+        printlogf("  %s %s %s(not in reflex_deps, left to require)%s\n", YELLOW WARNING_SYMBOL RESET, name, DIM, RESET);
+    }
+}
+
+// Executable name for `reflex build app.lua`: app
+static void default_build_output(const char *entry, char *output, size_t size) {
+    const char *name = strrchr(entry, '/');
+    name = name ? name + 1 : entry;
+    snprintf(output, size, "%s", name);
+    size_t length = strlen(output);
+    if (length > 4 && strcmp(output + length - 4, ".lua") == 0) {
+        output[length - 4] = '\0';
+    }
+}
+
+// A binary made by `reflex build` runs its bundled script, every argument
+// is passed through to the script
+static int run_bundle(const ReflexBundle *bundle, Args *args) {
+    LuaAPI *api = reflex_new();
+    if (!api) {
+        return 1;
+    }
+    define_reflex_builtin(api);
+
+    Args lua_args = { args->count - 1, args->values + 1 };
+    if (lua_args.count > 0) {
+        define_program_arguments(api, lua_args);
+    }
+
+    lua_pushcfunction(api->L, lua_error_handler);
+    int error_handler_idx = lua_gettop(api->L);
+
+    int result = reflex_bundle_load(api->L, bundle, REFLEX_BUNDLE_MAIN);
+    if (result == LUA_OK) {
+        result = lua_pcall(api->L, 0, 0, error_handler_idx);
+        if (result == LUA_ERRMEM) {
+            reflex_memory_error(api->L);
+            lua_error_handler(api->L);
+            reflex_memory_restore(api->L);
+        }
+        if (result == LUA_OK) {
+            result = reflex_loop_run(api);
+        }
+    } else {
+        lua_error_handler(api->L);
+    }
+
+    reflex_free(api);
+    return result != 0 ? 1 : 0;
+}
+
 int handle_command(LuaAPI *api, Args *args) {
     Command cmd = args_parse_command(args);
 
@@ -143,15 +237,6 @@ int handle_command(LuaAPI *api, Args *args) {
             return 1;
         }
 
-        const char *contents = fs_read(fileName);
-        if (!contents) {
-            print_error("Failed to read file");
-            printlogf("  %s%s File not found: %s%s\n\n", RED, ARROW_RIGHT, fileName, RESET);
-            return 1;
-        }
-        
-        define_reflex_builtin(api);
-
         Args reflex_args = {0}, lua_args = {0};
         split_args_at_double_dash(args, &reflex_args, &lua_args);
 
@@ -160,6 +245,71 @@ int handle_command(LuaAPI *api, Args *args) {
             print_info("Debug mode enabled");
         }
 
+        const char *max_memory = args_get_value(&reflex_args, "--max-memory");
+        if (max_memory) {
+            size_t limit = parse_size(max_memory);
+            if (limit == 0) {
+                print_error("Invalid value for --max-memory");
+                return 1;
+            }
+            // Workers and other states started by the script get the same limit
+            reflex_set_memory_limit(limit);
+            api->memory.limit = limit;
+        }
+
+        const char *threadpool_size = args_get_value(&reflex_args, "--threadpool-size");
+        if (threadpool_size) {
+            int size = atoi(threadpool_size);
+            if (size <= 0) {
+                print_error("Invalid value for --threadpool-size");
+                return 1;
+            }
+            fs_set_threadpool_size((unsigned int)size);
+        }
+
+        if (args_has_flag(&reflex_args, "--no-cache")) {
+            reflex_cache_set_enabled(0);
+        }
+
+        const char *log_format = args_get_value(&reflex_args, "--log-format");
+        if (log_format) {
+            ReflexLogFormat format;
+            if (reflex_log_format_parse(log_format, &format) != 0) {
+                print_error("Invalid value for --log-format, expected text or json");
+                return 1;
+            }
+            reflex_log_set_format(format);
+        }
+
+        const char *log_level = args_get_value(&reflex_args, "--log-level");
+        if (log_level) {
+            ReflexLogLevel level;
+            if (reflex_log_level_parse(log_level, &level) != 0) {
+                print_error("Invalid value for --log-level, expected debug, info, warn or error");
+                return 1;
+            }
+            reflex_log_set_level(level);
+        }
+
+        // Compiled before the builtins exist, the chunk only captures the
+        // global table they are added to
+        int load_status = reflex_load_cached(api->L, fileName, fileName);
+        if (load_status == LUA_ERRFILE) {
+            print_error("Failed to read file");
+            printlogf("  %s%s File not found: %s%s\n\n", RED, ARROW_RIGHT, fileName, RESET);
+            return 1;
+        }
+        int chunk_idx = lua_gettop(api->L);
+
+        define_reflex_builtin(api);
+
+        if (load_status == LUA_OK && args_has_flag(&reflex_args, "--precompile")) {
+            int compiled = reflex_precompile(api->L, fileName);
+            if (debug_mode) {
+                printlogf("%s Precompiled %d module(s)\n", BLUE INFO_SYMBOL, compiled);
+            }
+        }
+
         if (lua_args.count > 0) {
             if (debug_mode) {
                 printlogf("%s Passing %d argument(s) to Lua script\n", BLUE INFO_SYMBOL, lua_args.count);
@@ -173,12 +323,11 @@ int handle_command(LuaAPI *api, Args *args) {
 
         print_execution_start(fileName);
 
-        // Set up the error handler before loading the script
+        // Set up the error handler beneath the loaded script
         lua_pushcfunction(api->L, lua_error_handler);
-        int error_handler_idx = lua_gettop(api->L);
+        lua_insert(api->L, chunk_idx);
+        int error_handler_idx = chunk_idx;
 
-        // Load the script
-        int load_status = luaL_loadbuffer(api->L, contents, strlen(contents), fileName);
         if (load_status != 0) {
             // Handle syntax errors during loading
             const char *error_msg = lua_tostring(api->L, -1);
@@ -203,14 +352,67 @@ int handle_command(LuaAPI *api, Args *args) {
         
         // Execute the script with error handler
         int result = lua_pcall(api->L, 0, LUA_MULTRET, error_handler_idx);
+        if (result == LUA_ERRMEM) {
+            // Memory errors skip the message handler
+            reflex_memory_error(api->L);
+            lua_error_handler(api->L);
+            reflex_memory_restore(api->L);
+        }
         
         // Remove the error handler from the stack
         lua_remove(api->L, error_handler_idx);
+
+        // Keep the process alive until every timer, socket and request
+        // registered by the main chunk has finished. Servers and other
+        // long-running scripts see changes to reflex_deps.
+        if (result == 0) {
+            if (uv_loop_alive(api->loop)) {
+                reflex_require_watch(api, args_has_flag(&reflex_args, "--hot-reload"));
+            }
+            result = reflex_loop_run(api);
+        }
         
+        if (debug_mode) {
+            ReflexAllocStats stats;
+            reflex_alloc_stats(&stats);
+            printlogf("%s Allocator %s: %zu allocations, %zu from the system, %zu blocks cached\n", BLUE INFO_SYMBOL,
+                reflex_allocator_name(reflex_get_allocator()), stats.allocations, stats.system_allocations,
+                stats.cached_blocks);
+        }
+
         print_execution_end(result == 0);
         return result != 0 ? 1 : 0;
     }
 
+    if (cmd.command && strcmp(cmd.command, "build") == 0) {
+        if (cmd.value_count == 0) {
+            print_error("No file specified for 'build' command");
+            printlogf("Try %sreflex help%s for usage information\n\n", BOLD, RESET);
+            return 1;
+        }
+
+        const char *entry = cmd.values[0];
+        char default_output[256];
+        const char *output = args_get_value(args, "-o");
+        if (!output) {
+            default_build_output(entry, default_output, sizeof(default_output));
+            output = default_output;
+        }
+
+        printlogf("\n%s %sBundling%s %s%s%s\n", ARROW_RIGHT, DIM, RESET, BOLD, entry, RESET);
+        char error[512];
+        if (reflex_bundle_build(entry, output, print_bundled_module, NULL, error, sizeof(error)) != 0) {
+            print_error("Build failed");
+            printlogf("  %s%s %s%s\n\n", RED, ARROW_RIGHT, error, RESET);
+            return 1;
+        }
+
+        char message[512];
+        snprintf(message, sizeof(message), "Built %s", output);
+        print_success(message);
+        return 0;
+    }
+
     print_error("Unknown command");
     printlogf("%s Unknown command: '%s'\n", ARROW_RIGHT, cmd.command);
     printlogf("%s Try %sreflex help%s for usage information\n\n", ARROW_RIGHT, BOLD, RESET);
@@ -218,6 +420,13 @@ int handle_command(LuaAPI *api, Args *args) {
 }
 
 int main(int argc, char *argv[]) {
+    const ReflexBundle *bundle = reflex_bundle_open();
+    if (bundle) {
+        reflex_output_configure(0);
+        Args args = args_parse(argc, argv);
+        return run_bundle(bundle, &args);
+    }
+
     if (argc == 1) {
         print_logo();
         printlogf("%s Run %sreflex help%s for usage information\n\n", INFO_SYMBOL, BOLD, RESET);
@@ -225,6 +434,23 @@ int main(int argc, char *argv[]) {
     }
 
     Args args = args_parse(argc, argv);
+
+    // The state is created before the command runs, so the allocator is
+    // picked here
+    Args reflex_args = {0}, lua_args = {0};
+    split_args_at_double_dash(&args, &reflex_args, &lua_args);
+    reflex_output_configure(args_has_flag(&reflex_args, "--buffer-output"));
+    const char *allocator_name = args_get_value(&reflex_args, "--allocator");
+    if (allocator_name) {
+        ReflexAllocator allocator;
+        if (reflex_allocator_parse(allocator_name, &allocator) != 0) {
+            print_error("Invalid value for --allocator");
+            args_free(&args);
+            return 1;
+        }
+        reflex_set_allocator(allocator);
+    }
+
     LuaAPI* api = reflex_new();
 
     // Handle the commands
@@ -0,0 +1,352 @@
+#include "alloc.h"
+#include <uv.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_CLASS_SIZE 16
+#define ALLOC_CLASS_COUNT 16             // 16 to 256 bytes
+#define ALLOC_MAX_SMALL (ALLOC_CLASS_SIZE * ALLOC_CLASS_COUNT)
+#define ALLOC_SLAB_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct AllocBlock {
+    struct AllocBlock *next;
+} AllocBlock;
+
+// Free blocks of one size class. The tail lets a whole list be moved in
+// one step.
+typedef struct {
+    AllocBlock *head;
+    AllocBlock *tail;
+    size_t count;
+} AllocList;
+
+// Lua passes the size of a block back when it frees or resizes it, so
+// small blocks carry no header and go back to the list of their class.
+// Blocks freed on another thread simply move to that thread's lists.
+typedef struct {
+    AllocList lists[ALLOC_CLASS_COUNT];
+    char *bump;                // Rest of the current slab
+    size_t bump_left;
+    ReflexAllocStats stats;
+} AllocCache;
+
+static _Thread_local AllocCache cache;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    char *top;
+    char *end;
+} ArenaChunk;
+
+struct ReflexArena {
+    ArenaChunk *head;      // Chunk being bumped, older ones follow
+    size_t chunk_size;
+    char *last;            // Most recent block, the only one that can be undone
+};
+
+// Blocks of threads that are done, adopted once a thread runs out of slab.
+// Slabs are never returned to the system.
+static struct {
+    uv_mutex_t lock;
+    AllocList lists[ALLOC_CLASS_COUNT];
+} depot;
+
+static uv_once_t depot_once = UV_ONCE_INIT;
+static ReflexAllocator current_allocator = REFLEX_ALLOC_SYSTEM;
+static size_t memory_limit = 0;
+
+static void depot_init(void) {
+    uv_mutex_init(&depot.lock);
+}
+
+void reflex_set_allocator(ReflexAllocator allocator) {
+    current_allocator = allocator;
+}
+
+ReflexAllocator reflex_get_allocator(void) {
+    return current_allocator;
+}
+
+int reflex_allocator_parse(const char *name, ReflexAllocator *allocator) {
+    if (strcmp(name, "system") == 0) {
+        *allocator = REFLEX_ALLOC_SYSTEM;
+    } else if (strcmp(name, "pool") == 0) {
+        *allocator = REFLEX_ALLOC_POOL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* reflex_allocator_name(ReflexAllocator allocator) {
+    return allocator == REFLEX_ALLOC_POOL ? "pool" : "system";
+}
+
+void reflex_set_memory_limit(size_t limit) {
+    memory_limit = limit;
+}
+
+size_t reflex_get_memory_limit(void) {
+    return memory_limit;
+}
+
+// Failing an allocation makes Lua collect garbage and retry before it
+// raises a memory error. Shrinking and freeing never fail.
+void* reflex_memory_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    ReflexMemory *memory = (ReflexMemory*)ud;
+    size_t old = ptr ? osize : 0;
+
+    if (nsize > old && memory->limit && !memory->headroom && memory->live - old + nsize > memory->limit) {
+        return NULL;
+    }
+
+    void *data = memory->alloc(memory->ud, ptr, osize, nsize);
+    if (data || nsize == 0) {
+        memory->live = memory->live - old + nsize;
+        if (memory->live > memory->peak) {
+            memory->peak = memory->live;
+        }
+    }
+    return data;
+}
+
+void reflex_alloc_stats(ReflexAllocStats *stats) {
+    *stats = cache.stats;
+    stats->cached_blocks = 0;
+    for (int i = 0; i < ALLOC_CLASS_COUNT; i++) {
+        stats->cached_blocks += cache.lists[i].count;
+    }
+}
+
+// Appends all of `from` to `to` and empties it
+static void list_splice(AllocList *to, AllocList *from) {
+    if (!from->head) {
+        return;
+    }
+    if (to->tail) {
+        to->tail->next = from->head;
+    } else {
+        to->head = from->head;
+    }
+    to->tail = from->tail;
+    to->count += from->count;
+    *from = (AllocList){0};
+}
+
+static void* system_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud;
+    (void)osize;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    cache.stats.allocations++;
+    cache.stats.system_allocations++;
+    return realloc(ptr, nsize);
+}
+
+static AllocBlock* list_pop(AllocList *list) {
+    AllocBlock *block = list->head;
+    if (block) {
+        list->head = block->next;
+        if (!list->head) {
+            list->tail = NULL;
+        }
+        list->count--;
+    }
+    return block;
+}
+
+static void* small_take(int index) {
+    AllocBlock *block = list_pop(&cache.lists[index]);
+    if (block) {
+        return block;
+    }
+
+    size_t size = (size_t)(index + 1) * ALLOC_CLASS_SIZE;
+    if (cache.bump_left < size) {
+        uv_once(&depot_once, depot_init);
+        uv_mutex_lock(&depot.lock);
+        list_splice(&cache.lists[index], &depot.lists[index]);
+        uv_mutex_unlock(&depot.lock);
+        block = list_pop(&cache.lists[index]);
+        if (block) {
+            return block;
+        }
+
+        char *slab = (char*)malloc(ALLOC_SLAB_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        cache.stats.system_allocations++;
+        cache.bump = slab;
+        cache.bump_left = ALLOC_SLAB_SIZE;
+    }
+
+    void *data = cache.bump;
+    cache.bump += size;
+    cache.bump_left -= size;
+    return data;
+}
+
+static void small_give(void *ptr, int index) {
+    AllocList *list = &cache.lists[index];
+    AllocBlock *block = (AllocBlock*)ptr;
+    block->next = list->head;
+    if (!list->head) {
+        list->tail = block;
+    }
+    list->head = block;
+    list->count++;
+}
+
+// Size class of a block, or -1 when it is left to malloc
+static int small_class(size_t size) {
+    return size <= ALLOC_MAX_SMALL ? (int)((size + ALLOC_CLASS_SIZE - 1) / ALLOC_CLASS_SIZE) - 1 : -1;
+}
+
+static void* pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud;
+    // Without a block, osize only tells the type of the new object
+    int from = ptr ? small_class(osize) : -1;
+
+    if (nsize == 0) {
+        if (from >= 0) {
+            small_give(ptr, from);
+        } else {
+            free(ptr);
+        }
+        return NULL;
+    }
+
+    cache.stats.allocations++;
+    int to = small_class(nsize);
+    if (ptr && from == to && to >= 0) {
+        return ptr;
+    }
+
+    if (to < 0 && (!ptr || from < 0)) {
+        cache.stats.system_allocations++;
+        return realloc(ptr, nsize);
+    }
+
+    void *data;
+    if (to >= 0) {
+        data = small_take(to);
+    } else {
+        cache.stats.system_allocations++;
+        data = malloc(nsize);
+    }
+    if (!data || !ptr) {
+        return data;
+    }
+
+    memcpy(data, ptr, osize < nsize ? osize : nsize);
+    if (from >= 0) {
+        small_give(ptr, from);
+    } else {
+        free(ptr);
+    }
+    return data;
+}
+
+lua_Alloc reflex_allocator_function(ReflexAllocator allocator) {
+    return allocator == REFLEX_ALLOC_POOL ? pool_alloc : system_alloc;
+}
+
+void reflex_alloc_release_thread(void) {
+    uv_once(&depot_once, depot_init);
+    uv_mutex_lock(&depot.lock);
+    for (int i = 0; i < ALLOC_CLASS_COUNT; i++) {
+        list_splice(&depot.lists[i], &cache.lists[i]);
+    }
+    uv_mutex_unlock(&depot.lock);
+}
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaChunk))
+
+ReflexArena* reflex_arena_new(size_t chunk_size) {
+    ReflexArena *arena = (ReflexArena*)calloc(1, sizeof(ReflexArena));
+    if (arena) {
+        arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+    }
+    return arena;
+}
+
+void reflex_arena_free(ReflexArena *arena) {
+    if (!arena) {
+        return;
+    }
+    ArenaChunk *chunk = arena->head;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+static void* arena_take(ReflexArena *arena, size_t size) {
+    size = ARENA_ROUND(size);
+    ArenaChunk *head = arena->head;
+    if (head && (size_t)(head->end - head->top) >= size) {
+        arena->last = head->top;
+        head->top += size;
+        return arena->last;
+    }
+
+    // Blocks too big for a chunk get one of their own behind the head
+    size_t capacity = size > arena->chunk_size / 2 ? size : arena->chunk_size;
+    ArenaChunk *chunk = (ArenaChunk*)malloc(ARENA_HEADER + capacity);
+    if (!chunk) {
+        return NULL;
+    }
+    char *data = (char*)chunk + ARENA_HEADER;
+    chunk->top = data + size;
+    chunk->end = data + capacity;
+
+    if (capacity == size && head) {
+        chunk->next = head->next;
+        head->next = chunk;
+        return data;
+    }
+    chunk->next = head;
+    arena->head = chunk;
+    arena->last = data;
+    return data;
+}
+
+void* reflex_arena_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    ReflexArena *arena = (ReflexArena*)ud;
+    ArenaChunk *head = arena->head;
+    int is_last = ptr && (char*)ptr == arena->last;
+
+    if (nsize == 0) {
+        if (is_last) {
+            head->top = arena->last;
+            arena->last = NULL;
+        }
+        return NULL;
+    }
+    if (!ptr) {
+        return arena_take(arena, nsize);
+    }
+
+    // The most recent block grows and shrinks in place
+    if (is_last && (size_t)(head->end - arena->last) >= ARENA_ROUND(nsize)) {
+        head->top = arena->last + ARENA_ROUND(nsize);
+        return ptr;
+    }
+    if (nsize <= osize) {
+        return ptr;
+    }
+
+    void *data = arena_take(arena, nsize);
+    if (data) {
+        memcpy(data, ptr, osize);
+    }
+    return data;
+}
@@ -0,0 +1,257 @@
+#include "apis/async_api.h"
+#include "lua_api.h"
+#include "loop.h"
+#include "error/LuaError.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ASYNC_REGISTRY_KEY "reflex.async"
+#define ASYNC_TASKS_KEY    "reflex.async.tasks"
+
+struct ReflexTask {
+    lua_State *co;
+    ReflexTask *next;    // Ready queue link
+    int pending;         // Waiting for a binding to resume it
+    int failed;          // Resume by raising the value on top of the thread
+    int nargs;           // Values pushed on the thread for the next resume
+};
+
+typedef struct {
+    ReflexHandle base;
+    uv_check_t check;    // Resumes the ready queue after the poll phase
+    uv_idle_t idle;      // Keeps the poll phase from blocking while tasks are ready
+    lua_State *L;
+    ReflexTask *head;
+    ReflexTask *tail;
+} AsyncScheduler;
+
+static AsyncScheduler* scheduler_get(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_REGISTRY_KEY);
+    AsyncScheduler *scheduler = (AsyncScheduler*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return scheduler;
+}
+
+static void idle_noop(uv_idle_t *handle) {
+    (void)handle;
+}
+
+static void scheduler_on_check(uv_check_t *handle);
+
+static void scheduler_push(AsyncScheduler *scheduler, ReflexTask *task) {
+    task->next = NULL;
+    if (scheduler->tail) {
+        scheduler->tail->next = task;
+    } else {
+        scheduler->head = task;
+        uv_check_start(&scheduler->check, scheduler_on_check);
+        uv_idle_start(&scheduler->idle, idle_noop);
+    }
+    scheduler->tail = task;
+}
+
+static void task_finish(AsyncScheduler *scheduler, ReflexTask *task) {
+    lua_State *L = scheduler->L;
+    lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_TASKS_KEY);
+    lua_pushthread(task->co);
+    lua_xmove(task->co, L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+static void task_report_error(AsyncScheduler *scheduler, ReflexTask *task) {
+    lua_State *L = scheduler->L;
+    const char *message = lua_tostring(task->co, -1);
+
+    // The coroutine is dead, so the traceback has to be built from outside
+    LuaErrorInfo info;
+    lua_format_error(L, message ? message : "(error object is not a string)", &info);
+    luaL_traceback(L, task->co, "", 0);
+    strncpy(info.traceback, lua_tostring(L, -1), sizeof(info.traceback) - 1);
+    info.traceback[sizeof(info.traceback) - 1] = '\0';
+    lua_pop(L, 1);
+    lua_print_error(&info);
+
+    LuaAPI *api = reflex_get_api(L);
+    if (api) {
+        api->loop_error = 1;
+        uv_stop(api->loop);
+    }
+}
+
+static void task_step(AsyncScheduler *scheduler, ReflexTask *task, lua_State *from) {
+    int nargs = task->nargs;
+    int nresults = 0;
+    int status = lua_resume(task->co, from, nargs, &nresults);
+
+    if (status == LUA_YIELD) {
+        if (!task->pending) {
+            // A plain `coroutine.yield()` gives the loop a turn and
+            // continues on the next batch
+            lua_pop(task->co, nresults);
+            task->nargs = 0;
+            scheduler_push(scheduler, task);
+        }
+        return;
+    }
+
+    if (status != LUA_OK) {
+        if (status == LUA_ERRMEM) {
+            reflex_memory_error(task->co);
+        }
+        task_report_error(scheduler, task);
+        reflex_memory_restore(task->co);
+    }
+    task_finish(scheduler, task);
+}
+
+static void scheduler_on_check(uv_check_t *handle) {
+    AsyncScheduler *scheduler = (AsyncScheduler*)handle->data;
+
+    // Only the tasks that are ready now run in this batch, anything queued
+    // while it runs waits for the next loop iteration
+    ReflexTask *task = scheduler->head;
+    scheduler->head = NULL;
+    scheduler->tail = NULL;
+
+    while (task) {
+        ReflexTask *next = task->next;
+        task_step(scheduler, task, scheduler->L);
+        task = next;
+    }
+
+    if (!scheduler->head) {
+        uv_check_stop(&scheduler->check);
+        uv_idle_stop(&scheduler->idle);
+    }
+}
+
+static int async_continue(lua_State *L, int status, lua_KContext ctx) {
+    (void)status;
+    ReflexTask *task = (ReflexTask*)ctx;
+    if (task->failed) {
+        task->failed = 0;
+        return lua_error(L);
+    }
+    return task->nargs;
+}
+
+int reflex_async_spawn(lua_State *L, int nargs) {
+    AsyncScheduler *scheduler = scheduler_get(L);
+
+    lua_State *co = lua_newthread(L);
+    ReflexTask *task = (ReflexTask*)lua_newuserdatauv(L, sizeof(ReflexTask), 0);
+    memset(task, 0, sizeof(ReflexTask));
+    task->co = co;
+    task->nargs = nargs;
+
+    // tasks[co] = task keeps both alive until the task finishes
+    lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_TASKS_KEY);
+    lua_pushvalue(L, -3);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 3);
+
+    lua_xmove(L, co, nargs + 1);
+    task_step(scheduler, task, L);
+    return 0;
+}
+
+ReflexTask* reflex_async_current(lua_State *L) {
+    if (!lua_isyieldable(L)) {
+        return NULL; // Main thread, or a C boundary the task cannot yield across
+    }
+
+    lua_pushthread(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_TASKS_KEY);
+    lua_insert(L, -2);
+    lua_rawget(L, -2);
+    ReflexTask *task = (ReflexTask*)lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    return task;
+}
+
+lua_State* reflex_async_thread(ReflexTask *task) {
+    return task->co;
+}
+
+int reflex_async_await(lua_State *L, ReflexTask *task) {
+    task->pending = 1;
+    return lua_yieldk(L, 0, (lua_KContext)task, async_continue);
+}
+
+void reflex_async_resume(ReflexTask *task, int nresults) {
+    task->pending = 0;
+    task->nargs = nresults;
+    scheduler_push(scheduler_get(task->co), task);
+}
+
+void reflex_async_reject(ReflexTask *task, const char *message) {
+    lua_pushstring(task->co, message);
+    task->failed = 1;
+    reflex_async_resume(task, 1);
+}
+
+// reflex.async(fn, ...)
+int async_run(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    return reflex_async_spawn(L, lua_gettop(L) - 1);
+}
+
+typedef struct {
+    ReflexHandle base;
+    uv_timer_t timer;
+    ReflexTask *task;
+} SleepTimer;
+
+static void sleep_on_close(uv_handle_t *handle) {
+    free(handle->data);
+}
+
+static void sleep_on_timer(uv_timer_t *handle) {
+    SleepTimer *sleep = (SleepTimer*)handle->data;
+    ReflexTask *task = sleep->task;
+    uv_close((uv_handle_t*)handle, sleep_on_close);
+    reflex_async_resume(task, 0);
+}
+
+// reflex.sleep(ms)
+int async_sleep(lua_State *L) {
+    lua_Integer ms = luaL_checkinteger(L, 1);
+    ReflexTask *task = reflex_async_current(L);
+    if (!task) {
+        return luaL_error(L, "reflex.sleep must be called from within reflex.async");
+    }
+
+    SleepTimer *sleep = (SleepTimer*)malloc(sizeof(SleepTimer));
+    if (!sleep) {
+        return luaL_error(L, "Failed to allocate timer");
+    }
+    sleep->base.close = sleep_on_close;
+    sleep->task = task;
+    uv_timer_init(reflex_get_loop(L), &sleep->timer);
+    sleep->timer.data = sleep;
+    uv_timer_start(&sleep->timer, sleep_on_timer, ms > 0 ? (uint64_t)ms : 0, 0);
+
+    return reflex_async_await(L, task);
+}
+
+void define_async_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    AsyncScheduler *scheduler = (AsyncScheduler*)lua_newuserdatauv(L, sizeof(AsyncScheduler), 0);
+    memset(scheduler, 0, sizeof(AsyncScheduler));
+    scheduler->L = api->L;
+    uv_check_init(api->loop, &scheduler->check);
+    uv_idle_init(api->loop, &scheduler->idle);
+    scheduler->check.data = scheduler;
+    scheduler->idle.data = scheduler;
+    lua_setfield(L, LUA_REGISTRYINDEX, ASYNC_REGISTRY_KEY);
+
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, ASYNC_TASKS_KEY);
+
+    reflex_register_table_field(api, "reflex", "async", REFLEX_TYPE_FUNCTION, async_run);
+    reflex_register_table_field(api, "reflex", "sleep", REFLEX_TYPE_FUNCTION, async_sleep);
+}
@@ -0,0 +1,282 @@
+#include "apis/channel_api.h"
+#include "serialize.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Freed by channel_receiver_free, which the Lua side calls even when the
+// state is closing, so the handle has no close callback of its own
+struct ChannelReceiver {
+    ReflexHandle base;
+    uv_async_t async;
+    ReflexChannel *channel;
+    ReflexMessage *head;     // Drained but not yet received
+    ReflexMessage *tail;
+    ReflexTask *waiter;      // Task suspended in receive
+    int keep_alive;
+    int closed;              // Nothing more will arrive
+    ChannelClosedCallback on_closed;
+    void *data;
+};
+
+typedef struct {
+    ReflexChannel *channel;
+    ChannelReceiver *receiver;  // Created by the first receive
+} ChannelHandle;
+
+static void receiver_on_close(uv_handle_t *handle) {
+    free(handle->data);
+}
+
+// Pushes the values of the next queued message, returns how many or -1
+static int receiver_pop(ChannelReceiver *receiver, lua_State *L) {
+    ReflexMessage *message = receiver->head;
+    receiver->head = message->next;
+    if (!receiver->head) {
+        receiver->tail = NULL;
+    }
+
+    int count = reflex_deserialize(L, message->data, message->length);
+    serial_release_channels(message->data, message->length);
+    free(message);
+    return count;
+}
+
+static void receiver_deliver(ChannelReceiver *receiver) {
+    ReflexTask *task = receiver->waiter;
+    if (!task || (!receiver->head && !receiver->closed)) {
+        return;
+    }
+    receiver->waiter = NULL;
+    if (!receiver->keep_alive) {
+        uv_unref((uv_handle_t*)&receiver->async);
+    }
+
+    lua_State *co = reflex_async_thread(task);
+    if (!receiver->head) {
+        lua_pushnil(co);
+        reflex_async_resume(task, 1);
+        return;
+    }
+
+    int count = receiver_pop(receiver, co);
+    if (count < 0) {
+        reflex_async_reject(task, "Received a malformed message");
+        return;
+    }
+    reflex_async_resume(task, count);
+}
+
+static void receiver_on_async(uv_async_t *handle) {
+    ChannelReceiver *receiver = (ChannelReceiver*)handle->data;
+    if (receiver->closed) {
+        return;
+    }
+
+    // One wakeup covers everything sent since the last one
+    int closed;
+    ReflexMessage *messages = reflex_channel_drain(receiver->channel, &closed);
+    if (messages) {
+        if (receiver->tail) {
+            receiver->tail->next = messages;
+        } else {
+            receiver->head = messages;
+        }
+        ReflexMessage *last = messages;
+        while (last->next) {
+            last = last->next;
+        }
+        receiver->tail = last;
+    }
+
+    if (closed) {
+        receiver->closed = 1;
+        uv_unref((uv_handle_t*)&receiver->async);
+        if (receiver->on_closed) {
+            receiver->on_closed(receiver, receiver->data);
+        }
+    }
+    receiver_deliver(receiver);
+}
+
+ChannelReceiver* channel_receiver_new(lua_State *L, ReflexChannel *channel, int keep_alive,
+    ChannelClosedCallback on_closed, void *data) {
+    ChannelReceiver *receiver = (ChannelReceiver*)calloc(1, sizeof(ChannelReceiver));
+    if (!receiver) {
+        return NULL;
+    }
+
+    LuaAPI *api = reflex_get_api(L);
+    uv_async_init(api->loop, &receiver->async, receiver_on_async);
+    receiver->async.data = receiver;
+    receiver->channel = channel;
+    receiver->keep_alive = keep_alive;
+    receiver->on_closed = on_closed;
+    receiver->data = data;
+    if (!keep_alive) {
+        uv_unref((uv_handle_t*)&receiver->async);
+    }
+
+    if (reflex_channel_bind(channel, &receiver->async) != 0) {
+        uv_close((uv_handle_t*)&receiver->async, receiver_on_close);
+        return NULL;
+    }
+    reflex_channel_retain(channel);
+    return receiver;
+}
+
+int channel_receiver_receive(lua_State *L, ChannelReceiver *receiver) {
+    if (receiver->head) {
+        int count = receiver_pop(receiver, L);
+        if (count < 0) {
+            return luaL_error(L, "Received a malformed message");
+        }
+        return count;
+    }
+    if (receiver->closed) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    ReflexTask *task = reflex_async_current(L);
+    if (!task) {
+        return luaL_error(L, "receive must be called from within reflex.async");
+    }
+    if (receiver->waiter) {
+        return luaL_error(L, "Another task is already receiving from this channel");
+    }
+
+    receiver->waiter = task;
+    if (!receiver->keep_alive) {
+        uv_ref((uv_handle_t*)&receiver->async);
+    }
+    return reflex_async_await(L, task);
+}
+
+void channel_receiver_free(ChannelReceiver *receiver) {
+    reflex_channel_bind(receiver->channel, NULL);
+    reflex_channel_release(receiver->channel);
+
+    while (receiver->head) {
+        ReflexMessage *next = receiver->head->next;
+        serial_release_channels(receiver->head->data, receiver->head->length);
+        free(receiver->head);
+        receiver->head = next;
+    }
+
+    // When the state is closing the loop has already closed the handle
+    if (uv_is_closing((uv_handle_t*)&receiver->async)) {
+        free(receiver);
+    } else {
+        uv_close((uv_handle_t*)&receiver->async, receiver_on_close);
+    }
+}
+
+void reflex_channel_push(lua_State *L, ReflexChannel *channel) {
+    ChannelHandle *handle = (ChannelHandle*)lua_newuserdatauv(L, sizeof(ChannelHandle), 0);
+    handle->channel = channel;
+    handle->receiver = NULL;
+    reflex_channel_retain(channel);
+    luaL_setmetatable(L, CHANNEL_METATABLE);
+}
+
+ReflexChannel* reflex_channel_test(lua_State *L, int index) {
+    ChannelHandle *handle = (ChannelHandle*)luaL_testudata(L, index, CHANNEL_METATABLE);
+    return handle ? handle->channel : NULL;
+}
+
+static ChannelHandle* channel_check(lua_State *L) {
+    return (ChannelHandle*)luaL_checkudata(L, 1, CHANNEL_METATABLE);
+}
+
+// reflex.channel.new(capacity)
+int channel_new(lua_State *L) {
+    lua_Integer capacity = luaL_optinteger(L, 1, REFLEX_CHANNEL_CAPACITY);
+    luaL_argcheck(L, capacity > 0, 1, "capacity must be positive");
+
+    ReflexChannel *channel = reflex_channel_new((size_t)capacity);
+    if (!channel) {
+        return luaL_error(L, "Failed to allocate channel");
+    }
+    reflex_channel_push(L, channel);
+    reflex_channel_release(channel);
+    return 1;
+}
+
+// channel:send(...), false when the channel is full or closed. Receiving
+// no values means the channel is done, so at least one has to be sent.
+static int channel_send(lua_State *L) {
+    ChannelHandle *handle = channel_check(L);
+    luaL_argcheck(L, lua_gettop(L) >= 2, 2, "expected a value to send");
+
+    SerialBuffer buffer;
+    serial_buffer_init(&buffer);
+    if (reflex_serialize(L, 2, lua_gettop(L), &buffer) != 0) {
+        lua_pushstring(L, buffer.error);
+        serial_release_channels(buffer.data, buffer.length);
+        serial_buffer_free(&buffer);
+        return lua_error(L);
+    }
+
+    // A queued message takes over the channel references, else they are dropped here
+    int status = reflex_channel_send(handle->channel, buffer.data, buffer.length);
+    if (status != 0) {
+        serial_release_channels(buffer.data, buffer.length);
+    }
+    serial_buffer_free(&buffer);
+    if (status == UV_ENOMEM) {
+        return luaL_error(L, "Failed to allocate message");
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, status == 0);
+}
+
+// channel:receive(), only one state can receive from a channel
+static int channel_receive(lua_State *L) {
+    ChannelHandle *handle = channel_check(L);
+    if (!handle->receiver) {
+        handle->receiver = channel_receiver_new(L, handle->channel, 0, NULL, NULL);
+        if (!handle->receiver) {
+            return luaL_error(L, "Channel is already received from by another state");
+        }
+    }
+    return channel_receiver_receive(L, handle->receiver);
+}
+
+// channel:close()
+static int channel_close(lua_State *L) {
+    ChannelHandle *handle = channel_check(L);
+    reflex_channel_close(handle->channel);
+    return 0;
+}
+
+static int channel_gc(lua_State *L) {
+    ChannelHandle *handle = channel_check(L);
+    if (handle->receiver) {
+        channel_receiver_free(handle->receiver);
+        handle->receiver = NULL;
+    }
+    if (handle->channel) {
+        reflex_channel_release(handle->channel);
+        handle->channel = NULL;
+    }
+    return 0;
+}
+
+void define_channel_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    static const luaL_Reg methods[] = {
+        {"send", channel_send},
+        {"receive", channel_receive},
+        {"close", channel_close},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, CHANNEL_METATABLE);
+    luaL_newlib(L, methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, channel_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    reflex_register_table_field(api, "reflex", "channel", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.channel", "new", REFLEX_TYPE_FUNCTION, channel_new);
+}
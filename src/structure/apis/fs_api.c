@@ -0,0 +1,480 @@
+#include "apis/fs_api.h"
+#include "apis/async_api.h"
+#include "lua_api.h"
+#include "loop.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FS_ERROR     (-1)
+#define FS_CONTINUE  (-2)
+
+#define FS_READ_CHUNK 65536
+
+typedef enum {
+    FS_STAGE_OPEN,
+    FS_STAGE_STAT,
+    FS_STAGE_IO,
+    FS_STAGE_CLOSE
+} FsStage;
+
+typedef struct FsRequest FsRequest;
+
+// Handles a finished uv_fs request. Pushes the results on `r->L` and returns
+// their count, submits the next step and returns FS_CONTINUE, or sets
+// `r->error` and returns FS_ERROR.
+typedef int (*FsComplete)(FsRequest *r);
+
+struct FsRequest {
+    uv_fs_t req;
+    ReflexTask *task;    // NULL when the request runs synchronously
+    lua_State *L;
+    FsComplete complete;
+    const char *op;      // Operation name used in error messages
+    const char *path;    // Borrowed from the Lua stack of the caller
+    const char *input;   // Data being written, also borrowed
+    char *data;          // Buffer owned by the request
+    size_t size;
+    size_t capacity;
+    uv_file fd;
+    uv_buf_t buf;
+    FsStage stage;
+    int sized;           // The file reported its size, read exactly that much
+    int error;
+};
+
+static void fs_on_done(uv_fs_t *req);
+
+static FsRequest* fs_request_new(lua_State *L, FsComplete complete, const char *op, const char *path) {
+    FsRequest *r = (FsRequest*)calloc(1, sizeof(FsRequest));
+    if (!r) {
+        luaL_error(L, "Failed to allocate fs request");
+        return NULL;
+    }
+
+    r->task = reflex_async_current(L);
+    r->L = L;
+    r->complete = complete;
+    r->op = op;
+    r->path = path;
+    r->fd = -1;
+    r->req.data = r;
+    return r;
+}
+
+static void fs_request_free(FsRequest *r) {
+    uv_fs_req_cleanup(&r->req);
+    free(r->data);
+    free(r);
+}
+
+static uv_fs_cb fs_callback(FsRequest *r) {
+    return r->task ? fs_on_done : NULL;
+}
+
+static void fs_format_error(FsRequest *r, char *message, size_t size) {
+    if (r->path) {
+        snprintf(message, size, "%s: %s, %s '%s'", uv_err_name(r->error), uv_strerror(r->error), r->op, r->path);
+    } else {
+        snprintf(message, size, "%s: %s, %s", uv_err_name(r->error), uv_strerror(r->error), r->op);
+    }
+}
+
+static int fs_raise(lua_State *L, FsRequest *r) {
+    char message[512];
+    fs_format_error(r, message, sizeof(message));
+    fs_request_free(r);
+    return luaL_error(L, "%s", message);
+}
+
+// Result of submitting a follow-up step from inside a completion
+static int fs_next(FsRequest *r, int status) {
+    if (r->task && status < 0) {
+        r->error = status;
+        return FS_ERROR;
+    }
+    return FS_CONTINUE;
+}
+
+static void fs_on_done(uv_fs_t *req) {
+    FsRequest *r = (FsRequest*)req->data;
+    int n = r->complete(r);
+    if (n == FS_CONTINUE) {
+        return;
+    }
+
+    ReflexTask *task = r->task;
+    if (n == FS_ERROR) {
+        char message[512];
+        fs_format_error(r, message, sizeof(message));
+        fs_request_free(r);
+        reflex_async_reject(task, message);
+        return;
+    }
+
+    fs_request_free(r);
+    reflex_async_resume(task, n);
+}
+
+// Suspends the task on an async request, or drives a synchronous one
+static int fs_dispatch(lua_State *L, FsRequest *r, int status) {
+    if (r->task) {
+        if (status < 0) {
+            r->error = status;
+            return fs_raise(L, r);
+        }
+        return reflex_async_await(L, r->task);
+    }
+
+    int n;
+    while ((n = r->complete(r)) == FS_CONTINUE) {
+    }
+    if (n == FS_ERROR) {
+        return fs_raise(L, r);
+    }
+
+    fs_request_free(r);
+    return n;
+}
+
+static int fs_check_result(FsRequest *r) {
+    if (r->req.result < 0) {
+        r->error = (int)r->req.result;
+        return FS_ERROR;
+    }
+    return 0;
+}
+
+static int fs_parse_flags(lua_State *L, const char *flags) {
+    if (strcmp(flags, "r") == 0)  return O_RDONLY;
+    if (strcmp(flags, "r+") == 0) return O_RDWR;
+    if (strcmp(flags, "w") == 0)  return O_WRONLY | O_CREAT | O_TRUNC;
+    if (strcmp(flags, "w+") == 0) return O_RDWR | O_CREAT | O_TRUNC;
+    if (strcmp(flags, "a") == 0)  return O_WRONLY | O_CREAT | O_APPEND;
+    if (strcmp(flags, "a+") == 0) return O_RDWR | O_CREAT | O_APPEND;
+    return luaL_error(L, "Invalid open flags '%s'", flags);
+}
+
+static int open_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+    lua_pushinteger(r->L, (lua_Integer)r->req.result);
+    return 1;
+}
+
+// fs.open(path, flags, mode)
+int fs_api_open(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    int flags = fs_parse_flags(L, luaL_optstring(L, 2, "r"));
+    int mode = (int)luaL_optinteger(L, 3, 0644);
+
+    FsRequest *r = fs_request_new(L, open_complete, "open", path);
+    int status = uv_fs_open(reflex_get_loop(L), &r->req, path, flags, mode, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static int close_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+    lua_pushboolean(r->L, 1);
+    return 1;
+}
+
+// fs.close(fd)
+int fs_api_close(lua_State *L) {
+    uv_file fd = (uv_file)luaL_checkinteger(L, 1);
+
+    FsRequest *r = fs_request_new(L, close_complete, "close", NULL);
+    int status = uv_fs_close(reflex_get_loop(L), &r->req, fd, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static int read_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+    if (r->req.result == 0) {
+        lua_pushnil(r->L); // End of file
+    } else {
+        lua_pushlstring(r->L, r->data, (size_t)r->req.result);
+    }
+    return 1;
+}
+
+// fs.read(fd, length, offset)
+int fs_api_read(lua_State *L) {
+    uv_file fd = (uv_file)luaL_checkinteger(L, 1);
+    lua_Integer length = luaL_optinteger(L, 2, FS_READ_CHUNK);
+    lua_Integer offset = luaL_optinteger(L, 3, -1);
+    luaL_argcheck(L, length > 0, 2, "length must be positive");
+
+    FsRequest *r = fs_request_new(L, read_complete, "read", NULL);
+    r->data = (char*)malloc((size_t)length);
+    if (!r->data) {
+        fs_request_free(r);
+        return luaL_error(L, "Failed to allocate read buffer");
+    }
+    r->buf = uv_buf_init(r->data, (unsigned int)length);
+
+    int status = uv_fs_read(reflex_get_loop(L), &r->req, fd, &r->buf, 1, offset, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static int write_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+    lua_pushinteger(r->L, (lua_Integer)r->req.result);
+    return 1;
+}
+
+// fs.write(fd, data, offset)
+int fs_api_write(lua_State *L) {
+    uv_file fd = (uv_file)luaL_checkinteger(L, 1);
+    size_t length;
+    const char *data = luaL_checklstring(L, 2, &length);
+    lua_Integer offset = luaL_optinteger(L, 3, -1);
+
+    // The string stays on the caller's stack until the request finishes,
+    // so it is written without a copy
+    FsRequest *r = fs_request_new(L, write_complete, "write", NULL);
+    r->buf = uv_buf_init((char*)data, (unsigned int)length);
+
+    int status = uv_fs_write(reflex_get_loop(L), &r->req, fd, &r->buf, 1, offset, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static void fs_push_time(lua_State *L, const char *key, uv_timespec_t time) {
+    lua_pushnumber(L, (double)time.tv_sec + (double)time.tv_nsec / 1e9);
+    lua_setfield(L, -2, key);
+}
+
+static int stat_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+
+    lua_State *L = r->L;
+    const uv_stat_t *st = &r->req.statbuf;
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, (lua_Integer)st->st_size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer)st->st_mode);
+    lua_setfield(L, -2, "mode");
+    fs_push_time(L, "atime", st->st_atim);
+    fs_push_time(L, "mtime", st->st_mtim);
+    fs_push_time(L, "ctime", st->st_ctim);
+    lua_pushboolean(L, S_ISREG(st->st_mode));
+    lua_setfield(L, -2, "isFile");
+    lua_pushboolean(L, S_ISDIR(st->st_mode));
+    lua_setfield(L, -2, "isDirectory");
+    return 1;
+}
+
+// fs.stat(path)
+int fs_api_stat(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    FsRequest *r = fs_request_new(L, stat_complete, "stat", path);
+    int status = uv_fs_stat(reflex_get_loop(L), &r->req, path, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static int readdir_complete(FsRequest *r) {
+    if (fs_check_result(r) == FS_ERROR) {
+        return FS_ERROR;
+    }
+
+    lua_State *L = r->L;
+    lua_createtable(L, (int)r->req.result, 0);
+
+    uv_dirent_t entry;
+    lua_Integer i = 1;
+    while (uv_fs_scandir_next(&r->req, &entry) != UV_EOF) {
+        lua_pushstring(L, entry.name);
+        lua_rawseti(L, -2, i++);
+    }
+    return 1;
+}
+
+// fs.readdir(path)
+int fs_api_readdir(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    FsRequest *r = fs_request_new(L, readdir_complete, "scandir", path);
+    int status = uv_fs_scandir(reflex_get_loop(L), &r->req, path, 0, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+// Closes the descriptor of a failed whole-file request before reporting
+static int fs_abort(FsRequest *r, int error) {
+    r->error = error;
+    if (r->fd < 0) {
+        return FS_ERROR;
+    }
+
+    r->stage = FS_STAGE_CLOSE;
+    uv_fs_req_cleanup(&r->req);
+    int status = uv_fs_close(reflex_get_loop(r->L), &r->req, r->fd, fs_callback(r));
+    r->fd = -1;
+    if (status < 0 && r->task) {
+        return FS_ERROR;
+    }
+    return FS_CONTINUE;
+}
+
+static int fs_submit_read(FsRequest *r) {
+    r->op = "read";
+    r->buf = uv_buf_init(r->data + r->size, (unsigned int)(r->capacity - r->size));
+    uv_fs_req_cleanup(&r->req);
+    return fs_next(r, uv_fs_read(reflex_get_loop(r->L), &r->req, r->fd, &r->buf, 1, (int64_t)r->size, fs_callback(r)));
+}
+
+static int fs_submit_close(FsRequest *r) {
+    r->op = "close";
+    r->stage = FS_STAGE_CLOSE;
+    uv_fs_req_cleanup(&r->req);
+    int status = uv_fs_close(reflex_get_loop(r->L), &r->req, r->fd, fs_callback(r));
+    r->fd = -1;
+    return fs_next(r, status);
+}
+
+static int read_file_complete(FsRequest *r) {
+    if (r->stage == FS_STAGE_CLOSE) {
+        if (r->error) {
+            return FS_ERROR;
+        }
+        if (fs_check_result(r) == FS_ERROR) {
+            return FS_ERROR;
+        }
+        lua_pushlstring(r->L, r->data ? r->data : "", r->size);
+        return 1;
+    }
+
+    if (r->req.result < 0) {
+        return fs_abort(r, (int)r->req.result);
+    }
+
+    switch (r->stage) {
+        case FS_STAGE_OPEN:
+            r->fd = (uv_file)r->req.result;
+            r->stage = FS_STAGE_STAT;
+            r->op = "fstat";
+            uv_fs_req_cleanup(&r->req);
+            return fs_next(r, uv_fs_fstat(reflex_get_loop(r->L), &r->req, r->fd, fs_callback(r)));
+
+        case FS_STAGE_STAT:
+            // Files that report no size (pipes, procfs) are read in chunks
+            r->sized = r->req.statbuf.st_size > 0;
+            r->capacity = r->sized ? (size_t)r->req.statbuf.st_size : FS_READ_CHUNK;
+            r->data = (char*)malloc(r->capacity);
+            if (!r->data) {
+                return fs_abort(r, UV_ENOMEM);
+            }
+            r->stage = FS_STAGE_IO;
+            return fs_submit_read(r);
+
+        case FS_STAGE_IO:
+            if (r->req.result == 0) {
+                return fs_submit_close(r);
+            }
+
+            r->size += (size_t)r->req.result;
+            if (r->size == r->capacity) {
+                if (r->sized) {
+                    return fs_submit_close(r);
+                }
+                char *data = (char*)realloc(r->data, r->capacity * 2);
+                if (!data) {
+                    return fs_abort(r, UV_ENOMEM);
+                }
+                r->data = data;
+                r->capacity *= 2;
+            }
+            return fs_submit_read(r);
+
+        default:
+            return FS_ERROR;
+    }
+}
+
+// fs.readFile(path)
+int fs_api_read_file(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    FsRequest *r = fs_request_new(L, read_file_complete, "open", path);
+    r->stage = FS_STAGE_OPEN;
+    int status = uv_fs_open(reflex_get_loop(L), &r->req, path, O_RDONLY, 0, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+static int write_file_complete(FsRequest *r) {
+    if (r->stage == FS_STAGE_CLOSE) {
+        if (r->error) {
+            return FS_ERROR;
+        }
+        if (fs_check_result(r) == FS_ERROR) {
+            return FS_ERROR;
+        }
+        lua_pushboolean(r->L, 1);
+        return 1;
+    }
+
+    if (r->req.result < 0) {
+        return fs_abort(r, (int)r->req.result);
+    }
+
+    if (r->stage == FS_STAGE_OPEN) {
+        r->fd = (uv_file)r->req.result;
+        r->stage = FS_STAGE_IO;
+        r->op = "write";
+    } else {
+        r->size += (size_t)r->req.result;
+    }
+
+    if (r->size == r->capacity) {
+        return fs_submit_close(r);
+    }
+
+    // Short writes continue where the previous one stopped
+    r->buf = uv_buf_init((char*)r->input + r->size, (unsigned int)(r->capacity - r->size));
+    uv_fs_req_cleanup(&r->req);
+    return fs_next(r, uv_fs_write(reflex_get_loop(r->L), &r->req, r->fd, &r->buf, 1, (int64_t)r->size, fs_callback(r)));
+}
+
+// fs.writeFile(path, data)
+int fs_api_write_file(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    size_t length;
+    const char *data = luaL_checklstring(L, 2, &length);
+
+    FsRequest *r = fs_request_new(L, write_file_complete, "open", path);
+    r->stage = FS_STAGE_OPEN;
+    r->input = data;
+    r->capacity = length;
+
+    int status = uv_fs_open(reflex_get_loop(L), &r->req, path, O_WRONLY | O_CREAT | O_TRUNC, 0644, fs_callback(r));
+    return fs_dispatch(L, r, status);
+}
+
+void fs_set_threadpool_size(unsigned int size) {
+    char value[16];
+    snprintf(value, sizeof(value), "%u", size);
+    setenv("UV_THREADPOOL_SIZE", value, 1);
+}
+
+void define_fs_api(LuaAPI *api) {
+    reflex_register_global_table(api, "fs");
+    reflex_register_table_field(api, "fs", "open", REFLEX_TYPE_FUNCTION, fs_api_open);
+    reflex_register_table_field(api, "fs", "close", REFLEX_TYPE_FUNCTION, fs_api_close);
+    reflex_register_table_field(api, "fs", "read", REFLEX_TYPE_FUNCTION, fs_api_read);
+    reflex_register_table_field(api, "fs", "write", REFLEX_TYPE_FUNCTION, fs_api_write);
+    reflex_register_table_field(api, "fs", "stat", REFLEX_TYPE_FUNCTION, fs_api_stat);
+    reflex_register_table_field(api, "fs", "readdir", REFLEX_TYPE_FUNCTION, fs_api_readdir);
+    reflex_register_table_field(api, "fs", "readFile", REFLEX_TYPE_FUNCTION, fs_api_read_file);
+    reflex_register_table_field(api, "fs", "writeFile", REFLEX_TYPE_FUNCTION, fs_api_write_file);
+}
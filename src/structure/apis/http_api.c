@@ -0,0 +1,924 @@
+#define _GNU_SOURCE // memmem
+#include "apis/http_api.h"
+#include "apis/tcp_api.h"
+#include "apis/async_api.h"
+#include "error/LuaError.h"
+#include "lua_api.h"
+#include "buffer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define HTTP_INPUT_SIZE     (16 * 1024)
+#define HTTP_READ_MIN       (4 * 1024)         // Smallest free tail handed to a read
+#define HTTP_MAX_HEAD       (64 * 1024)
+#define HTTP_MAX_BODY       (8 * 1024 * 1024)
+#define HTTP_MAX_HEADERS    64
+#define HTTP_MAX_PENDING    (64 * 1024)        // Pipelined bytes buffered behind a busy handler
+#define HTTP_BACKLOG        511
+
+#define HTTP_INCOMPLETE     0
+#define HTTP_COMPLETE       1
+
+// Received bytes of a connection. Requests keep a reference, so the bytes
+// they point at stay put after the connection moves on to a new input.
+typedef struct {
+    size_t refs;
+    size_t capacity;
+    char data[];
+} HttpInput;
+
+// Offsets into the input, nothing is copied until Lua asks for it
+typedef struct {
+    uint32_t name;
+    uint32_t name_length;
+    uint32_t value;
+    uint32_t value_length;
+} HttpHeader;
+
+typedef struct {
+    HttpInput *input;
+    uint32_t method;
+    uint32_t method_length;
+    uint32_t target;
+    uint32_t target_length;
+    uint32_t body;
+    uint32_t body_length;
+    int minor;
+    int header_count;
+    HttpHeader headers[HTTP_MAX_HEADERS];
+} HttpRequest;
+
+typedef struct HttpServer HttpServer;
+typedef struct HttpConnection HttpConnection;
+
+typedef struct {
+    HttpConnection *conn;  // NULL once sent or when the peer went away
+    int status;
+    int minor;
+    int keep_alive;
+    int sent;
+} HttpResponse;
+
+struct HttpServer {
+    ReflexHandle base;
+    uv_tcp_t handle;
+    lua_State *L;
+    int self_ref;
+    int handler_ref;
+    size_t connections;
+    int closed;
+    time_t date_second;    // Second the cached Date header was built for
+    char date[64];
+};
+
+struct HttpConnection {
+    ReflexHandle base;
+    uv_tcp_t handle;
+    uv_shutdown_t shutdown;
+    HttpServer *server;
+    HttpInput *input;
+    size_t start;          // First byte of the next request
+    size_t length;         // End of the received bytes
+    size_t scanned;        // Where the search for the end of the head resumes
+    size_t head_length;    // Set while a parsed head waits for its body
+    HttpRequest request;   // Head parsed so far
+    int keep_alive;
+    HttpResponse *response;
+    int response_ref;
+    int busy;              // A handler owns the current response
+    int dispatching;
+    int reading;
+    int eof;
+    int closing;
+};
+
+static void conn_process(HttpConnection *conn, lua_State *L);
+
+static const char* http_reason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 101: return "Switching Protocols";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 410: return "Gone";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default:  return "Unknown";
+    }
+}
+
+static HttpInput* input_new(size_t capacity) {
+    HttpInput *input = (HttpInput*)malloc(sizeof(HttpInput) + capacity);
+    if (input) {
+        input->refs = 1;
+        input->capacity = capacity;
+    }
+    return input;
+}
+
+static void input_unref(HttpInput *input) {
+    if (input && --input->refs == 0) {
+        free(input);
+    }
+}
+
+// Makes room for `needed` bytes after the received data. Pending bytes move
+// to the front, into a fresh input when a request still points at this one.
+static int conn_reserve(HttpConnection *conn, size_t needed) {
+    HttpInput *input = conn->input;
+    if (input->capacity - conn->length >= needed) {
+        return 1;
+    }
+
+    size_t pending = conn->length - conn->start;
+    size_t capacity = input->capacity;
+    while (capacity - pending < needed) {
+        capacity *= 2;
+    }
+
+    if (capacity == input->capacity && input->refs == 1) {
+        memmove(input->data, input->data + conn->start, pending);
+    } else {
+        HttpInput *fresh = input_new(capacity);
+        if (!fresh) {
+            return 0;
+        }
+        memcpy(fresh->data, input->data + conn->start, pending);
+        input_unref(input);
+        conn->input = fresh;
+    }
+
+    // The parsed head refers to the old offsets
+    if (conn->head_length) {
+        HttpRequest *request = &conn->request;
+        uint32_t shift = (uint32_t)conn->start;
+        request->method -= shift;
+        request->target -= shift;
+        for (int i = 0; i < request->header_count; i++) {
+            request->headers[i].name -= shift;
+            request->headers[i].value -= shift;
+        }
+    }
+
+    conn->scanned -= conn->start;
+    conn->length = pending;
+    conn->start = 0;
+    return 1;
+}
+
+static int token_equals(const char *data, size_t length, const char *token) {
+    return strlen(token) == length && strncasecmp(data, token, length) == 0;
+}
+
+// Parses the request line and headers of `head`..`head + length`. Returns 0 or
+// the status code to reject the request with.
+static int http_parse_head(HttpConnection *conn, size_t head, size_t length) {
+    const char *data = conn->input->data;
+    const char *p = data + head;
+    const char *end = p + length - 2; // The last empty line
+    HttpRequest *request = &conn->request;
+
+    // Request line
+    const char *method = p;
+    while (p < end && *p != ' ') p++;
+    if (p == method || p >= end) return 400;
+    request->method = (uint32_t)(method - data);
+    request->method_length = (uint32_t)(p - method);
+
+    const char *target = ++p;
+    while (p < end && *p != ' ') p++;
+    if (p == target || p >= end) return 400;
+    request->target = (uint32_t)(target - data);
+    request->target_length = (uint32_t)(p - target);
+    p++;
+
+    if (end - p < 10 || memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1') || p[8] != '\r' || p[9] != '\n') {
+        return 400;
+    }
+    request->minor = p[7] - '0';
+    p += 10;
+
+    int close = 0;
+    int keep_alive = 0;
+    int has_length = 0;
+    uint64_t content_length = 0;
+    request->header_count = 0;
+
+    while (p < end) {
+        const char *line_end = (const char*)memchr(p, '\r', end - p);
+        if (!line_end || line_end[1] != '\n') return 400;
+
+        const char *colon = (const char*)memchr(p, ':', line_end - p);
+        if (!colon || colon == p) return 400;
+        for (const char *c = p; c < colon; c++) {
+            if (*c == ' ' || *c == '\t') return 400;
+        }
+
+        const char *value = colon + 1;
+        const char *value_end = line_end;
+        while (value < value_end && (*value == ' ' || *value == '\t')) value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+
+        if (request->header_count == HTTP_MAX_HEADERS) return 431;
+        HttpHeader *header = &request->headers[request->header_count++];
+        header->name = (uint32_t)(p - data);
+        header->name_length = (uint32_t)(colon - p);
+        header->value = (uint32_t)(value - data);
+        header->value_length = (uint32_t)(value_end - value);
+
+        size_t name_length = colon - p;
+        size_t value_length = value_end - value;
+        if (token_equals(p, name_length, "content-length")) {
+            if (value_length == 0 || has_length) return 400;
+            content_length = 0;
+            for (const char *c = value; c < value_end; c++) {
+                if (*c < '0' || *c > '9') return 400;
+                content_length = content_length * 10 + (uint64_t)(*c - '0');
+                if (content_length > HTTP_MAX_BODY) return 413;
+            }
+            has_length = 1;
+        } else if (token_equals(p, name_length, "transfer-encoding")) {
+            return 501; // Chunked request bodies are not supported
+        } else if (token_equals(p, name_length, "connection")) {
+            // Comma separated tokens, e.g. `keep-alive, Upgrade`
+            const char *token = value;
+            while (token < value_end) {
+                const char *token_end = (const char*)memchr(token, ',', value_end - token);
+                if (!token_end) token_end = value_end;
+                const char *last = token_end;
+                while (token < last && (*token == ' ' || *token == '\t')) token++;
+                while (last > token && (last[-1] == ' ' || last[-1] == '\t')) last--;
+                if (token_equals(token, last - token, "close")) close = 1;
+                if (token_equals(token, last - token, "keep-alive")) keep_alive = 1;
+                token = token_end + 1;
+            }
+        }
+
+        p = line_end + 2;
+    }
+
+    request->body_length = (uint32_t)content_length;
+    conn->keep_alive = request->minor == 1 ? !close : (keep_alive && !close);
+    return 0;
+}
+
+// Tries to complete the next request. Returns HTTP_COMPLETE, HTTP_INCOMPLETE
+// or the status code to reject the connection with.
+static int http_parse(HttpConnection *conn) {
+    char *data = conn->input->data;
+
+    if (!conn->head_length) {
+        // Stray line breaks between requests are allowed
+        while (conn->start < conn->length && (data[conn->start] == '\r' || data[conn->start] == '\n')) {
+            conn->start++;
+        }
+        if (conn->scanned < conn->start) {
+            conn->scanned = conn->start;
+        }
+
+        size_t from = conn->scanned >= conn->start + 3 ? conn->scanned - 3 : conn->start;
+        const char *found = (const char*)memmem(data + from, conn->length - from, "\r\n\r\n", 4);
+        if (!found) {
+            conn->scanned = conn->length;
+            return conn->length - conn->start > HTTP_MAX_HEAD ? 431 : HTTP_INCOMPLETE;
+        }
+
+        size_t head_length = (size_t)(found + 4 - (data + conn->start));
+        if (head_length > HTTP_MAX_HEAD) {
+            return 431;
+        }
+
+        int status = http_parse_head(conn, conn->start, head_length);
+        if (status != 0) {
+            return status;
+        }
+        conn->head_length = head_length;
+    }
+
+    size_t body = conn->start + conn->head_length;
+    if (conn->length - body < conn->request.body_length) {
+        return HTTP_INCOMPLETE;
+    }
+
+    conn->request.body = (uint32_t)body;
+    conn->request.input = conn->input;
+    conn->start = body + conn->request.body_length;
+    conn->scanned = conn->start;
+    conn->head_length = 0;
+    return HTTP_COMPLETE;
+}
+
+static void conn_update_reading(HttpConnection *conn);
+
+static void conn_on_close(uv_handle_t *handle) {
+    HttpConnection *conn = (HttpConnection*)handle->data;
+    HttpServer *server = conn->server;
+    input_unref(conn->input);
+    free(conn);
+
+    // The server stays alive until its last connection is gone
+    if (--server->connections == 0 && server->closed) {
+        luaL_unref(server->L, LUA_REGISTRYINDEX, server->handler_ref);
+        luaL_unref(server->L, LUA_REGISTRYINDEX, server->self_ref);
+    }
+}
+
+static void conn_on_shutdown(uv_shutdown_t *req, int status) {
+    (void)status;
+    if (!uv_is_closing((uv_handle_t*)req->handle)) {
+        uv_close((uv_handle_t*)req->handle, conn_on_close);
+    }
+}
+
+// Closes once the queued responses are flushed
+static void conn_close(HttpConnection *conn) {
+    if (conn->closing) {
+        return;
+    }
+    conn->closing = 1;
+
+    if (conn->response) {
+        conn->response->conn = NULL;
+        conn->response = NULL;
+        luaL_unref(conn->server->L, LUA_REGISTRYINDEX, conn->response_ref);
+    }
+
+    uv_stream_t *stream = (uv_stream_t*)&conn->handle;
+    uv_read_stop(stream);
+    if (!uv_is_writable(stream) || uv_shutdown(&conn->shutdown, stream, conn_on_shutdown) != 0) {
+        uv_close((uv_handle_t*)&conn->handle, conn_on_close);
+    }
+}
+
+static void conn_reject(HttpConnection *conn, lua_State *L, int status) {
+    lua_pushfstring(L, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, http_reason(status));
+    tcp_write_values(L, (uv_stream_t*)&conn->handle, lua_gettop(L), lua_gettop(L));
+    lua_pop(L, 1);
+    conn_close(conn);
+}
+
+// Runs the handler inside the task with a message handler, so a failing
+// request is reported and answered with a 500 instead of ending the process
+static int http_dispatch_done(lua_State *L, int status, lua_KContext ctx);
+
+static int http_dispatch(lua_State *L) {
+    // handler, request, response -> response, msgh, handler, request, response
+    lua_pushvalue(L, 3);
+    lua_insert(L, 1);
+    lua_pushcfunction(L, lua_error_handler);
+    lua_insert(L, 2);
+    int status = lua_pcallk(L, 2, 0, 2, 0, http_dispatch_done);
+    return http_dispatch_done(L, status, 0);
+}
+
+static void response_send(lua_State *L, HttpResponse *response, int body);
+
+static int http_dispatch_done(lua_State *L, int status, lua_KContext ctx) {
+    (void)ctx;
+    HttpResponse *response = (HttpResponse*)lua_touserdata(L, 1);
+    if (!response->sent) {
+        if (status != LUA_OK && status != LUA_YIELD) {
+            response->status = 500;
+            lua_pushnil(L);
+            lua_setiuservalue(L, 1, 1);
+        }
+        lua_settop(L, 1);
+        response_send(L, response, 0);
+    }
+    return 0;
+}
+
+static void conn_dispatch(HttpConnection *conn, lua_State *L) {
+    HttpServer *server = conn->server;
+    HttpRequest *parsed = &conn->request;
+
+    lua_pushcfunction(L, http_dispatch);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, server->handler_ref);
+
+    // Only the headers that were received are allocated
+    size_t size = sizeof(HttpRequest) - (HTTP_MAX_HEADERS - parsed->header_count) * sizeof(HttpHeader);
+    HttpRequest *request = (HttpRequest*)lua_newuserdatauv(L, size, 1);
+    memcpy(request, parsed, size);
+    request->input->refs++;
+    luaL_setmetatable(L, HTTP_REQUEST_METATABLE);
+
+    HttpResponse *response = (HttpResponse*)lua_newuserdatauv(L, sizeof(HttpResponse), 1);
+    response->conn = conn;
+    response->status = 200;
+    response->minor = parsed->minor;
+    response->keep_alive = conn->keep_alive;
+    response->sent = 0;
+    luaL_setmetatable(L, HTTP_RESPONSE_METATABLE);
+
+    lua_pushvalue(L, -1);
+    conn->response_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    conn->response = response;
+    conn->busy = 1;
+
+    reflex_async_spawn(L, 3);
+}
+
+// Runs the buffered requests one after another. A response sent while the
+// handler is still inside this loop only marks the connection idle, the
+// loop picks up the next pipelined request without recursing.
+static void conn_process(HttpConnection *conn, lua_State *L) {
+    if (conn->dispatching) {
+        return;
+    }
+    conn->dispatching = 1;
+
+    while (!conn->busy && !conn->closing) {
+        int status = http_parse(conn);
+        if (status == HTTP_INCOMPLETE) {
+            break;
+        }
+        if (status != HTTP_COMPLETE) {
+            conn_reject(conn, L, status);
+            break;
+        }
+        conn_dispatch(conn, L);
+    }
+
+    conn->dispatching = 0;
+    if (conn->closing) {
+        return;
+    }
+    if (conn->eof && !conn->busy) {
+        conn_close(conn);
+        return;
+    }
+    conn_update_reading(conn);
+}
+
+static void conn_on_alloc(uv_handle_t *handle, size_t suggested, uv_buf_t *buf) {
+    (void)suggested;
+    HttpConnection *conn = (HttpConnection*)handle->data;
+    if (!conn_reserve(conn, HTTP_READ_MIN)) {
+        *buf = uv_buf_init(NULL, 0);
+        return;
+    }
+    *buf = uv_buf_init(conn->input->data + conn->length, (unsigned int)(conn->input->capacity - conn->length));
+}
+
+static void conn_on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    (void)buf;
+    HttpConnection *conn = (HttpConnection*)stream->data;
+
+    if (nread > 0) {
+        conn->length += (size_t)nread;
+    } else if (nread == UV_EOF) {
+        conn->eof = 1;
+        uv_read_stop(stream);
+        conn->reading = 0;
+    } else if (nread < 0) {
+        conn_close(conn);
+        return;
+    } else {
+        return;
+    }
+
+    conn_process(conn, conn->server->L);
+}
+
+// Keeps reading ahead for pipelined requests, but only so far
+static void conn_update_reading(HttpConnection *conn) {
+    int wanted = !conn->eof && !conn->closing && (!conn->busy || conn->length - conn->start < HTTP_MAX_PENDING);
+    if (wanted && !conn->reading) {
+        conn->reading = uv_read_start((uv_stream_t*)&conn->handle, conn_on_alloc, conn_on_read) == 0;
+    } else if (!wanted && conn->reading) {
+        uv_read_stop((uv_stream_t*)&conn->handle);
+        conn->reading = 0;
+    }
+}
+
+static void server_on_connection(uv_stream_t *stream, int status) {
+    HttpServer *server = (HttpServer*)stream->data;
+    if (status < 0) {
+        return;
+    }
+
+    HttpConnection *conn = (HttpConnection*)calloc(1, sizeof(HttpConnection));
+    if (!conn) {
+        return;
+    }
+    conn->input = input_new(HTTP_INPUT_SIZE);
+    if (!conn->input) {
+        free(conn);
+        return;
+    }
+    conn->server = server;
+    conn->response_ref = LUA_NOREF;
+    conn->base.close = conn_on_close;
+    uv_tcp_init(stream->loop, &conn->handle);
+    conn->handle.data = conn;
+    server->connections++;
+
+    if (uv_accept(stream, (uv_stream_t*)&conn->handle) != 0) {
+        uv_close((uv_handle_t*)&conn->handle, conn_on_close);
+        return;
+    }
+    uv_tcp_nodelay(&conn->handle, 1);
+    conn_update_reading(conn);
+}
+
+// The Date header only changes once per second
+static const char* server_date(HttpServer *server) {
+    time_t now = time(NULL);
+    if (now != server->date_second) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(server->date, sizeof(server->date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        server->date_second = now;
+    }
+    return server->date;
+}
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    char inline_data[1024];
+} HttpHead;
+
+static void head_append(HttpHead *head, const char *data, size_t length) {
+    if (head->length + length > head->capacity) {
+        size_t capacity = head->capacity * 2;
+        while (capacity < head->length + length) {
+            capacity *= 2;
+        }
+        char *grown = (char*)malloc(capacity);
+        if (!grown) {
+            return;
+        }
+        memcpy(grown, head->data, head->length);
+        if (head->data != head->inline_data) {
+            free(head->data);
+        }
+        head->data = grown;
+        head->capacity = capacity;
+    }
+    memcpy(head->data + head->length, data, length);
+    head->length += length;
+}
+
+static void head_append_string(HttpHead *head, const char *text) {
+    head_append(head, text, strlen(text));
+}
+
+// Writes the head and the body as two buffers of one batched write. Expects
+// the response userdata at index 1 and the body (if any) at `body`.
+static void response_send(lua_State *L, HttpResponse *response, int body) {
+    response->sent = 1;
+    HttpConnection *conn = response->conn;
+    if (!conn) {
+        return;
+    }
+
+    size_t body_length = 0;
+    if (body) {
+        buffer_check_bytes(L, body, &body_length);
+    }
+
+    HttpHead head;
+    head.data = head.inline_data;
+    head.length = 0;
+    head.capacity = sizeof(head.inline_data);
+
+    char line[128];
+    int length = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nDate: ",
+        response->status, http_reason(response->status), body_length);
+    head_append(&head, line, (size_t)length);
+    head_append_string(&head, server_date(conn->server));
+    head_append(&head, "\r\n", 2);
+
+    if (!response->keep_alive) {
+        head_append_string(&head, "Connection: close\r\n");
+    } else if (response->minor == 0) {
+        head_append_string(&head, "Connection: keep-alive\r\n");
+    }
+
+    if (lua_getiuservalue(L, 1, 1) == LUA_TTABLE) {
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            size_t name_length, value_length;
+            const char *name = lua_tolstring(L, -2, &name_length);
+            const char *value = lua_tolstring(L, -1, &value_length);
+            head_append(&head, name, name_length);
+            head_append(&head, ": ", 2);
+            head_append(&head, value, value_length);
+            head_append(&head, "\r\n", 2);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    head_append(&head, "\r\n", 2);
+
+    lua_pushlstring(L, head.data, head.length);
+    if (head.data != head.inline_data) {
+        free(head.data);
+    }
+
+    int first = lua_gettop(L);
+    if (body && body_length > 0) {
+        lua_pushvalue(L, body);
+    }
+    tcp_write_values(L, (uv_stream_t*)&conn->handle, first, lua_gettop(L));
+    lua_settop(L, first - 1);
+
+    response->conn = NULL;
+    conn->response = NULL;
+    conn->busy = 0;
+    luaL_unref(L, LUA_REGISTRYINDEX, conn->response_ref);
+    conn->response_ref = LUA_NOREF;
+
+    if (!response->keep_alive) {
+        conn_close(conn);
+        return;
+    }
+    conn_process(conn, L);
+}
+
+static HttpResponse* response_check(lua_State *L) {
+    return (HttpResponse*)luaL_checkudata(L, 1, HTTP_RESPONSE_METATABLE);
+}
+
+// res:setStatus(code)
+static int response_set_status(lua_State *L) {
+    HttpResponse *response = response_check(L);
+    int status = (int)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, status >= 100 && status <= 999, 2, "invalid status code");
+    response->status = status;
+    lua_settop(L, 1);
+    return 1;
+}
+
+// res:setHeader(name, value)
+static int response_set_header(lua_State *L) {
+    HttpResponse *response = response_check(L);
+    luaL_checkstring(L, 2);
+    luaL_checkstring(L, 3);
+    if (response->sent) {
+        return luaL_error(L, "Cannot set headers after the response was sent");
+    }
+
+    // Content-Length and Connection are managed by the server
+    size_t length;
+    const char *name = lua_tolstring(L, 2, &length);
+    if (token_equals(name, length, "content-length") || token_equals(name, length, "connection")) {
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 4);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, 1, 1);
+    }
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 3);
+    lua_rawset(L, -3);
+    lua_settop(L, 1);
+    return 1;
+}
+
+// res:send(body)
+static int response_send_lua(lua_State *L) {
+    HttpResponse *response = response_check(L);
+    if (response->sent) {
+        return luaL_error(L, "Response was already sent");
+    }
+    int body = 0;
+    if (!lua_isnoneornil(L, 2)) {
+        size_t length;
+        buffer_check_bytes(L, 2, &length);
+        body = 2;
+    }
+    response_send(L, response, body);
+    return 0;
+}
+
+static HttpRequest* request_check(lua_State *L) {
+    return (HttpRequest*)luaL_checkudata(L, 1, HTTP_REQUEST_METATABLE);
+}
+
+// req:header(name), case-insensitive lookup without building the headers table
+static int request_header(lua_State *L) {
+    HttpRequest *request = request_check(L);
+    size_t length;
+    const char *name = luaL_checklstring(L, 2, &length);
+    const char *data = request->input->data;
+
+    for (int i = 0; i < request->header_count; i++) {
+        HttpHeader *header = &request->headers[i];
+        if (header->name_length == length && strncasecmp(data + header->name, name, length) == 0) {
+            lua_pushlstring(L, data + header->value, header->value_length);
+            return 1;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+// Builds the lowercased header table on first use, repeated headers are
+// joined with ", "
+static void request_push_headers(lua_State *L, HttpRequest *request) {
+    if (lua_getiuservalue(L, 1, 1) == LUA_TTABLE) {
+        return;
+    }
+    lua_pop(L, 1);
+
+    const char *data = request->input->data;
+    lua_createtable(L, 0, request->header_count);
+    for (int i = 0; i < request->header_count; i++) {
+        HttpHeader *header = &request->headers[i];
+        char name[256];
+        size_t length = header->name_length < sizeof(name) ? header->name_length : sizeof(name) - 1;
+        for (size_t j = 0; j < length; j++) {
+            char c = data[header->name + j];
+            name[j] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+        }
+
+        lua_pushlstring(L, name, length);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, -3) == LUA_TSTRING) {
+            lua_pushliteral(L, ", ");
+            lua_pushlstring(L, data + header->value, header->value_length);
+            lua_concat(L, 3);
+        } else {
+            lua_pop(L, 1);
+            lua_pushlstring(L, data + header->value, header->value_length);
+        }
+        lua_rawset(L, -3);
+    }
+
+    lua_pushvalue(L, -1);
+    lua_setiuservalue(L, 1, 1);
+}
+
+static int request_index(lua_State *L) {
+    HttpRequest *request = request_check(L);
+    const char *key = luaL_checkstring(L, 2);
+    const char *data = request->input->data;
+
+    if (strcmp(key, "method") == 0) {
+        lua_pushlstring(L, data + request->method, request->method_length);
+    } else if (strcmp(key, "path") == 0 || strcmp(key, "query") == 0) {
+        const char *target = data + request->target;
+        const char *query = (const char*)memchr(target, '?', request->target_length);
+        if (key[0] == 'p') {
+            lua_pushlstring(L, target, query ? (size_t)(query - target) : request->target_length);
+        } else if (query) {
+            lua_pushlstring(L, query + 1, request->target_length - (size_t)(query + 1 - target));
+        } else {
+            lua_pushnil(L);
+        }
+    } else if (strcmp(key, "url") == 0) {
+        lua_pushlstring(L, data + request->target, request->target_length);
+    } else if (strcmp(key, "version") == 0) {
+        lua_pushstring(L, request->minor == 1 ? "HTTP/1.1" : "HTTP/1.0");
+    } else if (strcmp(key, "body") == 0) {
+        lua_pushlstring(L, data + request->body, request->body_length);
+    } else if (strcmp(key, "headers") == 0) {
+        request_push_headers(L, request);
+    } else if (strcmp(key, "header") == 0) {
+        lua_pushcfunction(L, request_header);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int request_gc(lua_State *L) {
+    HttpRequest *request = request_check(L);
+    input_unref(request->input);
+    request->input = NULL;
+    return 0;
+}
+
+static HttpServer* server_check(lua_State *L) {
+    return (HttpServer*)luaL_checkudata(L, 1, HTTP_SERVER_METATABLE);
+}
+
+// server:listen(port, host, backlog)
+static int server_listen(lua_State *L) {
+    HttpServer *server = server_check(L);
+    int port = (int)luaL_checkinteger(L, 2);
+    const char *host = luaL_optstring(L, 3, "0.0.0.0");
+    int backlog = (int)luaL_optinteger(L, 4, HTTP_BACKLOG);
+
+    struct sockaddr_storage addr;
+    if (uv_ip4_addr(host, port, (struct sockaddr_in*)&addr) != 0
+        && uv_ip6_addr(host, port, (struct sockaddr_in6*)&addr) != 0) {
+        return luaL_error(L, "Invalid address '%s'", host);
+    }
+
+    int status = uv_tcp_bind(&server->handle, (const struct sockaddr*)&addr, 0);
+    if (status == 0) {
+        status = uv_listen((uv_stream_t*)&server->handle, backlog, server_on_connection);
+    }
+    if (status < 0) {
+        return luaL_error(L, "Failed to listen on %s:%d: %s", host, port, uv_strerror(status));
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+}
+
+static void server_on_close(uv_handle_t *handle) {
+    HttpServer *server = (HttpServer*)handle->data;
+    server->closed = 1;
+    if (server->connections == 0) {
+        luaL_unref(server->L, LUA_REGISTRYINDEX, server->handler_ref);
+        luaL_unref(server->L, LUA_REGISTRYINDEX, server->self_ref);
+    }
+}
+
+// server:close(), stops accepting while open connections finish
+static int server_close(lua_State *L) {
+    HttpServer *server = server_check(L);
+    if (!uv_is_closing((uv_handle_t*)&server->handle)) {
+        uv_close((uv_handle_t*)&server->handle, server_on_close);
+    }
+    return 0;
+}
+
+// reflex.http.createServer(handler)
+int http_create_server(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    LuaAPI *api = reflex_get_api(L);
+
+    HttpServer *server = (HttpServer*)lua_newuserdatauv(L, sizeof(HttpServer), 0);
+    memset(server, 0, sizeof(HttpServer));
+    luaL_setmetatable(L, HTTP_SERVER_METATABLE);
+    server->L = api->L;
+    server->base.close = server_on_close;
+    uv_tcp_init(api->loop, &server->handle);
+    server->handle.data = server;
+
+    lua_pushvalue(L, 1);
+    server->handler_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, -1);
+    server->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+void define_http_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    static const luaL_Reg server_methods[] = {
+        {"listen", server_listen},
+        {"close", server_close},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, HTTP_SERVER_METATABLE);
+    luaL_newlib(L, server_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, HTTP_REQUEST_METATABLE);
+    lua_pushcfunction(L, request_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, request_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    static const luaL_Reg response_methods[] = {
+        {"setStatus", response_set_status},
+        {"setHeader", response_set_header},
+        {"send", response_send_lua},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, HTTP_RESPONSE_METATABLE);
+    luaL_newlib(L, response_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    reflex_register_table_field(api, "reflex", "http", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.http", "createServer", REFLEX_TYPE_FUNCTION, http_create_server);
+}
@@ -0,0 +1,671 @@
+#include "apis/parallel_api.h"
+#include "apis/async_api.h"
+#include "reflex_api.h"
+#include "serialize.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARALLEL_UNITS_PER_WORKER 8    // Units per job and worker, spare ones get stolen
+#define PARALLEL_MAX_UPVALUES 255
+#define PARALLEL_WORKER_KEY "reflex.parallel.worker"
+
+enum { JOB_MAP, JOB_REDUCE };
+
+typedef struct {
+    SerialBuffer output;   // Results of the unit's items (map) or its partial (reduce)
+    size_t *ends;          // Map: end offset of each item's result in `output`
+} ParallelResult;
+
+typedef struct {
+    ReflexHandle base;
+    int kind;
+    uint64_t id;
+    SerialBuffer code;                      // lua_dump of the function
+    SerialBuffer upvalues;                  // Upvalues that are not the globals
+    uint8_t env[PARALLEL_MAX_UPVALUES];     // Upvalues bound to the worker's globals
+    int upvalue_count;
+    SerialBuffer items;
+    size_t *item_ends;                      // Item i spans item_ends[i - 1]..item_ends[i]
+    size_t count;
+    size_t grain;                           // Items per unit
+    size_t unit_count;
+    ParallelResult *results;
+    atomic_size_t remaining;                // Units not yet finished
+    atomic_int failed;
+    char error[512];                        // First failure, valid once `failed` is set
+
+    // Completion, blocking outside of a task or through the caller's loop.
+    // `done` is posted once the pool is finished with the job, also after
+    // `async` was sent, so the async is only freed after the last send.
+    int blocking;
+    uv_sem_t done;
+    uv_async_t async;
+    ReflexTask *task;
+    lua_State *L;                           // Caller's main thread
+    int fn_ref;                             // Reduce: folds the partials on the caller
+    int init_ref;
+} ParallelJob;
+
+typedef struct {
+    ParallelJob *job;
+    size_t index;
+} ParallelUnit;
+
+// The owner pushes and pops at the bottom, idle workers steal from the top
+typedef struct {
+    uv_mutex_t lock;
+    ParallelUnit *units;
+    size_t capacity;       // Power of two
+    size_t top;
+    size_t bottom;
+} ParallelDeque;
+
+typedef struct {
+    int index;
+    uv_thread_t thread;
+    ParallelDeque deque;
+    lua_State *L;
+    uint64_t loaded_job;   // Job whose function is loaded in `fn_ref`
+    int fn_ref;
+} ParallelWorker;
+
+static struct {
+    ParallelWorker *workers;
+    int count;
+    uv_mutex_t lock;
+    uv_cond_t wake;
+    atomic_size_t pending;     // Units queued in any deque
+    atomic_uint_fast64_t next_id;
+    atomic_uint_fast32_t next_worker;
+} pool;
+
+static uv_once_t pool_once = UV_ONCE_INIT;
+static unsigned int pool_size = 0;
+
+void parallel_set_pool_size(unsigned int size) {
+    pool_size = size;
+}
+
+static int deque_push(ParallelDeque *deque, ParallelUnit unit) {
+    uv_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        ParallelUnit *units = (ParallelUnit*)malloc(capacity * sizeof(ParallelUnit));
+        if (!units) {
+            uv_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++) {
+            units[i & (capacity - 1)] = deque->units[i & (deque->capacity - 1)];
+        }
+        free(deque->units);
+        deque->units = units;
+        deque->capacity = capacity;
+    }
+    deque->units[deque->bottom & (deque->capacity - 1)] = unit;
+    deque->bottom++;
+    uv_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+static int deque_pop(ParallelDeque *deque, ParallelUnit *unit) {
+    int found = 0;
+    uv_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        deque->bottom--;
+        *unit = deque->units[deque->bottom & (deque->capacity - 1)];
+        found = 1;
+    }
+    uv_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int deque_steal(ParallelDeque *deque, ParallelUnit *unit) {
+    int found = 0;
+    uv_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        *unit = deque->units[deque->top & (deque->capacity - 1)];
+        deque->top++;
+        found = 1;
+    }
+    uv_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void job_fail(ParallelJob *job, const char *format, const char *detail) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&job->failed, &expected, 1)) {
+        snprintf(job->error, sizeof(job->error), format, detail);
+    }
+}
+
+static const char* error_message(lua_State *L) {
+    const char *message = lua_tostring(L, -1);
+    return message ? message : "(error object is not a string)";
+}
+
+// Items and results are read by whoever needs them, the job keeps the
+// channel references in them until it is freed, whether it failed or not
+static void job_free(ParallelJob *job) {
+    serial_buffer_free(&job->code);
+    serial_release_channels(job->upvalues.data, job->upvalues.length);
+    serial_buffer_free(&job->upvalues);
+    serial_release_channels(job->items.data, job->items.length);
+    serial_buffer_free(&job->items);
+    free(job->item_ends);
+    if (job->results) {
+        for (size_t i = 0; i < job->unit_count; i++) {
+            serial_release_channels(job->results[i].output.data, job->results[i].output.length);
+            serial_buffer_free(&job->results[i].output);
+            free(job->results[i].ends);
+        }
+        free(job->results);
+    }
+    if (job->L) {
+        luaL_unref(job->L, LUA_REGISTRYINDEX, job->fn_ref);
+        luaL_unref(job->L, LUA_REGISTRYINDEX, job->init_ref);
+    }
+    uv_sem_destroy(&job->done);
+    free(job);
+}
+
+// Pushes item `i` of the job, returns 0 or -1 when it is malformed
+static int job_push_item(lua_State *L, ParallelJob *job, size_t i) {
+    size_t start = i ? job->item_ends[i - 1] : 0;
+    return reflex_deserialize(L, job->items.data + start, job->item_ends[i] - start) == 1 ? 0 : -1;
+}
+
+// Loads the job's function into `worker->fn_ref`, once per job and worker
+static int worker_load(ParallelWorker *worker, ParallelJob *job) {
+    lua_State *L = worker->L;
+    if (worker->loaded_job == job->id) {
+        return 0;
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, worker->fn_ref);
+    worker->fn_ref = LUA_NOREF;
+    worker->loaded_job = 0;
+
+    if (luaL_loadbufferx(L, job->code.data, job->code.length, "=parallel", "b") != 0) {
+        job_fail(job, "Failed to load the parallel function: %s", error_message(L));
+        lua_pop(L, 1);
+        return -1;
+    }
+    int fn = lua_gettop(L);
+
+    // Upvalues are copies, changes made by the function stay on this worker
+    int count = reflex_deserialize(L, job->upvalues.data, job->upvalues.length);
+    if (count < 0) {
+        job_fail(job, "%s", "Received malformed upvalues");
+        lua_settop(L, fn - 1);
+        return -1;
+    }
+    int next = fn + 1;
+    for (int i = 1; i <= job->upvalue_count; i++) {
+        if (job->env[i - 1]) {
+            lua_pushglobaltable(L);
+        } else {
+            lua_pushvalue(L, next++);
+        }
+        lua_setupvalue(L, fn, i);
+    }
+    lua_settop(L, fn);
+
+    worker->fn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    worker->loaded_job = job->id;
+    return 0;
+}
+
+static void worker_map(ParallelWorker *worker, ParallelJob *job, ParallelResult *result, size_t first, size_t last) {
+    lua_State *L = worker->L;
+
+    result->ends = (size_t*)malloc((last - first) * sizeof(size_t));
+    if (!result->ends) {
+        job_fail(job, "%s", "Failed to allocate results");
+        return;
+    }
+
+    for (size_t i = first; i < last && !atomic_load(&job->failed); i++) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, worker->fn_ref);
+        if (job_push_item(L, job, i) != 0) {
+            job_fail(job, "%s", "Received a malformed item");
+            break;
+        }
+        lua_pushinteger(L, (lua_Integer)(i + 1));
+        if (lua_pcall(L, 2, 1, 0) != 0) {
+            job_fail(job, "%s", error_message(L));
+            break;
+        }
+        if (reflex_serialize(L, -1, -1, &result->output) != 0) {
+            job_fail(job, "Result cannot be sent: %s", result->output.error);
+            break;
+        }
+        lua_pop(L, 1);
+        result->ends[i - first] = result->output.length;
+    }
+}
+
+// Folds the unit's items into one partial result
+static void worker_reduce(ParallelWorker *worker, ParallelJob *job, ParallelResult *result, size_t first, size_t last) {
+    lua_State *L = worker->L;
+
+    if (job_push_item(L, job, first) != 0) {
+        job_fail(job, "%s", "Received a malformed item");
+        return;
+    }
+    for (size_t i = first + 1; i < last && !atomic_load(&job->failed); i++) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, worker->fn_ref);
+        lua_insert(L, -2);
+        if (job_push_item(L, job, i) != 0) {
+            job_fail(job, "%s", "Received a malformed item");
+            return;
+        }
+        if (lua_pcall(L, 2, 1, 0) != 0) {
+            job_fail(job, "%s", error_message(L));
+            return;
+        }
+    }
+    if (reflex_serialize(L, -1, -1, &result->output) != 0) {
+        job_fail(job, "Result cannot be sent: %s", result->output.error);
+    }
+}
+
+static void worker_run(ParallelWorker *worker, ParallelUnit unit) {
+    ParallelJob *job = unit.job;
+    int top = lua_gettop(worker->L);
+
+    if (!atomic_load(&job->failed) && worker_load(worker, job) == 0) {
+        size_t first = unit.index * job->grain;
+        size_t last = first + job->grain < job->count ? first + job->grain : job->count;
+        ParallelResult *result = &job->results[unit.index];
+        if (job->kind == JOB_MAP) {
+            worker_map(worker, job, result, first, last);
+        } else {
+            worker_reduce(worker, job, result, first, last);
+        }
+    }
+    lua_settop(worker->L, top);
+
+    if (atomic_fetch_sub(&job->remaining, 1) == 1) {
+        if (!job->blocking) {
+            uv_async_send(&job->async);
+        }
+        uv_sem_post(&job->done);
+    }
+}
+
+// Own units first (most recently queued, still warm), then steal the
+// oldest unit of another worker
+static int worker_take(ParallelWorker *worker, ParallelUnit *unit) {
+    int found = deque_pop(&worker->deque, unit);
+    for (int i = 1; !found && i < pool.count; i++) {
+        found = deque_steal(&pool.workers[(worker->index + i) % pool.count].deque, unit);
+    }
+    if (found) {
+        atomic_fetch_sub(&pool.pending, 1);
+    }
+    return found;
+}
+
+static void worker_main(void *arg) {
+    ParallelWorker *worker = (ParallelWorker*)arg;
+    ParallelUnit unit;
+
+    while (1) {
+        if (worker_take(worker, &unit)) {
+            worker_run(worker, unit);
+            continue;
+        }
+        uv_mutex_lock(&pool.lock);
+        while (atomic_load(&pool.pending) == 0) {
+            uv_cond_wait(&pool.wake, &pool.lock);
+        }
+        uv_mutex_unlock(&pool.lock);
+    }
+}
+
+// The pool lives for the whole process, each worker keeps a state with the
+// builtins loaded so a job only costs loading its function
+static void pool_init(void) {
+    int count = (int)pool_size;
+    if (count <= 0) {
+        uv_cpu_info_t *cpus;
+        if (uv_cpu_info(&cpus, &count) == 0) {
+            uv_free_cpu_info(cpus, count);
+        }
+        if (count <= 0) {
+            count = 1;
+        }
+    }
+
+    pool.workers = (ParallelWorker*)calloc((size_t)count, sizeof(ParallelWorker));
+    if (!pool.workers) {
+        return;
+    }
+    uv_mutex_init(&pool.lock);
+    uv_cond_init(&pool.wake);
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.next_id, 1);
+    atomic_init(&pool.next_worker, 0);
+
+    for (int i = 0; i < count; i++) {
+        ParallelWorker *worker = &pool.workers[i];
+        LuaAPI *api = reflex_new();
+        if (!api) {
+            break;
+        }
+        define_reflex_builtin(api);
+        lua_pushboolean(api->L, 1);
+        lua_setfield(api->L, LUA_REGISTRYINDEX, PARALLEL_WORKER_KEY);
+
+        worker->index = i;
+        worker->L = api->L;
+        worker->fn_ref = LUA_NOREF;
+        uv_mutex_init(&worker->deque.lock);
+        if (uv_thread_create(&worker->thread, worker_main, worker) != 0) {
+            reflex_free(api);
+            break;
+        }
+        pool.count = i + 1;
+    }
+}
+
+// Spreads the units over the deques starting at a rotating worker
+static int pool_submit(ParallelJob *job) {
+    int start = (int)(atomic_fetch_add(&pool.next_worker, 1) % (uint_fast32_t)pool.count);
+    for (size_t i = 0; i < job->unit_count; i++) {
+        ParallelUnit unit = { job, i };
+        ParallelWorker *worker = &pool.workers[(start + (int)(i % (size_t)pool.count)) % pool.count];
+        if (deque_push(&worker->deque, unit) != 0) {
+            // Units that were not queued count as done, the caller completes
+            // the job itself when none were queued at all
+            job_fail(job, "%s", "Failed to queue parallel work");
+            size_t skipped = job->unit_count - i;
+            if (atomic_fetch_sub(&job->remaining, skipped) == skipped) {
+                return -1;
+            }
+            break;
+        }
+        atomic_fetch_add(&pool.pending, 1);
+    }
+
+    uv_mutex_lock(&pool.lock);
+    uv_cond_broadcast(&pool.wake);
+    uv_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+// Pushes the result of a finished job onto `L`. Returns 0, or -1 with the
+// error message pushed instead.
+static int job_collect(lua_State *L, ParallelJob *job) {
+    if (atomic_load(&job->failed)) {
+        lua_pushstring(L, job->error);
+        return -1;
+    }
+
+    if (job->kind == JOB_MAP) {
+        lua_createtable(L, job->count < INT32_MAX ? (int)job->count : 0, 0);
+        for (size_t unit = 0; unit < job->unit_count; unit++) {
+            ParallelResult *result = &job->results[unit];
+            size_t first = unit * job->grain;
+            size_t start = 0;
+            for (size_t i = first; i < first + job->grain && i < job->count; i++) {
+                size_t end = result->ends[i - first];
+                if (reflex_deserialize(L, result->output.data + start, end - start) != 1) {
+                    lua_pop(L, 1);
+                    lua_pushstring(L, "Received a malformed result");
+                    return -1;
+                }
+                lua_rawseti(L, -2, (lua_Integer)(i + 1));
+                start = end;
+            }
+        }
+        return 0;
+    }
+
+    // The partials are folded in order, so only associativity is required
+    lua_rawgeti(L, LUA_REGISTRYINDEX, job->fn_ref);
+    int has_value = job->init_ref != LUA_NOREF;
+    if (has_value) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, job->init_ref);
+    }
+    for (size_t unit = 0; unit < job->unit_count; unit++) {
+        SerialBuffer *output = &job->results[unit].output;
+        if (reflex_deserialize(L, output->data, output->length) != 1) {
+            lua_pop(L, has_value ? 2 : 1);
+            lua_pushstring(L, "Received a malformed result");
+            return -1;
+        }
+        if (!has_value) {
+            has_value = 1;
+            continue;
+        }
+        lua_pushvalue(L, -3);
+        lua_insert(L, -3);
+        if (lua_pcall(L, 2, 1, 0) != 0) {
+            lua_remove(L, -2);
+            return -1;
+        }
+    }
+    lua_remove(L, -2);
+    return 0;
+}
+
+// Also closes the job of a state that is freed while the pool still runs
+// it, after waiting for the pool
+static void job_on_close(uv_handle_t *handle) {
+    ParallelJob *job = (ParallelJob*)handle->data;
+    uv_sem_wait(&job->done);
+    job_free(job);
+}
+
+static void job_on_done(uv_async_t *handle) {
+    ParallelJob *job = (ParallelJob*)handle->data;
+    lua_State *co = reflex_async_thread(job->task);
+
+    // Reduce calls the function, which cannot run on the suspended task
+    if (job_collect(job->L, job) == 0) {
+        lua_xmove(job->L, co, 1);
+        reflex_async_resume(job->task, 1);
+    } else {
+        reflex_async_reject(job->task, error_message(job->L));
+        lua_pop(job->L, 1);
+    }
+    uv_close((uv_handle_t*)handle, job_on_close);
+}
+
+static int parallel_writer(lua_State *L, const void *data, size_t length, void *buffer) {
+    (void)L;
+    return serial_buffer_append((SerialBuffer*)buffer, data, length);
+}
+
+// Serializes the function at index 2 and its upvalues into the job. Returns
+// 0, or -1 with the error message in `error`.
+static int job_set_function(lua_State *L, ParallelJob *job, char *error, size_t size) {
+    if (lua_iscfunction(L, 2)) {
+        snprintf(error, size, "C functions cannot be run in parallel");
+        return -1;
+    }
+
+    lua_pushvalue(L, 2);
+    int status = lua_dump(L, parallel_writer, &job->code, 0);
+    lua_pop(L, 1);
+    if (status != 0) {
+        snprintf(error, size, "Failed to dump the function: %s", job->code.error);
+        return -1;
+    }
+
+    const char *name;
+    for (int i = 1; (name = lua_getupvalue(L, 2, i)) != NULL; i++) {
+        if (i > PARALLEL_MAX_UPVALUES) {
+            lua_pop(L, 1);
+            snprintf(error, size, "Too many upvalues");
+            return -1;
+        }
+        job->upvalue_count = i;
+
+        lua_pushglobaltable(L);
+        int is_env = strcmp(name, "_ENV") == 0 || lua_rawequal(L, -1, -2);
+        lua_pop(L, 1);
+        if (is_env) {
+            job->env[i - 1] = 1;
+            lua_pop(L, 1);
+            continue;
+        }
+
+        if (reflex_serialize(L, -1, -1, &job->upvalues) != 0) {
+            snprintf(error, size, "Upvalue '%s' cannot be sent: %s", name, job->upvalues.error);
+            lua_pop(L, 1);
+            return -1;
+        }
+        lua_pop(L, 1);
+    }
+
+    // Upvalues are copies per worker, a captured channel would be shared
+    // by all of them without saying so
+    if (job->upvalues.channels > 0) {
+        snprintf(error, size, "Channels cannot be captured as upvalues, pass them as items");
+        return -1;
+    }
+    return 0;
+}
+
+static int parallel_run(lua_State *L, int kind) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    int has_init = kind == JOB_REDUCE && !lua_isnone(L, 3);
+    lua_settop(L, 3);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, PARALLEL_WORKER_KEY);
+    int nested = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (nested) {
+        return luaL_error(L, "reflex.parallel cannot be used from within a parallel function");
+    }
+
+    size_t count = (size_t)lua_rawlen(L, 1);
+    if (count == 0) {
+        if (kind == JOB_MAP) {
+            lua_newtable(L);
+        } else {
+            lua_pushvalue(L, 3);
+        }
+        return 1;
+    }
+
+    uv_once(&pool_once, pool_init);
+    if (pool.count == 0) {
+        return luaL_error(L, "Failed to start the parallel pool");
+    }
+
+    ParallelJob *job = (ParallelJob*)calloc(1, sizeof(ParallelJob));
+    if (!job) {
+        return luaL_error(L, "Failed to allocate parallel job");
+    }
+    uv_sem_init(&job->done, 0);
+    job->kind = kind;
+    job->id = atomic_fetch_add(&pool.next_id, 1);
+    job->count = count;
+    job->fn_ref = LUA_NOREF;
+    job->init_ref = LUA_NOREF;
+    serial_buffer_init(&job->code);
+    serial_buffer_init(&job->upvalues);
+    serial_buffer_init(&job->items);
+
+    char error[256];
+    if (job_set_function(L, job, error, sizeof(error)) != 0) {
+        job_free(job);
+        return luaL_error(L, "%s", error);
+    }
+
+    job->item_ends = (size_t*)malloc(count * sizeof(size_t));
+    if (!job->item_ends) {
+        job_free(job);
+        return luaL_error(L, "Failed to allocate parallel job");
+    }
+    for (size_t i = 0; i < count; i++) {
+        lua_rawgeti(L, 1, (lua_Integer)(i + 1));
+        if (reflex_serialize(L, -1, -1, &job->items) != 0) {
+            snprintf(error, sizeof(error), "Item %zu cannot be sent: %s", i + 1, job->items.error);
+            job_free(job);
+            return luaL_error(L, "%s", error);
+        }
+        lua_pop(L, 1);
+        job->item_ends[i] = job->items.length;
+    }
+
+    // Enough units for stealing to even out uneven items, few enough to
+    // keep the per-unit overhead small
+    size_t target = (size_t)pool.count * PARALLEL_UNITS_PER_WORKER;
+    job->grain = (count + target - 1) / target;
+    job->unit_count = (count + job->grain - 1) / job->grain;
+    job->results = (ParallelResult*)calloc(job->unit_count, sizeof(ParallelResult));
+    if (!job->results) {
+        job_free(job);
+        return luaL_error(L, "Failed to allocate parallel job");
+    }
+    for (size_t i = 0; i < job->unit_count; i++) {
+        serial_buffer_init(&job->results[i].output);
+    }
+    atomic_init(&job->remaining, job->unit_count);
+    atomic_init(&job->failed, 0);
+
+    LuaAPI *api = reflex_get_api(L);
+    job->L = api->L;
+    if (kind == JOB_REDUCE) {
+        lua_pushvalue(L, 2);
+        job->fn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (has_init) {
+            lua_pushvalue(L, 3);
+            job->init_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+    }
+
+    // Inside a task the loop keeps running while the pool works
+    ReflexTask *task = reflex_async_current(L);
+    if (task) {
+        job->task = task;
+        job->base.close = job_on_close;
+        uv_async_init(api->loop, &job->async, job_on_done);
+        job->async.data = job;
+        if (pool_submit(job) != 0) {
+            uv_async_send(&job->async);
+            uv_sem_post(&job->done);
+        }
+        return reflex_async_await(L, task);
+    }
+
+    job->blocking = 1;
+    if (pool_submit(job) == 0) {
+        uv_sem_wait(&job->done);
+    }
+
+    int status = job_collect(L, job);
+    job_free(job);
+    if (status != 0) {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+// reflex.parallel.map(list, fn), calls fn(item, index) for every item on the
+// pool and returns the results in order
+int parallel_map(lua_State *L) {
+    return parallel_run(L, JOB_MAP);
+}
+
+// reflex.parallel.reduce(list, fn, init), folds the list with fn(a, b) on the
+// pool. fn must be associative, chunks are folded in parallel then combined
+// in order.
+int parallel_reduce(lua_State *L) {
+    return parallel_run(L, JOB_REDUCE);
+}
+
+void define_parallel_api(LuaAPI *api) {
+    reflex_register_table_field(api, "reflex", "parallel", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.parallel", "map", REFLEX_TYPE_FUNCTION, parallel_map);
+    reflex_register_table_field(api, "reflex.parallel", "reduce", REFLEX_TYPE_FUNCTION, parallel_reduce);
+}
@@ -8,6 +8,7 @@
 #include "version.h"
 #include "args.h"
 #include "lua.h"
+#include "output.h"
 
 int process_platform(lua_State *L) {
     #if defined(_WIN64)
@@ -28,7 +29,7 @@ int process_platform(lua_State *L) {
 int process_exit(lua_State *L) {
     int exitCode = get_as_number(L, 1); // Ensure integer conversion
     printlogf("Exiting application with code: %d", exitCode);
-    fflush(stdout);
+    reflex_output_flush();
     exit(exitCode);
 }
 
@@ -39,6 +40,33 @@ int process_pid(lua_State *L)
     return lua_return(L, REFLEX_TYPE_NUMBER, (double)pid);
 }
 
+// Monotonic time in nanoseconds, for measuring durations
+int process_hrtime(lua_State *L)
+{
+    lua_pushinteger(L, (lua_Integer)uv_hrtime());
+    return 1;
+}
+
+// Bytes held by this state and the resident memory of the process
+int process_memory_usage(lua_State *L) {
+    LuaAPI *api = reflex_get_api(L);
+    size_t rss = 0;
+    uv_resident_set_memory(&rss);
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, api ? (lua_Integer)api->memory.live : 0);
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, api ? (lua_Integer)api->memory.peak : 0);
+    lua_setfield(L, -2, "peak");
+    if (api && api->memory.limit) {
+        lua_pushinteger(L, (lua_Integer)api->memory.limit);
+        lua_setfield(L, -2, "limit");
+    }
+    lua_pushinteger(L, (lua_Integer)rss);
+    lua_setfield(L, -2, "rss");
+    return 1;
+}
+
 int process_version(lua_State *L) {
 
     return lua_return(L, REFLEX_TYPE_STRING, getVersion());
@@ -82,5 +110,7 @@ void define_process_api(LuaAPI *api)
     reflex_register_table_field(api, "process", "pid", REFLEX_TYPE_FUNCTION, process_pid);
     reflex_register_table_field(api, "process", "exit", REFLEX_TYPE_FUNCTION, process_exit);
     reflex_register_table_field(api, "process", "version", REFLEX_TYPE_FUNCTION, process_version);
+    reflex_register_table_field(api, "process", "hrtime", REFLEX_TYPE_FUNCTION, process_hrtime);
+    reflex_register_table_field(api, "process", "memoryUsage", REFLEX_TYPE_FUNCTION, process_memory_usage);
     process_versions(api);
 }
\ No newline at end of file
@@ -1,58 +1,180 @@
 #include "apis/reflex_logger_api.h"
 #include "lua_api.h"
-#include "logger.h"
+#include "log_writer.h"
+#include "log_format.h"
+#include <uv.h>
+
+// reflex.logger.<level>(message, fields), the fields table is optional
+static int logger_log(lua_State* L, ReflexLogLevel level) {
+
+    reflex_log_record(L, level, 1, lua_istable(L, 2) ? 2 : 0);
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
 
 int logger_info(lua_State* L) {
     
-    char* info = colorize("INFO:", COLOR_GREEN);
-    char* message = get_as_string(L, 1);
-    multi_coloredlog("%s %s", info, message);
-    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+    return logger_log(L, REFLEX_LOG_INFO);
 
 }
 
 int logger_warn(lua_State* L) {
     
-    char* info = colorize("WARN:", COLOR_YELLOW);
-    char* message = get_as_string(L, 1);
-    multi_coloredlog("%s %s", info, message);
-    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+    return logger_log(L, REFLEX_LOG_WARN);
 
 }
 
 int logger_error(lua_State* L) {
  
-    char* info = colorize("ERROR:", COLOR_RED);
-    char* message = get_as_string(L, 1);
-    multi_coloredlog("%s %s", info, message);
-    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+    return logger_log(L, REFLEX_LOG_ERROR);
 
 }
 
 int logger_debug(lua_State* L) {
     
-    char* info = colorize("DEBUG:", COLOR_MAGENTA);
-    char* message = get_as_string(L, 1);
-    multi_coloredlog("%s %s", info, message);
+    return logger_log(L, REFLEX_LOG_DEBUG);
+
+}
+
+// Stands in for the levels below the state's level, so a disabled call
+// formats nothing
+static int logger_disabled(lua_State* L) {
+
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
+
+static const lua_CFunction level_functions[] = {logger_debug, logger_info, logger_warn, logger_error};
+
+// Binds reflex.logger.<level> to the real or the no-op function
+static void logger_apply_level(lua_State* L, ReflexLogLevel level) {
+
+    lua_getglobal(L, "reflex");
+    lua_getfield(L, -1, "logger");
+    for (int i = REFLEX_LOG_DEBUG; i <= REFLEX_LOG_ERROR; i++) {
+        lua_pushcfunction(L, i < (int)level ? logger_disabled : level_functions[i]);
+        lua_setfield(L, -2, reflex_log_level_name((ReflexLogLevel)i));
+    }
+    lua_pushstring(L, reflex_log_level_name(level));
+    lua_setfield(L, LUA_REGISTRYINDEX, LOGGER_LEVEL_KEY);
+    lua_pop(L, 2);
+
+}
+
+// reflex.logger.setLevel(level), for this state. Functions taken from
+// reflex.logger before the call keep their old behavior.
+int logger_set_level(lua_State* L) {
+
+    ReflexLogLevel level;
+    if (reflex_log_level_parse(luaL_checkstring(L, 1), &level) != 0) {
+        return luaL_argerror(L, 1, "expected \"debug\", \"info\", \"warn\" or \"error\"");
+    }
+    logger_apply_level(L, level);
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
+
+int logger_get_level(lua_State* L) {
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LOGGER_LEVEL_KEY);
+    return 1;
+
+}
+
+// reflex.logger.setFormat("text" or "json"), for every thread
+int logger_set_format(lua_State* L) {
+
+    ReflexLogFormat format;
+    if (reflex_log_format_parse(luaL_checkstring(L, 1), &format) != 0) {
+        return luaL_argerror(L, 1, "expected \"text\" or \"json\"");
+    }
+    reflex_log_set_format(format);
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
+
+static lua_Integer logger_option(lua_State* L, const char* name, lua_Integer fallback) {
+
+    lua_getfield(L, 2, name);
+    lua_Integer value = lua_isnil(L, -1) ? fallback : luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+    if (value < 0) {
+        luaL_error(L, "Option '%s' cannot be negative", name);
+    }
+    return value;
+
+}
+
+// reflex.logger.addFile(path, options), every later record is also appended
+// to the file in blocks
+int logger_add_file(lua_State* L) {
+
+    const char* path = luaL_checkstring(L, 1);
+    ReflexLogFileOptions options = {0};
+    if (!lua_isnoneornil(L, 2)) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        options.block_size = (size_t)logger_option(L, "bufferSize", REFLEX_LOG_BLOCK_SIZE);
+        options.flush_interval = (unsigned int)logger_option(L, "flushInterval", REFLEX_LOG_FLUSH_INTERVAL);
+        options.max_size = (unsigned long long)logger_option(L, "maxSize", 0);
+        options.rotate_every = (unsigned int)logger_option(L, "rotateEvery", 0);
+        lua_getfield(L, 2, "compress");
+        options.compress = lua_isnil(L, -1) ? NULL : luaL_checkstring(L, -1);
+    } else {
+        options.flush_interval = REFLEX_LOG_FLUSH_INTERVAL;
+    }
+
+    int status = reflex_log_add_file(path, &options);
+    if (status != 0) {
+        return luaL_error(L, "Failed to open log file '%s': %s", path, uv_strerror(status));
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
+
+// reflex.logger.setStdout(enabled), for every thread
+int logger_set_stdout(lua_State* L) {
+
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    reflex_log_set_stdout(lua_toboolean(L, 1));
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+
+}
+
+// Waits until everything logged so far has been written
+int logger_flush(lua_State* L) {
+
+    reflex_log_flush();
     return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
 
 }
 
 int logger_override_print(lua_State* L) {
 
-    reflex_register_function_L(L, "print", logger_info);
+    // Follows the level, a disabled info level silences print too
+    lua_getglobal(L, "reflex");
+    lua_getfield(L, -1, "logger");
+    lua_getfield(L, -1, "info");
+    lua_setglobal(L, "print");
+    lua_pop(L, 2);
     return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
 
 }
 
 void define_logger_api(LuaAPI* api) {
 
-    reflex_register_global_table(api, "reflex"); // incase
+    // `reflex` already exists here, the field helper creates it if not
     reflex_register_table_field(api, "reflex", "logger", REFLEX_TYPE_TABLE);
     reflex_register_table_field(api, "reflex.logger", "info", REFLEX_TYPE_FUNCTION, logger_info);
     reflex_register_table_field(api, "reflex.logger", "warn", REFLEX_TYPE_FUNCTION, logger_warn);
     reflex_register_table_field(api, "reflex.logger", "error", REFLEX_TYPE_FUNCTION, logger_error);
     reflex_register_table_field(api, "reflex.logger", "debug", REFLEX_TYPE_FUNCTION, logger_debug);
+    reflex_register_table_field(api, "reflex.logger", "flush", REFLEX_TYPE_FUNCTION, logger_flush);
+    reflex_register_table_field(api, "reflex.logger", "setFormat", REFLEX_TYPE_FUNCTION, logger_set_format);
+    reflex_register_table_field(api, "reflex.logger", "addFile", REFLEX_TYPE_FUNCTION, logger_add_file);
+    reflex_register_table_field(api, "reflex.logger", "setStdout", REFLEX_TYPE_FUNCTION, logger_set_stdout);
+    reflex_register_table_field(api, "reflex.logger", "setLevel", REFLEX_TYPE_FUNCTION, logger_set_level);
+    reflex_register_table_field(api, "reflex.logger", "getLevel", REFLEX_TYPE_FUNCTION, logger_get_level);
     reflex_register_table_field(api, "reflex.logger", "overridePrint", REFLEX_TYPE_FUNCTION, logger_override_print);
+    logger_apply_level(api->L, reflex_log_get_level());
 
 }
\ No newline at end of file
@@ -0,0 +1,481 @@
+#include "apis/tcp_api.h"
+#include "apis/async_api.h"
+#include "lua_api.h"
+#include "buffer.h"
+#include "loop.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TCP_QUEUE_SIZE   16     // Received chunks held before reading pauses
+#define TCP_STACK_BUFS   16     // Buffers batched without a heap allocation
+#define TCP_BACKLOG      511
+
+typedef struct {
+    ReflexHandle base;
+    uv_tcp_t handle;
+    lua_State *L;
+    int self_ref;        // Keeps the userdata alive while the handle is open
+    int handler_ref;     // Connection handler
+} TcpServer;
+
+typedef struct {
+    ReflexHandle base;
+    uv_tcp_t handle;
+    uv_shutdown_t shutdown;
+    lua_State *L;
+    BufferPool *pool;
+    int self_ref;
+    ReflexTask *reader;  // Task suspended in socket:read()
+    BufferChunk queue[TCP_QUEUE_SIZE];
+    int head;
+    int count;
+    int reading;
+    int eof;
+    int error;
+    int closed;
+} TcpSocket;
+
+typedef struct {
+    uv_write_t req;
+    lua_State *L;
+    int pin_ref;         // Table holding the written values
+} TcpWrite;
+
+typedef struct {
+    uv_connect_t req;
+    ReflexTask *task;
+    TcpSocket *socket;
+} TcpConnect;
+
+static int tcp_parse_address(const char *host, int port, struct sockaddr_storage *addr) {
+    if (uv_ip4_addr(host, port, (struct sockaddr_in*)addr) == 0) {
+        return 0;
+    }
+    return uv_ip6_addr(host, port, (struct sockaddr_in6*)addr);
+}
+
+static void tcp_write_done(uv_write_t *req, int status) {
+    (void)status; // Failures surface on the read side of the socket
+    TcpWrite *write = (TcpWrite*)req->data;
+    luaL_unref(write->L, LUA_REGISTRYINDEX, write->pin_ref);
+    free(write);
+}
+
+int tcp_write_values(lua_State *L, uv_stream_t *stream, int first, int last) {
+    int count = last - first + 1;
+    if (count <= 0) {
+        return 0;
+    }
+
+    uv_buf_t stack_bufs[TCP_STACK_BUFS];
+    uv_buf_t *bufs = count <= TCP_STACK_BUFS ? stack_bufs : (uv_buf_t*)malloc(count * sizeof(uv_buf_t));
+    if (!bufs) {
+        return UV_ENOMEM;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        size_t length;
+        const char *data = buffer_check_bytes(L, first + i, &length);
+        bufs[i] = uv_buf_init((char*)data, (unsigned int)length);
+        total += length;
+    }
+
+    // Most writes fit in the socket buffer and finish right here
+    int index = 0;
+    if (stream->write_queue_size == 0) {
+        int written = uv_try_write(stream, bufs, count);
+        if (written > 0) {
+            if ((size_t)written == total) {
+                if (bufs != stack_bufs) {
+                    free(bufs);
+                }
+                return 0;
+            }
+
+            size_t skip = (size_t)written;
+            while (skip >= bufs[index].len) {
+                skip -= bufs[index].len;
+                index++;
+            }
+            bufs[index].base += skip;
+            bufs[index].len -= skip;
+        }
+    }
+
+    TcpWrite *write = (TcpWrite*)malloc(sizeof(TcpWrite));
+    if (!write) {
+        if (bufs != stack_bufs) {
+            free(bufs);
+        }
+        return UV_ENOMEM;
+    }
+
+    lua_createtable(L, count, 0);
+    for (int i = 0; i < count; i++) {
+        lua_pushvalue(L, first + i);
+        lua_rawseti(L, -2, i + 1);
+    }
+    write->L = reflex_get_api(L)->L; // Tasks may be collected before the write ends
+    write->pin_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    write->req.data = write;
+
+    // uv_write copies the buffer descriptors, only the bytes must stay alive
+    int status = uv_write(&write->req, stream, bufs + index, (unsigned int)(count - index), tcp_write_done);
+    if (status < 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, write->pin_ref);
+        free(write);
+    }
+
+    if (bufs != stack_bufs) {
+        free(bufs);
+    }
+    return status;
+}
+
+static void socket_on_alloc(uv_handle_t *handle, size_t suggested, uv_buf_t *buf) {
+    (void)suggested;
+    TcpSocket *socket = (TcpSocket*)handle->data;
+    char *base;
+    size_t length;
+    buffer_pool_reserve(socket->pool, &base, &length);
+    *buf = uv_buf_init(base, (unsigned int)length);
+}
+
+static void socket_wake_reader(TcpSocket *socket) {
+    ReflexTask *task = socket->reader;
+    if (!task) {
+        return;
+    }
+    socket->reader = NULL;
+
+    lua_State *co = reflex_async_thread(task);
+    if (socket->count > 0) {
+        BufferChunk chunk = socket->queue[socket->head];
+        socket->head = (socket->head + 1) % TCP_QUEUE_SIZE;
+        socket->count--;
+        buffer_push(co, chunk);
+        reflex_async_resume(task, 1);
+    } else if (socket->error) {
+        reflex_async_reject(task, uv_strerror(socket->error));
+    } else {
+        lua_pushnil(co); // End of stream or closed socket
+        reflex_async_resume(task, 1);
+    }
+}
+
+static void socket_on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    TcpSocket *socket = (TcpSocket*)stream->data;
+
+    if (nread > 0) {
+        int tail = (socket->head + socket->count) % TCP_QUEUE_SIZE;
+        socket->queue[tail] = buffer_pool_commit(socket->pool, buf->base, (size_t)nread);
+        socket->count++;
+
+        // Stop pulling from the kernel until Lua catches up
+        if (socket->count == TCP_QUEUE_SIZE) {
+            uv_read_stop(stream);
+            socket->reading = 0;
+        }
+    } else if (nread < 0) {
+        if (nread == UV_EOF) {
+            socket->eof = 1;
+        } else {
+            socket->error = (int)nread;
+        }
+        uv_read_stop(stream);
+        socket->reading = 0;
+    } else {
+        return;
+    }
+
+    socket_wake_reader(socket);
+}
+
+static void socket_start_reading(TcpSocket *socket) {
+    if (socket->reading || socket->eof || socket->error || socket->closed) {
+        return;
+    }
+    if (uv_read_start((uv_stream_t*)&socket->handle, socket_on_alloc, socket_on_read) == 0) {
+        socket->reading = 1;
+    }
+}
+
+static void socket_on_close(uv_handle_t *handle) {
+    TcpSocket *socket = (TcpSocket*)handle->data;
+    while (socket->count > 0) {
+        buffer_chunk_release(&socket->queue[socket->head]);
+        socket->head = (socket->head + 1) % TCP_QUEUE_SIZE;
+        socket->count--;
+    }
+    luaL_unref(socket->L, LUA_REGISTRYINDEX, socket->self_ref);
+    socket->self_ref = LUA_NOREF;
+}
+
+// Pushes a new socket userdata whose handle is initialized on the loop
+static TcpSocket* socket_new(lua_State *L) {
+    TcpSocket *socket = (TcpSocket*)lua_newuserdatauv(L, sizeof(TcpSocket), 0);
+    memset(socket, 0, sizeof(TcpSocket));
+    luaL_setmetatable(L, TCP_SOCKET_METATABLE);
+
+    LuaAPI *api = reflex_get_api(L);
+    socket->L = api->L;
+    socket->pool = buffer_pool_get(L);
+    socket->base.close = socket_on_close;
+    uv_tcp_init(api->loop, &socket->handle);
+    socket->handle.data = socket;
+
+    lua_pushvalue(L, -1);
+    socket->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return socket;
+}
+
+static void socket_on_shutdown(uv_shutdown_t *req, int status) {
+    (void)status;
+    if (!uv_is_closing((uv_handle_t*)req->handle)) {
+        uv_close((uv_handle_t*)req->handle, socket_on_close);
+    }
+}
+
+// Queued writes are flushed before the handle goes away
+static void socket_close(TcpSocket *socket) {
+    if (socket->closed) {
+        return;
+    }
+    socket->closed = 1;
+    socket->reading = 0;
+    uv_read_stop((uv_stream_t*)&socket->handle);
+
+    if (socket->error || !uv_is_writable((uv_stream_t*)&socket->handle)
+        || uv_shutdown(&socket->shutdown, (uv_stream_t*)&socket->handle, socket_on_shutdown) != 0) {
+        uv_close((uv_handle_t*)&socket->handle, socket_on_close);
+    }
+    socket_wake_reader(socket);
+}
+
+static TcpSocket* socket_check(lua_State *L) {
+    return (TcpSocket*)luaL_checkudata(L, 1, TCP_SOCKET_METATABLE);
+}
+
+// socket:read(), returns the next Buffer or nil once the peer is done
+static int socket_read(lua_State *L) {
+    TcpSocket *socket = socket_check(L);
+
+    if (socket->count > 0) {
+        BufferChunk chunk = socket->queue[socket->head];
+        socket->head = (socket->head + 1) % TCP_QUEUE_SIZE;
+        socket->count--;
+        buffer_push(L, chunk);
+        socket_start_reading(socket);
+        return 1;
+    }
+    if (socket->error) {
+        return luaL_error(L, "%s", uv_strerror(socket->error));
+    }
+    if (socket->eof || socket->closed) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    ReflexTask *task = reflex_async_current(L);
+    if (!task) {
+        return luaL_error(L, "socket:read must be called from within reflex.async");
+    }
+    if (socket->reader) {
+        return luaL_error(L, "socket is already being read by another task");
+    }
+
+    socket->reader = task;
+    socket_start_reading(socket);
+    return reflex_async_await(L, task);
+}
+
+// socket:write(...), strings and buffers are sent in one batch
+static int socket_write(lua_State *L) {
+    TcpSocket *socket = socket_check(L);
+    if (socket->closed) {
+        return luaL_error(L, "socket is closed");
+    }
+
+    int status = tcp_write_values(L, (uv_stream_t*)&socket->handle, 2, lua_gettop(L));
+    if (status < 0) {
+        return luaL_error(L, "%s", uv_strerror(status));
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+}
+
+// socket:close()
+static int socket_close_lua(lua_State *L) {
+    socket_close(socket_check(L));
+    return 0;
+}
+
+// socket:setNoDelay(enable)
+static int socket_set_no_delay(lua_State *L) {
+    TcpSocket *socket = socket_check(L);
+    int enable = lua_isnone(L, 2) ? 1 : lua_toboolean(L, 2);
+    uv_tcp_nodelay(&socket->handle, enable);
+    return 0;
+}
+
+static void server_on_connection(uv_stream_t *stream, int status) {
+    TcpServer *server = (TcpServer*)stream->data;
+    if (status < 0) {
+        return;
+    }
+
+    lua_State *L = server->L;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, server->handler_ref);
+    TcpSocket *socket = socket_new(L);
+    if (uv_accept(stream, (uv_stream_t*)&socket->handle) != 0) {
+        socket_close(socket);
+        lua_pop(L, 2);
+        return;
+    }
+
+    // Every connection gets its own task so the handler can await reads
+    reflex_async_spawn(L, 1);
+}
+
+static TcpServer* server_check(lua_State *L) {
+    return (TcpServer*)luaL_checkudata(L, 1, TCP_SERVER_METATABLE);
+}
+
+// server:listen(port, host, backlog)
+static int server_listen(lua_State *L) {
+    TcpServer *server = server_check(L);
+    int port = (int)luaL_checkinteger(L, 2);
+    const char *host = luaL_optstring(L, 3, "0.0.0.0");
+    int backlog = (int)luaL_optinteger(L, 4, TCP_BACKLOG);
+
+    struct sockaddr_storage addr;
+    if (tcp_parse_address(host, port, &addr) != 0) {
+        return luaL_error(L, "Invalid address '%s'", host);
+    }
+
+    int status = uv_tcp_bind(&server->handle, (const struct sockaddr*)&addr, 0);
+    if (status == 0) {
+        status = uv_listen((uv_stream_t*)&server->handle, backlog, server_on_connection);
+    }
+    if (status < 0) {
+        return luaL_error(L, "Failed to listen on %s:%d: %s", host, port, uv_strerror(status));
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+}
+
+static void server_on_close(uv_handle_t *handle) {
+    TcpServer *server = (TcpServer*)handle->data;
+    luaL_unref(server->L, LUA_REGISTRYINDEX, server->handler_ref);
+    luaL_unref(server->L, LUA_REGISTRYINDEX, server->self_ref);
+}
+
+// server:close()
+static int server_close(lua_State *L) {
+    TcpServer *server = server_check(L);
+    if (!uv_is_closing((uv_handle_t*)&server->handle)) {
+        uv_close((uv_handle_t*)&server->handle, server_on_close);
+    }
+    return 0;
+}
+
+// reflex.tcp.createServer(handler)
+int tcp_create_server(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    LuaAPI *api = reflex_get_api(L);
+
+    TcpServer *server = (TcpServer*)lua_newuserdatauv(L, sizeof(TcpServer), 0);
+    memset(server, 0, sizeof(TcpServer));
+    luaL_setmetatable(L, TCP_SERVER_METATABLE);
+    server->L = api->L;
+    server->base.close = server_on_close;
+    uv_tcp_init(api->loop, &server->handle);
+    server->handle.data = server;
+
+    lua_pushvalue(L, 1);
+    server->handler_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, -1);
+    server->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+static void connect_on_done(uv_connect_t *req, int status) {
+    TcpConnect *connect = (TcpConnect*)req->data;
+    ReflexTask *task = connect->task;
+    TcpSocket *socket = connect->socket;
+    free(connect);
+
+    if (status < 0) {
+        socket_close(socket);
+        reflex_async_reject(task, uv_strerror(status));
+        return;
+    }
+
+    lua_State *co = reflex_async_thread(task);
+    lua_rawgeti(co, LUA_REGISTRYINDEX, socket->self_ref);
+    reflex_async_resume(task, 1);
+}
+
+// reflex.tcp.connect(host, port)
+int tcp_connect(lua_State *L) {
+    const char *host = luaL_checkstring(L, 1);
+    int port = (int)luaL_checkinteger(L, 2);
+
+    ReflexTask *task = reflex_async_current(L);
+    if (!task) {
+        return luaL_error(L, "reflex.tcp.connect must be called from within reflex.async");
+    }
+
+    struct sockaddr_storage addr;
+    if (tcp_parse_address(host, port, &addr) != 0) {
+        return luaL_error(L, "Invalid address '%s'", host);
+    }
+
+    TcpConnect *connect = (TcpConnect*)malloc(sizeof(TcpConnect));
+    if (!connect) {
+        return luaL_error(L, "Failed to allocate connect request");
+    }
+
+    lua_settop(L, 2);
+    connect->task = task;
+    connect->socket = socket_new(L);
+    connect->req.data = connect;
+
+    int status = uv_tcp_connect(&connect->req, &connect->socket->handle, (const struct sockaddr*)&addr, connect_on_done);
+    if (status < 0) {
+        socket_close(connect->socket);
+        free(connect);
+        return luaL_error(L, "Failed to connect to %s:%d: %s", host, port, uv_strerror(status));
+    }
+
+    return reflex_async_await(L, task);
+}
+
+void define_tcp_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    static const luaL_Reg socket_methods[] = {
+        {"read", socket_read},
+        {"write", socket_write},
+        {"close", socket_close_lua},
+        {"setNoDelay", socket_set_no_delay},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, TCP_SOCKET_METATABLE);
+    luaL_newlib(L, socket_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    static const luaL_Reg server_methods[] = {
+        {"listen", server_listen},
+        {"close", server_close},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, TCP_SERVER_METATABLE);
+    luaL_newlib(L, server_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    reflex_register_table_field(api, "reflex", "tcp", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.tcp", "createServer", REFLEX_TYPE_FUNCTION, tcp_create_server);
+    reflex_register_table_field(api, "reflex.tcp", "connect", REFLEX_TYPE_FUNCTION, tcp_connect);
+}
@@ -0,0 +1,312 @@
+#include "apis/timer_api.h"
+#include "lua_api.h"
+#include "loop.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hashed timer wheel with 1ms ticks. Every Lua timer lives in the slot
+// `deadline & WHEEL_MASK`, so inserting and cancelling are plain linked
+// list operations and the whole wheel is driven by a single uv_timer_t.
+#define WHEEL_SIZE   4096
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_WORDS  (WHEEL_SIZE / 64)
+#define DUE_LIST     WHEEL_SIZE          // Pseudo slot for timers about to fire
+#define TIMER_NIL    UINT32_MAX
+
+#define TIMER_REGISTRY_KEY "reflex.timer"
+
+typedef struct {
+    uint64_t deadline;   // Absolute tick the timer is due at
+    uint64_t interval;   // Repeat interval in ms, 0 for one-shot timers
+    uint32_t prev;
+    uint32_t next;       // Also links the free list
+    uint32_t slot;       // List the entry is linked in
+    uint32_t generation; // Bumped on release so stale ids are rejected
+    int ref;             // Registry reference to the callback
+    int active;
+} TimerEntry;
+
+typedef struct {
+    ReflexHandle base;
+    uv_timer_t handle;
+    lua_State *L;
+    TimerEntry *entries;
+    uint32_t capacity;
+    uint32_t free_head;
+    size_t count;
+    uint64_t current;    // Last tick that was processed
+    uint64_t armed_at;   // Tick the uv timer fires at, 0 when stopped
+    uint32_t heads[WHEEL_SIZE + 1];
+    uint64_t bitmap[WHEEL_WORDS];
+} TimerWheel;
+
+static void wheel_on_timer(uv_timer_t *handle);
+
+static TimerWheel* wheel_get(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, TIMER_REGISTRY_KEY);
+    TimerWheel *wheel = (TimerWheel*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return wheel;
+}
+
+static void wheel_link(TimerWheel *wheel, uint32_t index, uint32_t slot) {
+    TimerEntry *entry = &wheel->entries[index];
+    entry->slot = slot;
+    entry->prev = TIMER_NIL;
+    entry->next = wheel->heads[slot];
+    if (entry->next != TIMER_NIL) {
+        wheel->entries[entry->next].prev = index;
+    }
+    wheel->heads[slot] = index;
+
+    if (slot != DUE_LIST) {
+        wheel->bitmap[slot >> 6] |= (uint64_t)1 << (slot & 63);
+    }
+}
+
+static void wheel_unlink(TimerWheel *wheel, uint32_t index) {
+    TimerEntry *entry = &wheel->entries[index];
+    if (entry->prev != TIMER_NIL) {
+        wheel->entries[entry->prev].next = entry->next;
+    } else {
+        wheel->heads[entry->slot] = entry->next;
+    }
+    if (entry->next != TIMER_NIL) {
+        wheel->entries[entry->next].prev = entry->prev;
+    }
+
+    if (entry->slot != DUE_LIST && wheel->heads[entry->slot] == TIMER_NIL) {
+        wheel->bitmap[entry->slot >> 6] &= ~((uint64_t)1 << (entry->slot & 63));
+    }
+}
+
+static uint32_t wheel_alloc(TimerWheel *wheel) {
+    if (wheel->free_head == TIMER_NIL) {
+        uint32_t capacity = wheel->capacity ? wheel->capacity * 2 : 64;
+        TimerEntry *entries = (TimerEntry*)realloc(wheel->entries, capacity * sizeof(TimerEntry));
+        if (!entries) {
+            return TIMER_NIL;
+        }
+
+        for (uint32_t i = wheel->capacity; i < capacity; i++) {
+            entries[i].next = i + 1 < capacity ? i + 1 : TIMER_NIL;
+            entries[i].generation = 1;
+            entries[i].active = 0;
+        }
+
+        wheel->entries = entries;
+        wheel->free_head = wheel->capacity;
+        wheel->capacity = capacity;
+    }
+
+    uint32_t index = wheel->free_head;
+    wheel->free_head = wheel->entries[index].next;
+    return index;
+}
+
+static void wheel_release(TimerWheel *wheel, uint32_t index) {
+    TimerEntry *entry = &wheel->entries[index];
+    luaL_unref(wheel->L, LUA_REGISTRYINDEX, entry->ref);
+    entry->ref = LUA_NOREF;
+    entry->active = 0;
+    entry->generation++;
+    entry->next = wheel->free_head;
+    wheel->free_head = index;
+    wheel->count--;
+}
+
+// Arms the uv timer for the first occupied slot after the current tick
+static void wheel_rearm(TimerWheel *wheel) {
+    if (wheel->count == 0) {
+        uv_timer_stop(&wheel->handle);
+        wheel->armed_at = 0;
+        return;
+    }
+
+    uint32_t start = (uint32_t)((wheel->current + 1) & WHEEL_MASK);
+    uint32_t distance = WHEEL_SIZE;
+
+    for (uint32_t step = 0; step <= WHEEL_WORDS; step++) {
+        uint32_t word = ((start >> 6) + step) % WHEEL_WORDS;
+        uint64_t bits = wheel->bitmap[word];
+        if (step == 0) {
+            bits &= ~(uint64_t)0 << (start & 63);
+        } else if (step == WHEEL_WORDS) {
+            bits &= ((uint64_t)1 << (start & 63)) - 1;
+        }
+        if (bits) {
+            uint32_t slot = (word << 6) | (uint32_t)__builtin_ctzll(bits);
+            distance = ((slot - start) & WHEEL_MASK) + 1;
+            break;
+        }
+    }
+
+    uint64_t wake = wheel->current + distance;
+    uint64_t now = uv_now(wheel->handle.loop);
+    wheel->armed_at = wake;
+    uv_timer_start(&wheel->handle, wheel_on_timer, wake > now ? wake - now : 0, 0);
+}
+
+// Moves every due timer of a slot into the due list
+static void wheel_collect(TimerWheel *wheel, uint32_t slot, uint64_t now) {
+    uint32_t index = wheel->heads[slot];
+    while (index != TIMER_NIL) {
+        uint32_t next = wheel->entries[index].next;
+        if (wheel->entries[index].deadline <= now) {
+            wheel_unlink(wheel, index);
+            wheel_link(wheel, index, DUE_LIST);
+        }
+        index = next;
+    }
+}
+
+static void wheel_on_timer(uv_timer_t *handle) {
+    TimerWheel *wheel = (TimerWheel*)handle->data;
+    lua_State *L = wheel->L;
+    uint64_t now = uv_now(handle->loop);
+    wheel->armed_at = 0;
+
+    if (now - wheel->current >= WHEEL_SIZE) {
+        for (uint32_t word = 0; word < WHEEL_WORDS; word++) {
+            uint64_t bits = wheel->bitmap[word];
+            while (bits) {
+                uint32_t slot = (word << 6) | (uint32_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+                wheel_collect(wheel, slot, now);
+            }
+        }
+    } else {
+        for (uint64_t tick = wheel->current + 1; tick <= now; tick++) {
+            uint32_t slot = (uint32_t)(tick & WHEEL_MASK);
+            if (wheel->heads[slot] != TIMER_NIL) {
+                wheel_collect(wheel, slot, now);
+            }
+        }
+    }
+    wheel->current = now;
+
+    // Callbacks may add or clear timers, including the ones still waiting
+    // in the due list, so always pop from the head
+    while (wheel->heads[DUE_LIST] != TIMER_NIL) {
+        uint32_t index = wheel->heads[DUE_LIST];
+        TimerEntry *entry = &wheel->entries[index];
+        wheel_unlink(wheel, index);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, entry->ref);
+        if (entry->interval > 0) {
+            entry->deadline = now + entry->interval;
+            wheel_link(wheel, index, (uint32_t)(entry->deadline & WHEEL_MASK));
+        } else {
+            wheel_release(wheel, index);
+        }
+
+        reflex_loop_call(L, 0, 0);
+
+        if (reflex_get_api(L)->loop_error) {
+            return;
+        }
+    }
+
+    wheel_rearm(wheel);
+}
+
+static int wheel_add(lua_State *L, int repeat) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_Integer delay = luaL_optinteger(L, 2, 0);
+    if (delay < 1) {
+        delay = 1;
+    }
+
+    TimerWheel *wheel = wheel_get(L);
+    uint32_t index = wheel_alloc(wheel);
+    if (index == TIMER_NIL) {
+        return luaL_error(L, "Failed to allocate timer");
+    }
+
+    TimerEntry *entry = &wheel->entries[index];
+    lua_pushvalue(L, 1);
+    entry->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    entry->interval = repeat ? (uint64_t)delay : 0;
+    entry->deadline = uv_now(wheel->handle.loop) + (uint64_t)delay;
+    entry->active = 1;
+    wheel_link(wheel, index, (uint32_t)(entry->deadline & WHEEL_MASK));
+    wheel->count++;
+
+    if (wheel->armed_at == 0 || entry->deadline < wheel->armed_at) {
+        uint64_t now = uv_now(wheel->handle.loop);
+        wheel->armed_at = entry->deadline;
+        uv_timer_start(&wheel->handle, wheel_on_timer, entry->deadline - now, 0);
+    }
+
+    lua_pushinteger(L, ((lua_Integer)entry->generation << 32) | index);
+    return 1;
+}
+
+// reflex.timer.setTimeout(fn, ms)
+int timer_set_timeout(lua_State *L) {
+    return wheel_add(L, 0);
+}
+
+// reflex.timer.setInterval(fn, ms)
+int timer_set_interval(lua_State *L) {
+    return wheel_add(L, 1);
+}
+
+// reflex.timer.clearTimer(id)
+int timer_clear(lua_State *L) {
+    lua_Integer id = luaL_checkinteger(L, 1);
+    uint32_t index = (uint32_t)(id & 0xFFFFFFFF);
+    uint32_t generation = (uint32_t)((lua_Unsigned)id >> 32);
+
+    TimerWheel *wheel = wheel_get(L);
+    if (index >= wheel->capacity) {
+        return lua_return(L, REFLEX_TYPE_BOOLEAN, 0);
+    }
+
+    TimerEntry *entry = &wheel->entries[index];
+    if (!entry->active || entry->generation != generation) {
+        return lua_return(L, REFLEX_TYPE_BOOLEAN, 0);
+    }
+
+    wheel_unlink(wheel, index);
+    wheel_release(wheel, index);
+
+    if (wheel->count == 0) {
+        uv_timer_stop(&wheel->handle);
+        wheel->armed_at = 0;
+    }
+
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, 1);
+}
+
+static int wheel_gc(lua_State *L) {
+    TimerWheel *wheel = (TimerWheel*)lua_touserdata(L, 1);
+    free(wheel->entries);
+    wheel->entries = NULL;
+    return 0;
+}
+
+void define_timer_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    TimerWheel *wheel = (TimerWheel*)lua_newuserdatauv(L, sizeof(TimerWheel), 0);
+    memset(wheel, 0, sizeof(TimerWheel));
+    memset(wheel->heads, 0xFF, sizeof(wheel->heads));
+    wheel->L = api->L;
+    wheel->free_head = TIMER_NIL;
+    uv_timer_init(api->loop, &wheel->handle);
+    wheel->handle.data = wheel;
+    wheel->current = uv_now(api->loop);
+
+    lua_newtable(L);
+    lua_pushcfunction(L, wheel_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, TIMER_REGISTRY_KEY);
+
+    reflex_register_table_field(api, "reflex", "timer", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.timer", "setTimeout", REFLEX_TYPE_FUNCTION, timer_set_timeout);
+    reflex_register_table_field(api, "reflex.timer", "setInterval", REFLEX_TYPE_FUNCTION, timer_set_interval);
+    reflex_register_table_field(api, "reflex.timer", "clearTimer", REFLEX_TYPE_FUNCTION, timer_clear);
+}
@@ -0,0 +1,260 @@
+#include "apis/worker_api.h"
+#include "apis/async_api.h"
+#include "error/LuaError.h"
+#include "reflex_api.h"
+#include "serialize.h"
+#include "apis/channel_api.h"
+#include "loop.h"
+#include "file_loader.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKER_CHANNEL_CAPACITY 4096
+
+// One end of the connection between two states: messages arrive through
+// the receiver and are sent on `out`
+typedef struct {
+    ChannelReceiver *receiver;
+    ChannelReceiver *exited;  // Parent only, closed once the worker thread ends
+    ReflexChannel *out;
+    lua_State *L;
+    int self_ref;          // Keeps a running worker's port alive
+    int has_thread;
+    uv_thread_t thread;
+} WorkerPort;
+
+typedef struct {
+    char *script;
+    SerialBuffer args;
+    ReflexChannel *in;     // Parent to worker
+    ReflexChannel *out;    // Worker to parent
+    ReflexChannel *done;   // Never sent on, the worker closes it once its state is freed
+} WorkerStart;
+
+// Either side can close `in` and `out` while the worker runs, only `done`
+// tells that the thread is about to return
+static void port_on_worker_done(ChannelReceiver *receiver, void *data) {
+    (void)receiver;
+    WorkerPort *port = (WorkerPort*)data;
+    if (port->has_thread) {
+        uv_thread_join(&port->thread);
+        port->has_thread = 0;
+    }
+    luaL_unref(port->L, LUA_REGISTRYINDEX, port->self_ref);
+    port->self_ref = LUA_NOREF;
+}
+
+// Pushes a port receiving from `in` on the state's loop. The parent's port
+// of a worker keeps the loop open until `done` is closed.
+static WorkerPort* port_new(lua_State *L, ReflexChannel *in, ReflexChannel *out, ReflexChannel *done) {
+    WorkerPort *port = (WorkerPort*)lua_newuserdatauv(L, sizeof(WorkerPort), 0);
+    memset(port, 0, sizeof(WorkerPort));
+    luaL_setmetatable(L, WORKER_PORT_METATABLE);
+
+    port->L = reflex_get_api(L)->L;
+    port->out = out;
+    port->self_ref = LUA_NOREF;
+    reflex_channel_retain(out);
+
+    port->receiver = channel_receiver_new(L, in, 0, NULL, NULL);
+    if (done) {
+        port->exited = channel_receiver_new(L, done, 1, port_on_worker_done, port);
+    }
+    if (!port->receiver || (done && !port->exited)) {
+        luaL_error(L, "Failed to create worker port");
+        return NULL;
+    }
+    if (done) {
+        lua_pushvalue(L, -1);
+        port->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return port;
+}
+
+static WorkerPort* port_check(lua_State *L) {
+    return (WorkerPort*)luaL_checkudata(L, 1, WORKER_PORT_METATABLE);
+}
+
+// port:send(...), returns false once the other side stopped receiving.
+// At least one value, none is what receive returns once the other side is done.
+static int port_send(lua_State *L) {
+    WorkerPort *port = port_check(L);
+    luaL_argcheck(L, lua_gettop(L) >= 2, 2, "expected a value to send");
+
+    SerialBuffer buffer;
+    serial_buffer_init(&buffer);
+    if (reflex_serialize(L, 2, lua_gettop(L), &buffer) != 0) {
+        lua_pushstring(L, buffer.error);
+        serial_release_channels(buffer.data, buffer.length);
+        serial_buffer_free(&buffer);
+        return lua_error(L);
+    }
+
+    // A queued message takes over the channel references, else they are dropped here
+    int status = reflex_channel_send(port->out, buffer.data, buffer.length);
+    if (status != 0) {
+        serial_release_channels(buffer.data, buffer.length);
+    }
+    serial_buffer_free(&buffer);
+    if (status == UV_ENOMEM) {
+        return luaL_error(L, "Failed to allocate message");
+    }
+    return lua_return(L, REFLEX_TYPE_BOOLEAN, status == 0);
+}
+
+// port:receive(), returns the values of the next message or nil once the
+// other side is done
+static int port_receive(lua_State *L) {
+    WorkerPort *port = port_check(L);
+    return channel_receiver_receive(L, port->receiver);
+}
+
+// port:close(), the other side receives nil after the queued messages
+static int port_close(lua_State *L) {
+    WorkerPort *port = port_check(L);
+    reflex_channel_close(port->out);
+    return 0;
+}
+
+static int port_gc(lua_State *L) {
+    WorkerPort *port = port_check(L);
+    if (port->receiver) {
+        channel_receiver_free(port->receiver);
+        port->receiver = NULL;
+    }
+    if (port->exited) {
+        channel_receiver_free(port->exited);
+        port->exited = NULL;
+    }
+
+    // A worker that is still running sees its input close and is left to
+    // finish on its own
+    reflex_channel_close(port->out);
+    reflex_channel_release(port->out);
+    return 0;
+}
+
+static void worker_run(LuaAPI *api, WorkerStart *start) {
+    lua_State *L = api->L;
+
+    lua_getglobal(L, "reflex");
+    lua_getfield(L, -1, "worker");
+    port_new(L, start->in, start->out, NULL);
+    lua_setfield(L, -2, "parent");
+    lua_pop(L, 2);
+
+    lua_pushcfunction(L, lua_error_handler);
+    int error_handler_idx = lua_gettop(L);
+
+    if (reflex_load_file(L, start->script, start->script, NULL) != LUA_OK) {
+        lua_error_handler(L);
+        return;
+    }
+
+    int nargs = reflex_deserialize(L, start->args.data, start->args.length);
+    if (nargs < 0) {
+        return;
+    }
+
+    int status = lua_pcall(L, nargs, 0, error_handler_idx);
+    if (status == LUA_OK) {
+        reflex_loop_run(api);
+    } else if (status == LUA_ERRMEM) {
+        reflex_memory_error(L);
+        lua_error_handler(L);
+        reflex_memory_restore(L);
+    }
+}
+
+static void worker_start_free(WorkerStart *start) {
+    if (start->in) reflex_channel_release(start->in);
+    if (start->out) reflex_channel_release(start->out);
+    if (start->done) reflex_channel_release(start->done);
+    serial_release_channels(start->args.data, start->args.length);
+    serial_buffer_free(&start->args);
+    free(start->script);
+    free(start);
+}
+
+static void worker_main(void *arg) {
+    WorkerStart *start = (WorkerStart*)arg;
+
+    LuaAPI *api = reflex_new();
+    if (api) {
+        define_reflex_builtin(api);
+        worker_run(api, start);
+        reflex_free(api);
+    }
+
+    reflex_channel_close(start->in);
+    reflex_channel_close(start->out);
+
+    // Tells the parent it can join this thread
+    reflex_channel_close(start->done);
+    worker_start_free(start);
+}
+
+// reflex.worker.spawn(script, ...), runs the script on a new thread with
+// its own state and loop. The extra arguments are passed to the script.
+int worker_spawn(lua_State *L) {
+    const char *script = luaL_checkstring(L, 1);
+
+    WorkerStart *start = (WorkerStart*)calloc(1, sizeof(WorkerStart));
+    if (!start) {
+        return luaL_error(L, "Failed to allocate worker");
+    }
+    serial_buffer_init(&start->args);
+
+    // The worker loads the script itself, failing here keeps the error with the caller
+    uv_fs_t req;
+    int stat_status = uv_fs_stat(NULL, &req, script, NULL);
+    uv_fs_req_cleanup(&req);
+    if (stat_status != 0) {
+        worker_start_free(start);
+        return luaL_error(L, "Failed to read worker script '%s'", script);
+    }
+
+    if (reflex_serialize(L, 2, lua_gettop(L), &start->args) != 0) {
+        lua_pushstring(L, start->args.error);
+        worker_start_free(start);
+        return lua_error(L);
+    }
+
+    start->script = strdup(script);
+    start->in = reflex_channel_new(WORKER_CHANNEL_CAPACITY);
+    start->out = reflex_channel_new(WORKER_CHANNEL_CAPACITY);
+    start->done = reflex_channel_new(1);
+    if (!start->script || !start->in || !start->out || !start->done) {
+        worker_start_free(start);
+        return luaL_error(L, "Failed to allocate worker");
+    }
+
+    WorkerPort *port = port_new(L, start->out, start->in, start->done);
+    if (uv_thread_create(&port->thread, worker_main, start) != 0) {
+        reflex_channel_close(start->done); // Lets the port finish like a worker that ended
+        worker_start_free(start);
+        return luaL_error(L, "Failed to start worker thread");
+    }
+    port->has_thread = 1;
+    return 1;
+}
+
+void define_worker_api(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    static const luaL_Reg port_methods[] = {
+        {"send", port_send},
+        {"receive", port_receive},
+        {"close", port_close},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, WORKER_PORT_METATABLE);
+    luaL_newlib(L, port_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, port_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    reflex_register_table_field(api, "reflex", "worker", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.worker", "spawn", REFLEX_TYPE_FUNCTION, worker_spawn);
+}
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE // memmem
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_POOL_KEY     "reflex.buffer.pool"
+#define BLOCK_SIZE          (64 * 1024)
+#define BLOCK_MIN_TAIL      (4 * 1024)   // Smaller tails start a new block
+#define POOL_MAX_FREE       64           // Idle blocks kept for reuse
+
+struct BufferBlock {
+    BufferPool *pool;
+    BufferBlock *next;   // Free list link
+    size_t refs;
+    char data[];
+};
+
+struct BufferPool {
+    BufferBlock *current;
+    size_t offset;       // First unused byte of the current block
+    BufferBlock *free_list;
+    size_t free_count;
+    size_t live_blocks;  // Allocated blocks, the pool outlives all of them
+    int closed;          // The state is gone, blocks are freed on release
+};
+
+static BufferBlock* block_new(BufferPool *pool) {
+    BufferBlock *block = pool->free_list;
+    if (block) {
+        pool->free_list = block->next;
+        pool->free_count--;
+    } else {
+        block = (BufferBlock*)malloc(sizeof(BufferBlock) + BLOCK_SIZE);
+        if (!block) {
+            return NULL;
+        }
+        block->pool = pool;
+        pool->live_blocks++;
+    }
+
+    block->next = NULL;
+    block->refs = 0;
+    return block;
+}
+
+static void block_unref(BufferBlock *block) {
+    if (--block->refs > 0) {
+        return;
+    }
+
+    BufferPool *pool = block->pool;
+    if (!pool->closed && pool->free_count < POOL_MAX_FREE) {
+        block->next = pool->free_list;
+        pool->free_list = block;
+        pool->free_count++;
+        return;
+    }
+
+    free(block);
+    pool->live_blocks--;
+    if (pool->closed && pool->live_blocks == 0) {
+        free(pool);
+    }
+}
+
+void buffer_pool_reserve(BufferPool *pool, char **base, size_t *length) {
+    if (!pool->current || BLOCK_SIZE - pool->offset < BLOCK_MIN_TAIL) {
+        if (pool->current) {
+            block_unref(pool->current);
+        }
+
+        pool->current = block_new(pool);
+        pool->offset = 0;
+        if (!pool->current) {
+            *base = NULL;
+            *length = 0;
+            return;
+        }
+        pool->current->refs = 1; // Held while it is the current block
+    }
+
+    *base = pool->current->data + pool->offset;
+    *length = BLOCK_SIZE - pool->offset;
+}
+
+BufferChunk buffer_pool_commit(BufferPool *pool, const char *data, size_t length) {
+    BufferChunk chunk = { pool->current, data, length };
+    pool->current->refs++;
+    pool->offset = (size_t)(data - pool->current->data) + length;
+    return chunk;
+}
+
+void buffer_chunk_release(BufferChunk *chunk) {
+    if (chunk->block) {
+        block_unref(chunk->block);
+    }
+    chunk->block = NULL;
+    chunk->data = NULL;
+    chunk->length = 0;
+}
+
+BufferChunk* buffer_test(lua_State *L, int index) {
+    return (BufferChunk*)luaL_testudata(L, index, BUFFER_METATABLE);
+}
+
+BufferChunk* buffer_check(lua_State *L, int index) {
+    return (BufferChunk*)luaL_checkudata(L, index, BUFFER_METATABLE);
+}
+
+const char* buffer_check_bytes(lua_State *L, int index, size_t *length) {
+    if (lua_type(L, index) == LUA_TSTRING) {
+        return lua_tolstring(L, index, length);
+    }
+
+    BufferChunk *chunk = buffer_test(L, index);
+    if (!chunk) {
+        luaL_typeerror(L, index, "string or buffer");
+        return NULL;
+    }
+    *length = chunk->length;
+    return chunk->data;
+}
+
+// Translates string.sub style indices into a [start, end) byte range
+static void buffer_range(lua_State *L, BufferChunk *chunk, int first, int last, size_t *start, size_t *end) {
+    lua_Integer length = (lua_Integer)chunk->length;
+    lua_Integer i = luaL_optinteger(L, first, 1);
+    lua_Integer j = luaL_optinteger(L, last, -1);
+
+    if (i < 0) i = i < -length ? 1 : length + i + 1;
+    else if (i == 0) i = 1;
+    if (j < 0) j = length + j + 1;
+    else if (j > length) j = length;
+
+    if (i > j) {
+        *start = *end = 0;
+    } else {
+        *start = (size_t)(i - 1);
+        *end = (size_t)j;
+    }
+}
+
+// buffer:tostring(i, j) / buffer:sub(i, j)
+static int buffer_tostring(lua_State *L) {
+    BufferChunk *chunk = buffer_check(L, 1);
+    size_t start, end;
+    buffer_range(L, chunk, 2, 3, &start, &end);
+    lua_pushlstring(L, chunk->data + start, end - start);
+    return 1;
+}
+
+static int buffer_len(lua_State *L) {
+    BufferChunk *chunk = buffer_check(L, 1);
+    lua_pushinteger(L, (lua_Integer)chunk->length);
+    return 1;
+}
+
+// buffer:byte(i)
+static int buffer_byte(lua_State *L) {
+    BufferChunk *chunk = buffer_check(L, 1);
+    lua_Integer i = luaL_optinteger(L, 2, 1);
+    if (i < 0) {
+        i += (lua_Integer)chunk->length + 1;
+    }
+    if (i < 1 || i > (lua_Integer)chunk->length) {
+        return 0;
+    }
+    lua_pushinteger(L, (unsigned char)chunk->data[i - 1]);
+    return 1;
+}
+
+// buffer:find(text, init), plain search without patterns
+static int buffer_find(lua_State *L) {
+    BufferChunk *chunk = buffer_check(L, 1);
+    size_t needle_length;
+    const char *needle = luaL_checklstring(L, 2, &needle_length);
+    lua_Integer init = luaL_optinteger(L, 3, 1);
+    if (init < 1) {
+        init = 1;
+    }
+
+    size_t from = (size_t)(init - 1);
+    if (from > chunk->length || needle_length > chunk->length - from) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    const char *found = needle_length == 0 ? chunk->data + from
+        : (const char*)memmem(chunk->data + from, chunk->length - from, needle, needle_length);
+    if (!found) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_Integer position = (lua_Integer)(found - chunk->data) + 1;
+    lua_pushinteger(L, position);
+    lua_pushinteger(L, position + (lua_Integer)needle_length - 1);
+    return 2;
+}
+
+// buffer:release(), hands the memory back before the buffer is collected
+static int buffer_release(lua_State *L) {
+    buffer_chunk_release(buffer_check(L, 1));
+    return 0;
+}
+
+static int pool_gc(lua_State *L) {
+    BufferPool *pool = *(BufferPool**)lua_touserdata(L, 1);
+    pool->closed = 1;
+
+    while (pool->free_list) {
+        BufferBlock *block = pool->free_list;
+        pool->free_list = block->next;
+        free(block);
+        pool->live_blocks--;
+    }
+
+    if (pool->current) {
+        BufferBlock *block = pool->current;
+        pool->current = NULL;
+        if (--block->refs == 0) {
+            free(block);
+            pool->live_blocks--;
+        }
+    }
+
+    // Buffers still alive free the pool with their last block
+    if (pool->live_blocks == 0) {
+        free(pool);
+    }
+    return 0;
+}
+
+BufferPool* buffer_pool_get(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, BUFFER_POOL_KEY);
+    if (lua_touserdata(L, -1)) {
+        BufferPool *pool = *(BufferPool**)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        return pool;
+    }
+    lua_pop(L, 1);
+
+    BufferPool *pool = (BufferPool*)calloc(1, sizeof(BufferPool));
+    if (!pool) {
+        luaL_error(L, "Failed to allocate buffer pool");
+        return NULL;
+    }
+
+    BufferPool **anchor = (BufferPool**)lua_newuserdatauv(L, sizeof(BufferPool*), 0);
+    *anchor = pool;
+    lua_newtable(L);
+    lua_pushcfunction(L, pool_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, BUFFER_POOL_KEY);
+
+    if (luaL_newmetatable(L, BUFFER_METATABLE)) {
+        static const luaL_Reg methods[] = {
+            {"tostring", buffer_tostring},
+            {"sub", buffer_tostring},
+            {"byte", buffer_byte},
+            {"find", buffer_find},
+            {"release", buffer_release},
+            {"len", buffer_len},
+            {NULL, NULL}
+        };
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, buffer_len);
+        lua_setfield(L, -2, "__len");
+        lua_pushcfunction(L, buffer_tostring);
+        lua_setfield(L, -2, "__tostring");
+        lua_pushcfunction(L, buffer_release);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+
+    return pool;
+}
+
+void buffer_push(lua_State *L, BufferChunk chunk) {
+    BufferChunk *buffer = (BufferChunk*)lua_newuserdatauv(L, sizeof(BufferChunk), 0);
+    *buffer = chunk;
+    luaL_setmetatable(L, BUFFER_METATABLE);
+}
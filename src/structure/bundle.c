@@ -0,0 +1,425 @@
+#include "bundle.h"
+#include "require.h"
+#include "serialize.h"
+#include "file_loader.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define BUNDLE_MAGIC "RFXBNDL1"
+
+// Layout after the executable: the chunks, the index sorted by name, then
+// this trailer as the very last bytes of the file
+typedef struct {
+    uint64_t index_offset;   // From the start of the bundle
+    uint64_t count;
+    uint64_t size;           // Chunks, index and trailer
+    char magic[8];
+} BundleTrailer;
+
+// Index entry, followed by the name
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t name_length;
+    uint32_t reserved;
+} BundleEntryHeader;
+
+typedef struct {
+    const char *name;
+    size_t name_length;
+    const char *data;
+    size_t size;
+} BundleEntry;
+
+struct ReflexBundle {
+    const char *base;        // Start of the bundle in the mapped executable
+    size_t offset;           // Where the bundle starts in the file
+    BundleEntry *entries;
+    size_t count;
+};
+
+static ReflexBundle *current_bundle = NULL;
+static uv_once_t bundle_once = UV_ONCE_INIT;
+
+static int bundle_parse(ReflexBundle *bundle, const char *file, size_t file_size) {
+    BundleTrailer trailer;
+    if (file_size < sizeof(trailer)) {
+        return -1;
+    }
+    memcpy(&trailer, file + file_size - sizeof(trailer), sizeof(trailer));
+    if (memcmp(trailer.magic, BUNDLE_MAGIC, 8) != 0 || trailer.size > file_size ||
+        trailer.index_offset > trailer.size - sizeof(trailer)) {
+        return -1;
+    }
+
+    bundle->offset = file_size - trailer.size;
+    bundle->base = file + bundle->offset;
+    bundle->entries = (BundleEntry*)calloc(trailer.count ? trailer.count : 1, sizeof(BundleEntry));
+    if (!bundle->entries) {
+        return -1;
+    }
+
+    size_t index_end = trailer.size - sizeof(trailer);
+    size_t position = trailer.index_offset;
+    for (uint64_t i = 0; i < trailer.count; i++) {
+        BundleEntryHeader header;
+        if (index_end - position < sizeof(header)) {
+            return -1;
+        }
+        memcpy(&header, bundle->base + position, sizeof(header));
+        position += sizeof(header);
+        if (index_end - position < header.name_length || header.offset > trailer.index_offset ||
+            header.size > trailer.index_offset - header.offset) {
+            return -1;
+        }
+
+        BundleEntry *entry = &bundle->entries[bundle->count++];
+        entry->name = bundle->base + position;
+        entry->name_length = header.name_length;
+        entry->data = bundle->base + header.offset;
+        entry->size = (size_t)header.size;
+        position += header.name_length;
+    }
+    return 0;
+}
+
+// The executable stays mapped for the life of the process, only the pages
+// of the chunks that are loaded are ever read
+static void bundle_open_once(void) {
+    char path[4096];
+    size_t length = sizeof(path);
+    if (uv_exepath(path, &length) != 0) {
+        return;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    BundleTrailer trailer;
+    if (file_size < (off_t)sizeof(trailer) ||
+        pread(fd, &trailer, sizeof(trailer), file_size - (off_t)sizeof(trailer)) != (ssize_t)sizeof(trailer) ||
+        memcmp(trailer.magic, BUNDLE_MAGIC, 8) != 0) {
+        close(fd);
+        return;
+    }
+
+    void *file = mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return;
+    }
+
+    ReflexBundle *bundle = (ReflexBundle*)calloc(1, sizeof(ReflexBundle));
+    if (!bundle || bundle_parse(bundle, (const char*)file, (size_t)file_size) != 0) {
+        if (bundle) {
+            free(bundle->entries);
+        }
+        free(bundle);
+        munmap(file, (size_t)file_size);
+        return;
+    }
+    current_bundle = bundle;
+}
+
+const ReflexBundle* reflex_bundle_open(void) {
+    uv_once(&bundle_once, bundle_open_once);
+    return current_bundle;
+}
+
+const ReflexBundle* reflex_bundle_current(void) {
+    return current_bundle;
+}
+
+static const BundleEntry* bundle_find(const ReflexBundle *bundle, const char *name) {
+    size_t length = strlen(name);
+    size_t low = 0, high = bundle->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const BundleEntry *entry = &bundle->entries[middle];
+        size_t common = entry->name_length < length ? entry->name_length : length;
+        int order = memcmp(entry->name, name, common);
+        if (order == 0) {
+            order = entry->name_length < length ? -1 : entry->name_length > length;
+        }
+        if (order == 0) {
+            return entry;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+int reflex_bundle_load(lua_State *L, const ReflexBundle *bundle, const char *name) {
+    const BundleEntry *entry = bundle ? bundle_find(bundle, name) : NULL;
+    if (!entry) {
+        lua_pushfstring(L, "no bundled module '%s'", name);
+        return LUA_ERRFILE;
+    }
+    // The chunk keeps the source name it was compiled with
+    return luaL_loadbufferx(L, entry->data, entry->size, name, "b");
+}
+
+static int bundle_searcher(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    int status = reflex_bundle_load(L, current_bundle, name);
+    if (status == LUA_ERRFILE) {
+        lua_pushfstring(L, "\n\t%s", lua_tostring(L, -1));
+        return 1;
+    }
+    if (status != LUA_OK) {
+        return luaL_error(L, "error loading bundled module '%s':\n\t%s", name, lua_tostring(L, -1));
+    }
+    lua_pushliteral(L, ":bundle:");
+    return 2;
+}
+
+void reflex_bundle_install_searcher(lua_State *L, int searchers) {
+    if (!current_bundle) {
+        return;
+    }
+    int n = (int)lua_rawlen(L, searchers);
+    for (int i = n; i >= 2; i--) {
+        lua_rawgeti(L, searchers, i);
+        lua_rawseti(L, searchers, i + 1);
+    }
+    lua_pushcfunction(L, bundle_searcher);
+    lua_rawseti(L, searchers, 2);
+}
+
+typedef struct {
+    char *name;
+    SerialBuffer chunk;
+} BuildEntry;
+
+typedef struct {
+    lua_State *L;
+    BuildEntry *entries;
+    size_t count;
+    size_t capacity;
+    char **pending;          // Required names, some of them not in reflex_deps
+    size_t pending_count;
+    size_t pending_capacity;
+} BuildState;
+
+static int build_writer(lua_State *L, const void *data, size_t length, void *buffer) {
+    (void)L;
+    return serial_buffer_append((SerialBuffer*)buffer, data, length);
+}
+
+static void build_on_require(const char *name, size_t length, void *data) {
+    BuildState *build = (BuildState*)data;
+    for (size_t i = 0; i < build->pending_count; i++) {
+        if (strlen(build->pending[i]) == length && memcmp(build->pending[i], name, length) == 0) {
+            return;
+        }
+    }
+    if (build->pending_count == build->pending_capacity) {
+        size_t capacity = build->pending_capacity ? build->pending_capacity * 2 : 16;
+        char **grown = (char**)realloc(build->pending, capacity * sizeof(char*));
+        if (!grown) {
+            return;
+        }
+        build->pending = grown;
+        build->pending_capacity = capacity;
+    }
+    char *copy = (char*)malloc(length + 1);
+    if (copy) {
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+        build->pending[build->pending_count++] = copy;
+    }
+}
+
+// Compiles the file into a new entry and queues what it requires
+static int build_add(BuildState *build, const char *name, const char *path, const char *chunkname,
+    char *error, size_t size) {
+    ReflexFileMap source;
+    if (reflex_file_map(path, &source) != 0) {
+        snprintf(error, size, "Failed to read %s", path);
+        return -1;
+    }
+
+    if (reflex_load_mapped(build->L, source.data ? source.data : "", source.length, chunkname, NULL) != LUA_OK) {
+        snprintf(error, size, "%s", lua_tostring(build->L, -1));
+        lua_pop(build->L, 1);
+        reflex_file_unmap(&source);
+        return -1;
+    }
+
+    if (build->count == build->capacity) {
+        size_t capacity = build->capacity ? build->capacity * 2 : 16;
+        BuildEntry *grown = (BuildEntry*)realloc(build->entries, capacity * sizeof(BuildEntry));
+        if (!grown) {
+            lua_pop(build->L, 1);
+            reflex_file_unmap(&source);
+            snprintf(error, size, "Out of memory");
+            return -1;
+        }
+        build->entries = grown;
+        build->capacity = capacity;
+    }
+    BuildEntry *entry = &build->entries[build->count++];
+    entry->name = strdup(name);
+    serial_buffer_init(&entry->chunk);
+    int status = lua_dump(build->L, build_writer, &entry->chunk, 0);
+    lua_pop(build->L, 1);
+
+    if (source.data) {
+        reflex_scan_requires(source.data, source.length, build_on_require, build);
+    }
+    reflex_file_unmap(&source);
+    if (!entry->name || status != 0) {
+        snprintf(error, size, "Failed to compile %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int build_entry_compare(const void *a, const void *b) {
+    return strcmp(((const BuildEntry*)a)->name, ((const BuildEntry*)b)->name);
+}
+
+static int build_copy(FILE *out, FILE *in, size_t length) {
+    char buffer[65536];
+    while (length > 0) {
+        size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+        if (fread(buffer, 1, chunk, in) != chunk || fwrite(buffer, 1, chunk, out) != chunk) {
+            return -1;
+        }
+        length -= chunk;
+    }
+    return 0;
+}
+
+// Copies the executable without a bundle it may already carry, then
+// appends the entries, the index and the trailer
+static int build_write(BuildState *build, const char *output, char *error, size_t size) {
+    char path[4096];
+    size_t path_length = sizeof(path);
+    if (uv_exepath(path, &path_length) != 0) {
+        snprintf(error, size, "Cannot find the reflex executable");
+        return -1;
+    }
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        snprintf(error, size, "Cannot read %s", path);
+        return -1;
+    }
+    fseek(in, 0, SEEK_END);
+    size_t executable = (size_t)ftell(in);
+    rewind(in);
+    const ReflexBundle *own = reflex_bundle_open();
+    if (own) {
+        executable = own->offset;
+    }
+
+    FILE *out = fopen(output, "wb");
+    if (!out) {
+        fclose(in);
+        snprintf(error, size, "Cannot write %s", output);
+        return -1;
+    }
+
+    int failed = build_copy(out, in, executable) != 0;
+    fclose(in);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < build->count && !failed; i++) {
+        failed = fwrite(build->entries[i].chunk.data, 1, build->entries[i].chunk.length, out) != build->entries[i].chunk.length;
+    }
+
+    BundleTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    for (size_t i = 0; i < build->count; i++) {
+        trailer.index_offset += build->entries[i].chunk.length;
+    }
+    for (size_t i = 0; i < build->count && !failed; i++) {
+        BundleEntryHeader header;
+        memset(&header, 0, sizeof(header));
+        header.offset = offset;
+        header.size = build->entries[i].chunk.length;
+        header.name_length = (uint32_t)strlen(build->entries[i].name);
+        offset += header.size;
+        failed = fwrite(&header, sizeof(header), 1, out) != 1 ||
+            fwrite(build->entries[i].name, 1, header.name_length, out) != header.name_length;
+        trailer.size += sizeof(header) + header.name_length;
+    }
+
+    trailer.count = build->count;
+    trailer.size += trailer.index_offset + sizeof(trailer);
+    memcpy(trailer.magic, BUNDLE_MAGIC, 8);
+    failed = failed || fwrite(&trailer, sizeof(trailer), 1, out) != 1;
+    failed = fclose(out) != 0 || failed;
+    if (failed) {
+        remove(output);
+        snprintf(error, size, "Failed to write %s", output);
+        return -1;
+    }
+
+    uv_fs_t req;
+    uv_fs_chmod(NULL, &req, output, 0755, NULL);
+    uv_fs_req_cleanup(&req);
+    return 0;
+}
+
+int reflex_bundle_build(const char *entry, const char *output, BundleModuleCallback on_module,
+    void *data, char *error, size_t size) {
+    BuildState build;
+    memset(&build, 0, sizeof(build));
+    build.L = luaL_newstate();
+    if (!build.L) {
+        snprintf(error, size, "Out of memory");
+        return -1;
+    }
+
+    int status = build_add(&build, REFLEX_BUNDLE_MAIN, entry, entry, error, size);
+
+    // The queue grows while it is walked, every name is visited once
+    for (size_t i = 0; i < build.pending_count && status == 0; i++) {
+        const char *name = build.pending[i];
+        char path[512];
+        char chunkname[512];
+        if (reflex_module_path(name, path, sizeof(path)) != 0) {
+            continue;
+        }
+
+        uv_fs_t req;
+        int exists = uv_fs_stat(NULL, &req, path, NULL) == 0;
+        uv_fs_req_cleanup(&req);
+        if (on_module) {
+            on_module(name, exists, data);
+        }
+        if (exists) {
+            snprintf(chunkname, sizeof(chunkname), "reflex_deps/%s.lua", name);
+            status = build_add(&build, name, path, chunkname, error, size);
+        }
+    }
+
+    if (status == 0) {
+        qsort(build.entries, build.count, sizeof(BuildEntry), build_entry_compare);
+        status = build_write(&build, output, error, size);
+    }
+
+    for (size_t i = 0; i < build.count; i++) {
+        free(build.entries[i].name);
+        serial_buffer_free(&build.entries[i].chunk);
+    }
+    for (size_t i = 0; i < build.pending_count; i++) {
+        free(build.pending[i]);
+    }
+    free(build.entries);
+    free(build.pending);
+    lua_close(build.L);
+    return status;
+}
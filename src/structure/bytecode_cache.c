@@ -0,0 +1,189 @@
+#include "bytecode_cache.h"
+#include "serialize.h"
+#include "file_loader.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "RXBC"
+#define CACHE_NAME "reflex"
+
+// Written in front of the bytecode, followed by the source path
+typedef struct {
+    char magic[4];
+    char release[16];      // LUA_RELEASE, the bytecode format changes between releases
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint32_t path_length;
+} CacheHeader;
+
+static int cache_enabled = 1;
+static char cache_dir[512];     // Empty when there is no usable directory
+static uv_once_t cache_once = UV_ONCE_INIT;
+
+void reflex_cache_set_enabled(int enabled) {
+    cache_enabled = enabled;
+}
+
+// Creates `path` private to the user and checks that it is a directory
+// nobody else owns or can write to. Returns 0 when it can hold entries.
+static int cache_dir_check(const char *path) {
+    mkdir(path, 0700);
+    struct stat info;
+    if (lstat(path, &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() ||
+        (info.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void cache_dir_init(void) {
+    char base[400];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0] == '/') {
+        snprintf(base, sizeof(base), "%s", xdg);
+    } else {
+        size_t length = sizeof(base);
+        if (uv_os_homedir(base, &length) != 0 || strlen(base) + sizeof("/.cache") > sizeof(base)) {
+            return;
+        }
+        strcat(base, "/.cache");
+    }
+
+    char dir[sizeof(cache_dir)];
+    snprintf(dir, sizeof(dir), "%s/%s", base, CACHE_NAME);
+    mkdir(base, 0700);
+    if (cache_dir_check(dir) == 0) {
+        snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    }
+}
+
+// FNV-1a of the absolute path names the cache entry, the full path in the
+// entry guards against collisions
+static void cache_entry_path(const char *path, char *out, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = path; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    snprintf(out, size, "%s/%016llx.luac", cache_dir, (unsigned long long)hash);
+}
+
+static void cache_header_init(CacheHeader *header, const uv_stat_t *stat, size_t path_length) {
+    memset(header, 0, sizeof(CacheHeader));
+    memcpy(header->magic, CACHE_MAGIC, 4);
+    strncpy(header->release, LUA_RELEASE, sizeof(header->release) - 1);
+    header->mtime_sec = (int64_t)stat->st_mtim.tv_sec;
+    header->mtime_nsec = (int64_t)stat->st_mtim.tv_nsec;
+    header->size = stat->st_size;
+    header->path_length = (uint32_t)path_length;
+}
+
+// Loads the cached chunk when it matches `expected`, returns 0 on success
+static int cache_load(lua_State *L, const char *entry, const CacheHeader *expected, const char *path, const char *chunkname) {
+    // Bytecode is run as it is, only trust what this user wrote
+    struct stat info;
+    if (lstat(entry, &info) != 0 || !S_ISREG(info.st_mode) || info.st_uid != geteuid()) {
+        return -1;
+    }
+
+    ReflexFileMap map;
+    if (reflex_file_map(entry, &map) != 0) {
+        return -1;
+    }
+
+    size_t offset = sizeof(CacheHeader) + expected->path_length;
+    int status = -1;
+    if (map.length > offset && memcmp(map.data, expected, sizeof(CacheHeader)) == 0 &&
+        memcmp(map.data + sizeof(CacheHeader), path, expected->path_length) == 0) {
+        status = reflex_load_mapped(L, map.data + offset, map.length - offset, chunkname, "b");
+        if (status != LUA_OK) {
+            lua_pop(L, 1);
+        }
+    }
+    reflex_file_unmap(&map);
+    return status == LUA_OK ? 0 : -1;
+}
+
+static int cache_writer(lua_State *L, const void *data, size_t length, void *buffer) {
+    (void)L;
+    return serial_buffer_append((SerialBuffer*)buffer, data, length);
+}
+
+// Dumps the function on top into the cache. Written to a temporary file
+// first, so concurrent runs and threads never see half an entry.
+static void cache_store(lua_State *L, const char *entry, const CacheHeader *header, const char *path) {
+    uv_fs_t req;
+    SerialBuffer buffer;
+    serial_buffer_init(&buffer);
+    if (serial_buffer_append(&buffer, header, sizeof(CacheHeader)) != 0 ||
+        serial_buffer_append(&buffer, path, header->path_length) != 0 ||
+        lua_dump(L, cache_writer, &buffer, 0) != 0) {
+        serial_buffer_free(&buffer);
+        return;
+    }
+
+    char temp[700];
+    snprintf(temp, sizeof(temp), "%s.%d.%lu.tmp", entry, (int)getpid(), (unsigned long)uv_thread_self());
+    FILE *file = fopen(temp, "wb");
+    if (file) {
+        int written = fwrite(buffer.data, 1, buffer.length, file) == buffer.length;
+        if (fclose(file) == 0 && written && uv_fs_rename(NULL, &req, temp, entry, NULL) == 0) {
+            uv_fs_req_cleanup(&req);
+        } else {
+            uv_fs_req_cleanup(&req);
+            remove(temp);
+        }
+    }
+    serial_buffer_free(&buffer);
+}
+
+int reflex_load_cached(lua_State *L, const char *path, const char *chunkname) {
+    uv_fs_t req;
+    int stat_status = uv_fs_stat(NULL, &req, path, NULL);
+    uv_stat_t stat = req.statbuf;
+    uv_fs_req_cleanup(&req);
+    if (stat_status != 0) {
+        lua_pushfstring(L, "cannot open %s: %s", path, uv_strerror(stat_status));
+        return LUA_ERRFILE;
+    }
+
+    // Pipes and devices have nothing stable to key an entry on
+    int cached = cache_enabled && (stat.st_mode & S_IFMT) == S_IFREG;
+    if (cached) {
+        uv_once(&cache_once, cache_dir_init);
+        cached = cache_dir[0] != '\0';
+    }
+
+    // Entries are shared by every directory scripts run from, so they are
+    // keyed by the absolute path
+    char absolute[4096];
+    if (cached) {
+        cached = uv_fs_realpath(NULL, &req, path, NULL) == 0 && strlen((const char*)req.ptr) < sizeof(absolute);
+        if (cached) {
+            strcpy(absolute, (const char*)req.ptr);
+        }
+        uv_fs_req_cleanup(&req);
+    }
+
+    char entry[600];
+    CacheHeader header;
+    size_t path_length = cached ? strlen(absolute) : 0;
+    if (cached) {
+        cache_entry_path(absolute, entry, sizeof(entry));
+        cache_header_init(&header, &stat, path_length);
+        if (cache_load(L, entry, &header, absolute, chunkname) == 0) {
+            return LUA_OK;
+        }
+    }
+
+    int status = reflex_load_file(L, path, chunkname, NULL);
+    if (status == LUA_OK && cached) {
+        cache_store(L, entry, &header, absolute);
+    }
+    return status;
+}
@@ -0,0 +1,213 @@
+#include "channel.h"
+#include "serialize.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slots of the ring follow the bounded queue by Dmitry Vyukov: a slot is
+// free for the producer that claims position `p` when its sequence equals
+// `p`, and holds a message for the consumer when it equals `p + 1`.
+typedef struct {
+    atomic_size_t sequence;
+    ReflexMessage *message;
+} ChannelSlot;
+
+struct ReflexChannel {
+    atomic_size_t enqueue_pos;
+    char padding[64 - sizeof(atomic_size_t)];  // Producers and the consumer
+    size_t dequeue_pos;                        // stay on separate cache lines
+    size_t mask;
+    ChannelSlot *slots;
+
+    atomic_size_t refs;
+    atomic_int closed;
+    atomic_int signalled;      // A wakeup is pending, later sends skip it
+    atomic_int sending;        // Producers between the closed check and their push
+    atomic_int senders;        // Producers currently touching `async`
+    _Atomic(uv_async_t*) async;
+};
+
+ReflexChannel* reflex_channel_new(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ReflexChannel *channel = (ReflexChannel*)calloc(1, sizeof(ReflexChannel));
+    if (!channel) {
+        return NULL;
+    }
+    channel->slots = (ChannelSlot*)malloc(size * sizeof(ChannelSlot));
+    if (!channel->slots) {
+        free(channel);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&channel->slots[i].sequence, i);
+        channel->slots[i].message = NULL;
+    }
+    channel->mask = size - 1;
+    atomic_init(&channel->enqueue_pos, 0);
+    atomic_init(&channel->refs, 1);
+    atomic_init(&channel->closed, 0);
+    atomic_init(&channel->signalled, 0);
+    atomic_init(&channel->sending, 0);
+    atomic_init(&channel->senders, 0);
+    atomic_init(&channel->async, NULL);
+    return channel;
+}
+
+void reflex_channel_retain(ReflexChannel *channel) {
+    atomic_fetch_add_explicit(&channel->refs, 1, memory_order_relaxed);
+}
+
+static ReflexMessage* channel_pop(ReflexChannel *channel) {
+    ChannelSlot *slot = &channel->slots[channel->dequeue_pos & channel->mask];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != channel->dequeue_pos + 1) {
+        return NULL;
+    }
+
+    ReflexMessage *message = slot->message;
+    atomic_store_explicit(&slot->sequence, channel->dequeue_pos + channel->mask + 1, memory_order_release);
+    channel->dequeue_pos++;
+    return message;
+}
+
+void reflex_channel_release(ReflexChannel *channel) {
+    if (atomic_fetch_sub_explicit(&channel->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Messages nobody received still hold the channels sent in them
+    ReflexMessage *message;
+    while ((message = channel_pop(channel))) {
+        serial_release_channels(message->data, message->length);
+        free(message);
+    }
+    free(channel->slots);
+    free(channel);
+}
+
+static void channel_signal(ReflexChannel *channel) {
+    if (atomic_exchange(&channel->signalled, 1)) {
+        return;
+    }
+
+    atomic_fetch_add(&channel->senders, 1);
+    uv_async_t *async = atomic_load(&channel->async);
+    if (async) {
+        uv_async_send(async);
+    }
+    atomic_fetch_sub(&channel->senders, 1);
+}
+
+// Queues the message unless the channel is closed or full
+static int channel_push(ReflexChannel *channel, ReflexMessage *message) {
+    if (atomic_load(&channel->closed)) {
+        return UV_EPIPE;
+    }
+
+    size_t position = atomic_load_explicit(&channel->enqueue_pos, memory_order_relaxed);
+    ChannelSlot *slot;
+    while (1) {
+        slot = &channel->slots[position & channel->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->enqueue_pos, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return UV_EAGAIN;
+        } else {
+            position = atomic_load_explicit(&channel->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->message = message;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    return 0;
+}
+
+int reflex_channel_send(ReflexChannel *channel, const char *data, size_t length) {
+    ReflexMessage *message = (ReflexMessage*)malloc(sizeof(ReflexMessage) + length);
+    if (!message) {
+        return UV_ENOMEM;
+    }
+    message->next = NULL;
+    message->length = length;
+    memcpy(message->data, data, length);
+
+    // While `sending` counts this send the receiver does not take the
+    // channel as done, so a send that saw it open is never dropped
+    atomic_fetch_add(&channel->sending, 1);
+    int status = channel_push(channel, message);
+    atomic_fetch_sub(&channel->sending, 1);
+    if (status != 0) {
+        free(message);
+        return status;
+    }
+    channel_signal(channel);
+    return 0;
+}
+
+void reflex_channel_close(ReflexChannel *channel) {
+    atomic_store_explicit(&channel->closed, 1, memory_order_release);
+    atomic_store(&channel->signalled, 0);
+    channel_signal(channel);
+}
+
+int reflex_channel_bind(ReflexChannel *channel, uv_async_t *async) {
+    if (!async) {
+        atomic_store(&channel->async, NULL);
+
+        // The handle may only be closed once no producer can still signal it
+        while (atomic_load(&channel->senders) > 0) {
+        }
+        return 0;
+    }
+
+    uv_async_t *expected = NULL;
+    if (!atomic_compare_exchange_strong(&channel->async, &expected, async)) {
+        return expected == async ? 0 : UV_EBUSY;
+    }
+
+    // Anything sent before the receiver was bound still needs a wakeup
+    atomic_store(&channel->signalled, 0);
+    channel_signal(channel);
+    return 0;
+}
+
+static void channel_pop_all(ReflexChannel *channel, ReflexMessage **head, ReflexMessage **tail) {
+    ReflexMessage *message;
+    while ((message = channel_pop(channel))) {
+        if (*tail) {
+            (*tail)->next = message;
+        } else {
+            *head = message;
+        }
+        *tail = message;
+    }
+}
+
+ReflexMessage* reflex_channel_drain(ReflexChannel *channel, int *closed) {
+    // Cleared first, so a send racing with this drain signals again
+    atomic_store(&channel->signalled, 0);
+
+    ReflexMessage *head = NULL;
+    ReflexMessage *tail = NULL;
+    channel_pop_all(channel, &head, &tail);
+
+    // Closed and no send in flight: whatever was sent is queued by now. A
+    // send still in flight signals once it is done.
+    *closed = atomic_load(&channel->closed) && atomic_load(&channel->sending) == 0;
+    if (*closed) {
+        channel_pop_all(channel, &head, &tail);
+    }
+    return head;
+}
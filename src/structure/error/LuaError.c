@@ -1,4 +1,6 @@
 #include "error/LuaError.h"
+#include "log_writer.h"
+#include "output.h"
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
@@ -181,7 +183,9 @@ int lua_error_handler(lua_State *L) {
     memset(&info, 0, sizeof(LuaErrorInfo));
     lua_format_error(L, error_message, &info);
     
-    // Print the error immediately
+    // Print the error immediately, after what was printed and logged before it
+    reflex_log_flush();
+    reflex_output_flush();
     lua_print_error(&info);
     
     // Return the original error to propagate it up the call chain
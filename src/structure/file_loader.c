@@ -0,0 +1,157 @@
+#include "file_loader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOADER_BLOCK_SIZE (64 * 1024)
+
+// Hands lua_load the whole mapping at once
+typedef struct {
+    const char *data;      // NULL once handed out
+    size_t length;
+    int skip_comment;      // Still dropping the `#!` line
+} MappedReader;
+
+// Hands lua_load one block of the file per call
+typedef struct {
+    int fd;
+    int skip_comment;
+    int failed;            // errno of a failed read
+    char block[LOADER_BLOCK_SIZE];
+} StreamReader;
+
+// Drops the first line when it starts with '#', keeping the newline so the
+// line numbers stay right. Returns how much of `data` is left.
+static size_t loader_skip_comment(int *skip_comment, const char **data, size_t length) {
+    if (*skip_comment == 1) {
+        if (length == 0) {
+            return 0;
+        }
+        *skip_comment = (*data)[0] == '#' ? 2 : 0;
+    }
+    if (*skip_comment == 2) {
+        const char *newline = (const char*)memchr(*data, '\n', length);
+        if (!newline) {
+            return 0;
+        }
+        *skip_comment = 0;
+        length -= (size_t)(newline - *data);
+        *data = newline;
+    }
+    return length;
+}
+
+static const char* mapped_read(lua_State *L, void *ud, size_t *size) {
+    (void)L;
+    MappedReader *reader = (MappedReader*)ud;
+
+    const char *data = reader->data;
+    size_t length = data ? loader_skip_comment(&reader->skip_comment, &data, reader->length) : 0;
+    reader->data = NULL;
+    *size = length;
+    return length ? data : NULL;
+}
+
+static const char* stream_read(lua_State *L, void *ud, size_t *size) {
+    (void)L;
+    StreamReader *state = (StreamReader*)ud;
+
+    while (state->fd >= 0) {
+        ssize_t count = read(state->fd, state->block, sizeof(state->block));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            state->failed = count < 0 ? errno : 0;
+            break;
+        }
+        const char *data = state->block;
+        size_t length = loader_skip_comment(&state->skip_comment, &data, (size_t)count);
+        if (length) {
+            *size = length;
+            return data;
+        }
+    }
+    *size = 0;
+    return NULL;
+}
+
+int reflex_file_map(const char *path, ReflexFileMap *map) {
+    map->data = NULL;
+    map->length = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    // Empty files cannot be mapped but are still valid
+    if (info.st_size > 0) {
+        void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        map->data = (const char*)data;
+        map->length = (size_t)info.st_size;
+    }
+    close(fd);
+    return 0;
+}
+
+void reflex_file_unmap(ReflexFileMap *map) {
+    if (map->data) {
+        munmap((void*)map->data, map->length);
+    }
+    map->data = NULL;
+    map->length = 0;
+}
+
+int reflex_load_mapped(lua_State *L, const char *data, size_t length, const char *chunkname, const char *mode) {
+    MappedReader reader;
+    reader.data = data;
+    reader.length = length;
+    reader.skip_comment = 1;
+    return lua_load(L, mapped_read, &reader, chunkname, mode);
+}
+
+int reflex_load_file(lua_State *L, const char *path, const char *chunkname, const char *mode) {
+    ReflexFileMap map;
+    if (reflex_file_map(path, &map) == 0) {
+        int status = reflex_load_mapped(L, map.data ? map.data : "", map.length, chunkname, mode);
+        reflex_file_unmap(&map);
+        return status;
+    }
+
+    // Pipes, sockets and devices are streamed
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        lua_pushfstring(L, "cannot open %s: %s", path, strerror(errno));
+        return LUA_ERRFILE;
+    }
+
+    StreamReader *state = (StreamReader*)lua_newuserdatauv(L, sizeof(StreamReader), 0);
+    state->fd = fd;
+    state->skip_comment = 1;
+    state->failed = 0;
+    int status = lua_load(L, stream_read, state, chunkname, mode);
+    int failed = state->failed;
+    close(fd);
+
+    // Drop the block buffer below the result
+    lua_remove(L, -2);
+    if (failed) {
+        lua_pop(L, 1);
+        lua_pushfstring(L, "cannot read %s: %s", path, strerror(failed));
+        return LUA_ERRFILE;
+    }
+    return status;
+}
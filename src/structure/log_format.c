@@ -0,0 +1,372 @@
+#include "log_format.h"
+#include "log_writer.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_MAX_DEPTH 16
+#define LOG_BUFFER_KEEP 65536     // Larger buffers are freed after their record
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;                   // Out of memory, the record is dropped
+} LogBuffer;
+
+// Reused by every record of the thread
+static _Thread_local LogBuffer log_buffer;
+
+// The coarse clock only moves every few milliseconds and the date part is
+// formatted again once a second
+static _Thread_local struct {
+    time_t second;
+    char text[24];
+} log_clock;
+
+static atomic_int log_format = REFLEX_LOG_TEXT;
+static atomic_int log_level = REFLEX_LOG_DEBUG;
+
+static const char *level_names[] = {"debug", "info", "warn", "error"};
+static const char *level_labels[][2] = {
+    {"DEBUG: ", "\033[35mDEBUG:\033[0m "},
+    {"INFO: ", "\033[32mINFO:\033[0m "},
+    {"WARN: ", "\033[33mWARN:\033[0m "},
+    {"ERROR: ", "\033[31mERROR:\033[0m "}
+};
+
+void reflex_log_set_level(ReflexLogLevel level) {
+    atomic_store(&log_level, level);
+}
+
+ReflexLogLevel reflex_log_get_level(void) {
+    return (ReflexLogLevel)atomic_load(&log_level);
+}
+
+int reflex_log_level_parse(const char *name, ReflexLogLevel *level) {
+    for (int i = REFLEX_LOG_DEBUG; i <= REFLEX_LOG_ERROR; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            *level = (ReflexLogLevel)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* reflex_log_level_name(ReflexLogLevel level) {
+    return level_names[level];
+}
+
+const char* reflex_log_level_label(ReflexLogLevel level, int color) {
+    return level_labels[level][color ? 1 : 0];
+}
+
+void reflex_log_set_format(ReflexLogFormat format) {
+    atomic_store(&log_format, format);
+}
+
+ReflexLogFormat reflex_log_get_format(void) {
+    return (ReflexLogFormat)atomic_load(&log_format);
+}
+
+int reflex_log_format_parse(const char *name, ReflexLogFormat *format) {
+    if (strcmp(name, "text") == 0) {
+        *format = REFLEX_LOG_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        *format = REFLEX_LOG_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static char* buffer_reserve(LogBuffer *buffer, size_t length) {
+    if (buffer->failed) {
+        return NULL;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 512;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *grown = (char*)realloc(buffer->data, capacity);
+        if (!grown) {
+            buffer->failed = 1;
+            return NULL;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    return buffer->data + buffer->length;
+}
+
+static void buffer_append(LogBuffer *buffer, const char *data, size_t length) {
+    char *out = buffer_reserve(buffer, length);
+    if (out) {
+        memcpy(out, data, length);
+        buffer->length += length;
+    }
+}
+
+#define buffer_literal(buffer, text) buffer_append(buffer, text, sizeof(text) - 1)
+
+static void buffer_integer(LogBuffer *buffer, lua_Integer value) {
+    char digits[24];
+    int i = (int)sizeof(digits);
+    lua_Unsigned magnitude = value < 0 ? 0 - (lua_Unsigned)value : (lua_Unsigned)value;
+    do {
+        digits[--i] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        digits[--i] = '-';
+    }
+    buffer_append(buffer, digits + i, sizeof(digits) - (size_t)i);
+}
+
+static void buffer_number(LogBuffer *buffer, lua_State *L, int index) {
+    if (lua_isinteger(L, index)) {
+        buffer_integer(buffer, lua_tointeger(L, index));
+        return;
+    }
+    lua_Number value = lua_tonumber(L, index);
+    if (value != value || value == HUGE_VAL || value == -HUGE_VAL) {
+        buffer_literal(buffer, "null");
+        return;
+    }
+    char *out = buffer_reserve(buffer, 32);
+    if (out) {
+        buffer->length += (size_t)snprintf(out, 32, "%.14g", (double)value);
+    }
+}
+
+// Appends the bytes as a JSON string, quotes included
+static void buffer_json_string(LogBuffer *buffer, const char *s, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    buffer_literal(buffer, "\"");
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        buffer_append(buffer, s + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"': buffer_literal(buffer, "\\\""); break;
+            case '\\': buffer_literal(buffer, "\\\\"); break;
+            case '\n': buffer_literal(buffer, "\\n"); break;
+            case '\r': buffer_literal(buffer, "\\r"); break;
+            case '\t': buffer_literal(buffer, "\\t"); break;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                buffer_append(buffer, escape, sizeof(escape));
+            }
+        }
+    }
+    buffer_append(buffer, s + start, length - start);
+    buffer_literal(buffer, "\"");
+}
+
+static void buffer_json_value(LogBuffer *buffer, lua_State *L, int index, int depth);
+
+// Sequences become arrays, any other table an object with string keys
+static void buffer_json_table(LogBuffer *buffer, lua_State *L, int index, int depth) {
+    if (depth >= LOG_MAX_DEPTH || !lua_checkstack(L, 3)) {
+        buffer_literal(buffer, "null");
+        return;
+    }
+    index = lua_absindex(L, index);
+
+    lua_Integer count = (lua_Integer)lua_rawlen(L, index);
+    if (count > 0) {
+        buffer_literal(buffer, "[");
+        for (lua_Integer i = 1; i <= count; i++) {
+            if (i > 1) {
+                buffer_literal(buffer, ",");
+            }
+            lua_rawgeti(L, index, i);
+            buffer_json_value(buffer, L, -1, depth + 1);
+            lua_pop(L, 1);
+        }
+        buffer_literal(buffer, "]");
+        return;
+    }
+
+    buffer_literal(buffer, "{");
+    int first = 1;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        int key_type = lua_type(L, -2);
+        if (key_type == LUA_TSTRING || key_type == LUA_TNUMBER) {
+            if (!first) {
+                buffer_literal(buffer, ",");
+            }
+            first = 0;
+            if (key_type == LUA_TSTRING) {
+                size_t length;
+                const char *key = lua_tolstring(L, -2, &length);
+                buffer_json_string(buffer, key, length);
+            } else {
+                // Converting the key in place would break lua_next
+                buffer_literal(buffer, "\"");
+                buffer_number(buffer, L, -2);
+                buffer_literal(buffer, "\"");
+            }
+            buffer_literal(buffer, ":");
+            buffer_json_value(buffer, L, -1, depth + 1);
+        }
+        lua_pop(L, 1);
+    }
+    buffer_literal(buffer, "}");
+}
+
+static void buffer_json_value(LogBuffer *buffer, lua_State *L, int index, int depth) {
+    switch (lua_type(L, index)) {
+        case LUA_TSTRING: {
+            size_t length;
+            const char *s = lua_tolstring(L, index, &length);
+            buffer_json_string(buffer, s, length);
+            break;
+        }
+        case LUA_TNUMBER:
+            buffer_number(buffer, L, index);
+            break;
+        case LUA_TBOOLEAN:
+            if (lua_toboolean(L, index)) {
+                buffer_literal(buffer, "true");
+            } else {
+                buffer_literal(buffer, "false");
+            }
+            break;
+        case LUA_TTABLE:
+            buffer_json_table(buffer, L, index, depth);
+            break;
+        case LUA_TNIL:
+            buffer_literal(buffer, "null");
+            break;
+        default: {
+            const char *name = luaL_typename(L, index);
+            buffer_json_string(buffer, name, strlen(name));
+        }
+    }
+}
+
+// The coarse clock is read without a system call, but only Linux has it
+#ifdef CLOCK_REALTIME_COARSE
+#define LOG_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define LOG_CLOCK CLOCK_REALTIME
+#endif
+
+// "2026-01-31T12:00:00.123Z"
+static void buffer_timestamp(LogBuffer *buffer) {
+    struct timespec now;
+    clock_gettime(LOG_CLOCK, &now);
+    if (now.tv_sec != log_clock.second || !log_clock.text[0]) {
+        struct tm date;
+        gmtime_r(&now.tv_sec, &date);
+        strftime(log_clock.text, sizeof(log_clock.text), "%Y-%m-%dT%H:%M:%S.", &date);
+        log_clock.second = now.tv_sec;
+    }
+    buffer_append(buffer, log_clock.text, strlen(log_clock.text));
+
+    long millis = now.tv_nsec / 1000000;
+    char fraction[4] = {(char)('0' + millis / 100), (char)('0' + millis / 10 % 10), (char)('0' + millis % 10), 'Z'};
+    buffer_append(buffer, fraction, sizeof(fraction));
+}
+
+static void record_json(LogBuffer *buffer, lua_State *L, ReflexLogLevel level, int message, int fields) {
+    buffer_literal(buffer, "{\"time\":\"");
+    buffer_timestamp(buffer);
+    buffer_literal(buffer, "\",\"level\":\"");
+    buffer_append(buffer, level_names[level], strlen(level_names[level]));
+    buffer_literal(buffer, "\",\"msg\":");
+    buffer_json_value(buffer, L, message, 0);
+
+    if (fields) {
+        // The fields go in the top-level object, after the record's own keys
+        size_t start = buffer->length;
+        buffer_json_table(buffer, L, fields, 0);
+        if (!buffer->failed && buffer->data[start] == '{' && buffer->length - start > 2) {
+            buffer->data[start] = ',';
+            buffer->length--;
+        } else {
+            buffer->length = buffer->failed ? buffer->length : start;
+        }
+    }
+    buffer_literal(buffer, "}\n");
+}
+
+// Strings without spaces, quotes or control characters are written as they are
+static void buffer_text_value(LogBuffer *buffer, lua_State *L, int index) {
+    if (lua_type(L, index) == LUA_TSTRING) {
+        size_t length;
+        const char *s = lua_tolstring(L, index, &length);
+        size_t i = 0;
+        while (i < length && (unsigned char)s[i] > ' ' && s[i] != '"') {
+            i++;
+        }
+        if (i == length && length > 0) {
+            buffer_append(buffer, s, length);
+            return;
+        }
+    }
+    buffer_json_value(buffer, L, index, 0);
+}
+
+// The writer puts the level label in front, colored only for a terminal
+static void record_text(LogBuffer *buffer, lua_State *L, int message, int fields) {
+    size_t length;
+    const char *text = lua_type(L, message) == LUA_TSTRING || lua_type(L, message) == LUA_TNUMBER ?
+        lua_tolstring(L, message, &length) : luaL_tolstring(L, message, &length);
+    buffer_append(buffer, text, length);
+
+    if (fields && lua_checkstack(L, 2)) {
+        lua_pushnil(L);
+        while (lua_next(L, fields)) {
+            if (lua_type(L, -2) == LUA_TSTRING) {
+                size_t key_length;
+                const char *key = lua_tolstring(L, -2, &key_length);
+                buffer_literal(buffer, " ");
+                buffer_append(buffer, key, key_length);
+                buffer_literal(buffer, "=");
+                buffer_text_value(buffer, L, -1);
+            }
+            lua_pop(L, 1);
+        }
+    }
+    buffer_literal(buffer, "\n");
+}
+
+void reflex_log_record(lua_State *L, ReflexLogLevel level, int message, int fields) {
+    LogBuffer *buffer = &log_buffer;
+    int top = lua_gettop(L);
+    message = lua_absindex(L, message);
+    fields = fields && lua_istable(L, fields) ? lua_absindex(L, fields) : 0;
+
+    buffer->length = 0;
+    buffer->failed = 0;
+    if (reflex_log_get_format() == REFLEX_LOG_JSON) {
+        record_json(buffer, L, level, message, fields);
+    } else {
+        record_text(buffer, L, message, fields);
+    }
+    lua_settop(L, top);
+
+    if (!buffer->failed) {
+        struct iovec part = { buffer->data, buffer->length };
+        reflex_log_writev(reflex_log_get_format() == REFLEX_LOG_JSON ? REFLEX_LOG_UNLABELED : (int)level, &part, 1);
+    }
+    if (buffer->capacity > LOG_BUFFER_KEEP) {
+        reflex_log_release_thread();
+    }
+}
+
+void reflex_log_release_thread(void) {
+    free(log_buffer.data);
+    memset(&log_buffer, 0, sizeof(log_buffer));
+}
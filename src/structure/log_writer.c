@@ -0,0 +1,575 @@
+#include "log_writer.h"
+#include "log_format.h"
+#include <uv.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS 4096      // Power of two
+#define LOG_SLOT_SIZE 496        // Longer records are copied to the heap
+#define LOG_BATCH 256            // Records per writev
+#define LOG_NAP_MS 5             // How long the writer polls before sleeping
+#define LOG_COMPRESS_ARGS 16
+
+// What the writer is doing while the ring is empty
+enum {
+    WRITER_BUSY,
+    WRITER_NAPPING,              // Wakes up by itself, woken early when the ring fills up
+    WRITER_SLEEPING              // Waits for the next record
+};
+
+// A slot is free for position p when its sequence is p, and holds the
+// record of position p once it is p + 1
+typedef struct {
+    atomic_size_t sequence;
+    size_t length;
+    int level;                   // Label to write in front, or REFLEX_LOG_UNLABELED
+    char *large;
+    char data[LOG_SLOT_SIZE];
+} LogSlot;
+
+// A file the writer appends to, only touched by the writer thread once added
+typedef struct LogSink {
+    char *path;
+    int fd;
+    char *block;
+    size_t used;
+    ReflexLogFileOptions options;
+    char *compress;              // Owned copy of options.compress
+    unsigned long long size;     // Bytes in the current file
+    time_t opened;               // When the current file was started
+    uint64_t pending_since;      // Loop time of the oldest record in the block
+    struct LogSink *next;
+} LogSink;
+
+static struct {
+    LogSlot *slots;
+    atomic_size_t tail;          // Next position a producer claims
+    size_t head;                 // Next position the writer reads, writer only
+    atomic_size_t written;       // Positions written out
+    atomic_int state;            // WRITER_*, producers wake the writer unless busy
+    atomic_int to_stdout;
+    int stdout_color;            // stdout is a terminal, labels get colors there only
+    atomic_size_t flush_requested;
+    size_t flush_done;           // Last request served, read under `lock`
+    atomic_int waiting;          // Threads in reflex_log_sync
+    LogSink *sinks;              // Read by the writer, linked in under `lock`
+    LogSink *added;              // Waiting for the writer, under `lock`
+    uv_mutex_t lock;
+    uv_cond_t drained;
+    uv_loop_t loop;
+    uv_async_t wake;
+    uv_timer_t timer;
+    uv_thread_t thread;
+    int started;
+} ring = { .to_stdout = 1 };
+
+static uv_once_t ring_once = UV_ONCE_INIT;
+
+// Position after the last record the thread queued
+static _Thread_local size_t log_queued;
+
+static int ring_ready(size_t position) {
+    return atomic_load(&ring.slots[position & (LOG_RING_SLOTS - 1)].sequence) == position + 1;
+}
+
+static void ring_write(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                sched_yield();
+                continue;
+            }
+            return; // Nowhere to log to, drop the batch
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+static void compress_on_close(uv_handle_t *handle) {
+    free(handle);
+}
+
+static void compress_on_exit(uv_process_t *process, int64_t status, int signal) {
+    (void)status;
+    (void)signal;
+    uv_close((uv_handle_t*)process, compress_on_close);
+}
+
+// Runs the sink's compress command on a rotated file without waiting for it
+static void sink_compress(LogSink *sink, const char *rotated) {
+    char command[1024];
+    snprintf(command, sizeof(command), "%s", sink->compress);
+
+    char *args[LOG_COMPRESS_ARGS + 2];
+    int count = 0;
+    char *save;
+    for (char *arg = strtok_r(command, " ", &save); arg && count < LOG_COMPRESS_ARGS; arg = strtok_r(NULL, " ", &save)) {
+        args[count++] = arg;
+    }
+    if (count == 0) {
+        return;
+    }
+    args[count++] = (char*)rotated;
+    args[count] = NULL;
+
+    uv_process_t *process = (uv_process_t*)malloc(sizeof(uv_process_t));
+    if (!process) {
+        return;
+    }
+    uv_process_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.file = args[0];
+    options.args = args;
+    options.exit_cb = compress_on_exit;
+    if (uv_spawn(&ring.loop, process, &options) != 0) {
+        uv_close((uv_handle_t*)process, compress_on_close);
+    }
+}
+
+// Moves the current file aside as <path>.<date> and starts a new one
+static void sink_rotate(LogSink *sink, time_t now) {
+    char rotated[4096];
+    char date[32];
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &local);
+
+    int length = snprintf(rotated, sizeof(rotated), "%s.%s", sink->path, date);
+    struct stat info;
+    for (int i = 1; stat(rotated, &info) == 0; i++) {
+        snprintf(rotated + length, sizeof(rotated) - (size_t)length, ".%d", i);
+    }
+    if (rename(sink->path, rotated) != 0) {
+        return; // Keeps appending to the current file
+    }
+
+    int fd = open(sink->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    close(sink->fd);
+    sink->fd = fd;
+    sink->size = 0;
+    sink->opened = now;
+    if (sink->compress) {
+        sink_compress(sink, rotated);
+    }
+}
+
+// Writes out the sink's block, rotating first when it is time to
+static void sink_write(LogSink *sink) {
+    if (sink->used == 0) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (sink->size > 0 && ((sink->options.max_size && sink->size + sink->used > sink->options.max_size) ||
+        (sink->options.rotate_every && now - sink->opened >= (time_t)sink->options.rotate_every))) {
+        sink_rotate(sink, now);
+    }
+
+    struct iovec part = { sink->block, sink->used };
+    ring_write(sink->fd, &part, 1);
+    sink->size += sink->used;
+    sink->used = 0;
+}
+
+static void sink_append(LogSink *sink, const char *data, size_t length) {
+    if (sink->used == 0) {
+        sink->pending_since = uv_now(&ring.loop);
+    }
+    while (length > 0) {
+        if (sink->used == sink->options.block_size) {
+            sink_write(sink);
+            sink->pending_since = uv_now(&ring.loop);
+        }
+        size_t chunk = sink->options.block_size - sink->used;
+        chunk = chunk < length ? chunk : length;
+        memcpy(sink->block + sink->used, data, chunk);
+        sink->used += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+// Writes the blocks that waited their flush interval, or all of them.
+// Returns the milliseconds until the next one is due, 0 when none waits.
+static uint64_t sinks_write(int all) {
+    uint64_t now = uv_now(&ring.loop);
+    uint64_t next = 0;
+    for (LogSink *sink = ring.sinks; sink; sink = sink->next) {
+        if (sink->used == 0) {
+            continue;
+        }
+        uint64_t due = sink->pending_since + sink->options.flush_interval;
+        if (all || due <= now) {
+            sink_write(sink);
+        } else if (next == 0 || due - now < next) {
+            next = due - now;
+        }
+    }
+    return next;
+}
+
+// Takes over the sinks added since the last wakeup
+static void sinks_adopt(void) {
+    uv_mutex_lock(&ring.lock);
+    while (ring.added) {
+        LogSink *sink = ring.added;
+        ring.added = sink->next;
+        sink->next = ring.sinks;
+        ring.sinks = sink;
+    }
+    uv_mutex_unlock(&ring.lock);
+}
+
+// Points `parts` at the slot's label and record, returns how many it used
+static int slot_parts(const LogSlot *slot, int color, struct iovec *parts) {
+    int count = 0;
+    if (slot->length == 0) {
+        return 0;
+    }
+    if (slot->level != REFLEX_LOG_UNLABELED) {
+        const char *label = reflex_log_level_label((ReflexLogLevel)slot->level, color);
+        parts[count].iov_base = (char*)label;
+        parts[count++].iov_len = strlen(label);
+    }
+    parts[count].iov_base = slot->large ? slot->large : (char*)slot->data;
+    parts[count++].iov_len = slot->length;
+    return count;
+}
+
+// Hands every ready record to stdout and the sinks, returns how many
+static size_t ring_drain(void) {
+    struct iovec iov[LOG_BATCH * 2];
+    size_t total = 0;
+
+    while (1) {
+        int count = 0;
+        int parts = 0;
+        while (count < LOG_BATCH && ring_ready(ring.head + count)) {
+            LogSlot *slot = &ring.slots[(ring.head + count) & (LOG_RING_SLOTS - 1)];
+            parts += slot_parts(slot, ring.stdout_color, iov + parts);
+            count++;
+        }
+        if (count == 0) {
+            return total;
+        }
+
+        // Files always get plain labels
+        for (LogSink *sink = ring.sinks; sink; sink = sink->next) {
+            for (int i = 0; i < count; i++) {
+                struct iovec record[2];
+                int n = slot_parts(&ring.slots[(ring.head + i) & (LOG_RING_SLOTS - 1)], 0, record);
+                for (int j = 0; j < n; j++) {
+                    sink_append(sink, (const char*)record[j].iov_base, record[j].iov_len);
+                }
+            }
+        }
+        if (atomic_load(&ring.to_stdout)) {
+            // Whatever print left in stdio's buffer goes out first
+            fflush(stdout);
+            ring_write(STDOUT_FILENO, iov, parts);
+        }
+
+        for (int i = 0; i < count; i++) {
+            LogSlot *slot = &ring.slots[ring.head & (LOG_RING_SLOTS - 1)];
+            free(slot->large);
+            slot->large = NULL;
+            atomic_store_explicit(&slot->sequence, ring.head + LOG_RING_SLOTS, memory_order_release);
+            ring.head++;
+        }
+        atomic_store(&ring.written, ring.head);
+        if (atomic_load(&ring.waiting)) {
+            uv_mutex_lock(&ring.lock);
+            uv_cond_broadcast(&ring.drained);
+            uv_mutex_unlock(&ring.lock);
+        }
+        total += (size_t)count;
+    }
+}
+
+static void ring_on_timer(uv_timer_t *timer);
+
+// Drains the ring until it stays empty. After records came in the writer
+// naps for LOG_NAP_MS, records arriving meanwhile cost no wakeup, then it
+// sleeps until the next record or the next block that is due.
+static void ring_service(void) {
+    atomic_store(&ring.state, WRITER_BUSY);
+    sinks_adopt();
+
+    size_t drained = 0;
+    while (1) {
+        size_t requested = atomic_load(&ring.flush_requested);
+        drained += ring_drain();
+
+        if (requested != ring.flush_done) {
+            sinks_write(1);
+            uv_mutex_lock(&ring.lock);
+            ring.flush_done = requested;
+            uv_cond_broadcast(&ring.drained);
+            uv_mutex_unlock(&ring.lock);
+        }
+
+        atomic_store(&ring.state, drained > 0 ? WRITER_NAPPING : WRITER_SLEEPING);
+        if (!ring_ready(ring.head) && atomic_load(&ring.flush_requested) == ring.flush_done) {
+            break;
+        }
+        atomic_store(&ring.state, WRITER_BUSY);
+    }
+
+    uint64_t next = sinks_write(0);
+    if (drained > 0) {
+        next = LOG_NAP_MS;
+    }
+    if (next > 0) {
+        uv_timer_start(&ring.timer, ring_on_timer, next, 0);
+    } else {
+        uv_timer_stop(&ring.timer);
+    }
+}
+
+static void ring_on_wake(uv_async_t *handle) {
+    (void)handle;
+    ring_service();
+}
+
+static void ring_on_timer(uv_timer_t *timer) {
+    (void)timer;
+    ring_service();
+}
+
+static void ring_main(void *arg) {
+    (void)arg;
+    uv_run(&ring.loop, UV_RUN_DEFAULT);
+}
+
+static void ring_start(void) {
+    ring.slots = (LogSlot*)calloc(LOG_RING_SLOTS, sizeof(LogSlot));
+    if (!ring.slots) {
+        return;
+    }
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) {
+        atomic_init(&ring.slots[i].sequence, i);
+    }
+    uv_mutex_init(&ring.lock);
+    uv_cond_init(&ring.drained);
+    atomic_store(&ring.state, WRITER_SLEEPING);
+    ring.stdout_color = isatty(STDOUT_FILENO);
+
+    // The loop is only run by the writer thread, which never exits
+    if (uv_loop_init(&ring.loop) != 0) {
+        free(ring.slots);
+        ring.slots = NULL;
+        return;
+    }
+    uv_async_init(&ring.loop, &ring.wake, ring_on_wake);
+    uv_timer_init(&ring.loop, &ring.timer);
+    if (uv_thread_create(&ring.thread, ring_main, NULL) != 0) {
+        free(ring.slots);
+        ring.slots = NULL;
+        return;
+    }
+    ring.started = 1;
+
+    // exit() from anywhere still writes out what was logged
+    atexit(reflex_log_flush);
+}
+
+// Claims the next free slot. A full ring waits for the writer, the only
+// case where logging yields the thread.
+static LogSlot* ring_claim(size_t *position) {
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    while (1) {
+        LogSlot *slot = &ring.slots[tail & (LOG_RING_SLOTS - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)tail;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring.tail, &tail, tail + 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+                *position = tail;
+                return slot;
+            }
+        } else {
+            if (difference < 0) {
+                sched_yield();
+            }
+            tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+        }
+    }
+}
+
+// Writes the record straight to stdout when the writer cannot run
+static void log_write_direct(int level, const struct iovec *parts, int count) {
+    if (!atomic_load(&ring.to_stdout)) {
+        return;
+    }
+    struct iovec copy[17];
+    int n = 0;
+    if (level != REFLEX_LOG_UNLABELED) {
+        const char *label = reflex_log_level_label((ReflexLogLevel)level, isatty(STDOUT_FILENO));
+        copy[n].iov_base = (char*)label;
+        copy[n++].iov_len = strlen(label);
+    }
+    for (int i = 0; i < count && n < 17; i++) {
+        copy[n++] = parts[i];
+    }
+    fflush(stdout);
+    ring_write(STDOUT_FILENO, copy, n);
+}
+
+void reflex_log_writev(int level, const struct iovec *parts, int count) {
+    uv_once(&ring_once, ring_start);
+    if (!ring.started) {
+        log_write_direct(level, parts, count);
+        return;
+    }
+
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += parts[i].iov_len;
+    }
+
+    size_t position;
+    LogSlot *slot = ring_claim(&position);
+    char *out = slot->data;
+    if (length > LOG_SLOT_SIZE) {
+        slot->large = (char*)malloc(length);
+        out = slot->large;
+    }
+    if (out) {
+        for (int i = 0; i < count; i++) {
+            memcpy(out, parts[i].iov_base, parts[i].iov_len);
+            out += parts[i].iov_len;
+        }
+    }
+    slot->length = out ? length : 0;
+    slot->level = level;
+    atomic_store(&slot->sequence, position + 1);
+    log_queued = position + 1;
+
+    // Only a sleeping writer, or a napping one with the ring half full,
+    // costs a wakeup
+    int state = atomic_load(&ring.state);
+    if (state == WRITER_SLEEPING || (state == WRITER_NAPPING &&
+        position - atomic_load(&ring.written) >= LOG_RING_SLOTS / 2)) {
+        uv_async_send(&ring.wake);
+    }
+}
+
+void reflex_log_flush(void) {
+    if (!ring.started) {
+        return;
+    }
+
+    uv_mutex_lock(&ring.lock);
+    size_t request = atomic_fetch_add(&ring.flush_requested, 1) + 1;
+    uv_async_send(&ring.wake);
+    while (ring.flush_done < request) {
+        uv_cond_wait(&ring.drained, &ring.lock);
+    }
+    uv_mutex_unlock(&ring.lock);
+}
+
+void reflex_log_sync(void) {
+    if (!ring.started || atomic_load(&ring.written) >= log_queued) {
+        return;
+    }
+
+    // The writer checks `waiting` after publishing `written`, so either
+    // it is seen here or the writer wakes this thread up
+    uv_mutex_lock(&ring.lock);
+    atomic_fetch_add(&ring.waiting, 1);
+    uv_async_send(&ring.wake);
+    while (atomic_load(&ring.written) < log_queued) {
+        uv_cond_wait(&ring.drained, &ring.lock);
+    }
+    atomic_fetch_sub(&ring.waiting, 1);
+    uv_mutex_unlock(&ring.lock);
+}
+
+int reflex_log_add_file(const char *path, const ReflexLogFileOptions *options) {
+    uv_once(&ring_once, ring_start);
+    if (!ring.started) {
+        return UV_ENOMEM;
+    }
+
+    LogSink *sink = (LogSink*)calloc(1, sizeof(LogSink));
+    if (!sink) {
+        return UV_ENOMEM;
+    }
+    sink->options = *options;
+    if (sink->options.block_size == 0) {
+        sink->options.block_size = REFLEX_LOG_BLOCK_SIZE;
+    }
+    sink->path = strdup(path);
+    sink->block = (char*)malloc(sink->options.block_size);
+    sink->compress = options->compress ? strdup(options->compress) : NULL;
+    sink->fd = -1;
+    if (!sink->path || !sink->block || (options->compress && !sink->compress)) {
+        free(sink->path);
+        free(sink->block);
+        free(sink->compress);
+        free(sink);
+        return UV_ENOMEM;
+    }
+
+    // Sinks are never removed, the writer only links new ones in under the lock
+    int status = 0;
+    uv_mutex_lock(&ring.lock);
+    for (int list = 0; list < 2 && status == 0; list++) {
+        for (LogSink *other = list ? ring.added : ring.sinks; other; other = other->next) {
+            if (strcmp(other->path, path) == 0) {
+                status = UV_EEXIST;
+                break;
+            }
+        }
+    }
+    if (status == 0) {
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat info;
+        if (sink->fd < 0) {
+            status = -errno;
+        } else if (fstat(sink->fd, &info) == 0) {
+            sink->size = (unsigned long long)info.st_size;
+        }
+    }
+    if (status == 0) {
+        sink->opened = time(NULL);
+        sink->next = ring.added;
+        ring.added = sink;
+    }
+    uv_mutex_unlock(&ring.lock);
+
+    if (status != 0) {
+        free(sink->path);
+        free(sink->block);
+        free(sink->compress);
+        free(sink);
+        return status;
+    }
+    uv_async_send(&ring.wake);
+    return 0;
+}
+
+void reflex_log_set_stdout(int enabled) {
+    atomic_store(&ring.to_stdout, enabled);
+}
@@ -0,0 +1,46 @@
+#include "loop.h"
+#include "error/LuaError.h"
+
+uv_loop_t* reflex_get_loop(lua_State *L) {
+    LuaAPI *api = reflex_get_api(L);
+    return api ? api->loop : NULL;
+}
+
+int reflex_loop_run(LuaAPI *api) {
+    if (!api || !api->loop) {
+        return 1;
+    }
+
+    uv_run(api->loop, UV_RUN_DEFAULT);
+    return api->loop_error ? 1 : 0;
+}
+
+int reflex_loop_call(lua_State *L, int nargs, int nresults) {
+    int func_idx = lua_gettop(L) - nargs;
+
+    // Slide the error handler beneath the function
+    lua_pushcfunction(L, lua_error_handler);
+    lua_insert(L, func_idx);
+
+    int status = lua_pcall(L, nargs, nresults, func_idx);
+    lua_remove(L, func_idx);
+
+    if (status != LUA_OK) {
+        // Memory errors skip the message handler
+        if (status == LUA_ERRMEM) {
+            reflex_memory_error(L);
+            lua_error_handler(L);
+            reflex_memory_restore(L);
+        }
+
+        // Uncaught errors end the process like they would in the main chunk
+        lua_pop(L, 1);
+        LuaAPI *api = reflex_get_api(L);
+        if (api) {
+            api->loop_error = 1;
+            uv_stop(api->loop);
+        }
+    }
+
+    return status;
+}
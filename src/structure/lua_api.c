@@ -1,25 +1,76 @@
 #include "lua_api.h"
+#include "alloc.h"
+#include "log_format.h"
+#include "output.h"
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-LuaAPI* reflex_new(void) {
+// Same as the panic function of luaL_newstate
+static int reflex_panic(lua_State *L) {
+    const char *message = lua_tostring(L, -1);
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", message ? message : "error object is not a string");
+    fflush(stderr);
+    return 0;
+}
+
+static LuaAPI* reflex_create(lua_Alloc alloc, void *ud, ReflexArena *arena) {
     LuaAPI *api = (LuaAPI*)malloc(sizeof(LuaAPI));
     if (!api) {
         return NULL;
     }
     
-    api->L = luaL_newstate();
+    api->arena = arena;
+    api->memory.alloc = alloc;
+    api->memory.ud = ud;
+    api->memory.live = 0;
+    api->memory.peak = 0;
+    api->memory.limit = reflex_get_memory_limit();
+    api->memory.headroom = 0;
+
+    api->L = lua_newstate(reflex_memory_alloc, &api->memory);
     if (!api->L) {
         free(api);
         return NULL;
     }
-    
+    lua_atpanic(api->L, reflex_panic);
+
+    api->loop = (uv_loop_t*)malloc(sizeof(uv_loop_t));
+    if (!api->loop || uv_loop_init(api->loop) != 0) {
+        lua_close(api->L);
+        free(api->loop);
+        free(api);
+        return NULL;
+    }
+    api->loop->data = api;
+    api->loop_error = 0;
+
+    // Coroutines inherit the extra space of the main thread, so every
+    // thread of this state can find its owner without a registry lookup
+    *(LuaAPI**)lua_getextraspace(api->L) = api;
+
     luaL_openlibs(api->L);
     return api;
 }
 
+LuaAPI* reflex_new(void) {
+    return reflex_create(reflex_allocator_function(reflex_get_allocator()), NULL, NULL);
+}
+
+LuaAPI* reflex_new_arena(size_t chunk_size) {
+    ReflexArena *arena = reflex_arena_new(chunk_size);
+    if (!arena) {
+        return NULL;
+    }
+
+    LuaAPI *api = reflex_create(reflex_arena_alloc, arena, arena);
+    if (!api) {
+        reflex_arena_free(arena);
+    }
+    return api;
+}
+
 LuaAPI* reflex_from(lua_State* L) {
     LuaAPI *api = (LuaAPI*)malloc(sizeof(LuaAPI));
     if (!api) {
@@ -31,16 +82,78 @@ LuaAPI* reflex_from(lua_State* L) {
         free(api);
         return NULL;
     }
+
+    // Borrow the loop of the owning API, the wrapper never closes it
+    LuaAPI *owner = reflex_get_api(L);
+    api->loop = owner ? owner->loop : NULL;
+    api->loop_error = 0;
+    memset(&api->memory, 0, sizeof(api->memory));
+    api->arena = NULL;
     
     return api;
 }
 
+LuaAPI* reflex_get_api(lua_State *L) {
+    if (!L) {
+        return NULL;
+    }
+    return *(LuaAPI**)lua_getextraspace(L);
+}
+
+void reflex_memory_error(lua_State *L) {
+    LuaAPI *api = reflex_get_api(L);
+    if (!api || !api->memory.limit) {
+        return;
+    }
+
+    api->memory.headroom = 1;
+    lua_pop(L, 1);
+    lua_pushfstring(L, "not enough memory (limit of %I bytes reached)", (lua_Integer)api->memory.limit);
+}
+
+void reflex_memory_restore(lua_State *L) {
+    LuaAPI *api = reflex_get_api(L);
+    if (api) {
+        api->memory.headroom = 0;
+    }
+}
+
+static void close_walk_cb(uv_handle_t *handle, void *arg) {
+    (void)arg;
+    if (!uv_is_closing(handle)) {
+        ReflexHandle *owner = (ReflexHandle*)handle->data;
+        uv_close(handle, owner ? owner->close : NULL);
+    }
+}
+
 void reflex_free(LuaAPI *api) {
     if (!api) {
         return;
     }
+
+    if (api->loop) {
+        // Close leftover handles while the state is still alive, their
+        // close callbacks may release registry references. Running the
+        // loop also waits for requests still on the threadpool.
+        uv_walk(api->loop, close_walk_cb, NULL);
+        uv_run(api->loop, UV_RUN_DEFAULT);
+    }
     
+    // Finalizers still run, but in an arena the frees are no-ops and the
+    // memory goes back in one piece
     lua_close(api->L);
+    if (api->arena) {
+        reflex_arena_free(api->arena);
+    } else {
+        reflex_alloc_release_thread();
+    }
+    reflex_log_release_thread();
+    reflex_output_flush();
+
+    if (api->loop) {
+        uv_loop_close(api->loop);
+        free(api->loop);
+    }
     free(api);
 }
 
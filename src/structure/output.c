@@ -0,0 +1,92 @@
+#include "output.h"
+#include "log_writer.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_REGISTRY_KEY "reflex.output"
+
+static int output_buffered = 0;
+
+void reflex_output_configure(int force) {
+    if (!force && isatty(STDOUT_FILENO)) {
+        return;
+    }
+    if (setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE) == 0) {
+        output_buffered = 1;
+    }
+}
+
+int reflex_output_buffered(void) {
+    return output_buffered;
+}
+
+void reflex_output_flush(void) {
+    fflush(stdout);
+}
+
+// print(...) like Lua's, without the flush after every line. The line is
+// written under the stream lock so lines of different workers do not mix,
+// and after the records the thread logged before it.
+static int output_print(lua_State *L) {
+    int count = lua_gettop(L);
+    luaL_checkstack(L, count, "too many arguments to print");
+    for (int i = 1; i <= count; i++) {
+        luaL_tolstring(L, i, NULL);
+    }
+
+    reflex_log_sync();
+    flockfile(stdout);
+    for (int i = 1; i <= count; i++) {
+        size_t length;
+        const char *text = lua_tolstring(L, count + i, &length);
+        if (i > 1) {
+            putc('\t', stdout);
+        }
+        fwrite(text, 1, length, stdout);
+    }
+    putc('\n', stdout);
+    funlockfile(stdout);
+    return 0;
+}
+
+// io.write(...), the original in upvalue 1, also after the records logged before it
+static int output_io_write(lua_State *L) {
+    reflex_log_sync();
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
+}
+
+// Runs before the loop polls, only a poll that can block counts as idle
+static void output_on_prepare(uv_prepare_t *handle) {
+    if (uv_backend_timeout(handle->loop) != 0) {
+        fflush(stdout);
+    }
+}
+
+void reflex_output_init(LuaAPI *api) {
+    lua_State *L = api->L;
+    reflex_register_function(api, "print", output_print);
+
+    lua_getglobal(L, "io");
+    if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, "write");
+        lua_pushcclosure(L, output_io_write, 1);
+        lua_setfield(L, -2, "write");
+    }
+    lua_pop(L, 1);
+
+    if (!output_buffered) {
+        return;
+    }
+
+    // Anchored in the registry, the loop closes the handle before the state
+    uv_prepare_t *prepare = (uv_prepare_t*)lua_newuserdatauv(L, sizeof(uv_prepare_t), 0);
+    uv_prepare_init(api->loop, prepare);
+    prepare->data = NULL;
+    uv_prepare_start(prepare, output_on_prepare);
+    uv_unref((uv_handle_t*)prepare);
+    lua_setfield(L, LUA_REGISTRYINDEX, OUTPUT_REGISTRY_KEY);
+}
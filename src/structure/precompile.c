@@ -0,0 +1,178 @@
+#include "precompile.h"
+#include "require.h"
+#include "bytecode_cache.h"
+#include "file_loader.h"
+#include "serialize.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char *name;
+    char path[512];
+    SerialBuffer code;     // Empty when the module is not in reflex_deps or failed to compile
+} PrecompileModule;
+
+// Modules are queued as the scanned sources name them, any thread takes the
+// next one. The work is done once the queue is empty and no thread is busy.
+typedef struct {
+    uv_mutex_t lock;
+    uv_cond_t wake;
+    PrecompileModule *modules;
+    size_t count;
+    size_t capacity;
+    size_t next;
+    int busy;
+} Precompile;
+
+static int precompile_writer(lua_State *L, const void *data, size_t length, void *buffer) {
+    (void)L;
+    return serial_buffer_append((SerialBuffer*)buffer, data, length);
+}
+
+// Queues a module the first time it is named, called with the lock held
+static void precompile_on_require(const char *name, size_t length, void *data) {
+    Precompile *work = (Precompile*)data;
+    for (size_t i = 0; i < work->count; i++) {
+        if (strlen(work->modules[i].name) == length && memcmp(work->modules[i].name, name, length) == 0) {
+            return;
+        }
+    }
+
+    if (work->count == work->capacity) {
+        size_t capacity = work->capacity ? work->capacity * 2 : 32;
+        PrecompileModule *grown = (PrecompileModule*)realloc(work->modules, capacity * sizeof(PrecompileModule));
+        if (!grown) {
+            return;
+        }
+        work->modules = grown;
+        work->capacity = capacity;
+    }
+
+    PrecompileModule *module = &work->modules[work->count];
+    module->name = (char*)malloc(length + 1);
+    if (!module->name) {
+        return;
+    }
+    memcpy(module->name, name, length);
+    module->name[length] = '\0';
+    serial_buffer_init(&module->code);
+    if (reflex_module_path(module->name, module->path, sizeof(module->path)) != 0) {
+        module->path[0] = '\0';
+    }
+    work->count++;
+    uv_cond_broadcast(&work->wake);
+}
+
+// Compiles one module into `code`, then queues what its source requires.
+// Names only stay valid until the lock is taken, so they are copied first.
+static void precompile_module(Precompile *work, lua_State *L, const char *path, SerialBuffer *code) {
+    ReflexFileMap source;
+    if (reflex_file_map(path, &source) != 0) {
+        return;
+    }
+
+    // Goes through the bytecode cache, which other runs then load directly
+    if (reflex_load_cached(L, path, path) == LUA_OK) {
+        lua_dump(L, precompile_writer, code, 0);
+    }
+    lua_settop(L, 0);
+
+    uv_mutex_lock(&work->lock);
+    if (source.data) {
+        reflex_scan_requires(source.data, source.length, precompile_on_require, work);
+    }
+    uv_mutex_unlock(&work->lock);
+    reflex_file_unmap(&source);
+}
+
+static void precompile_main(void *arg) {
+    Precompile *work = (Precompile*)arg;
+    lua_State *L = luaL_newstate();
+
+    uv_mutex_lock(&work->lock);
+    while (1) {
+        if (work->next < work->count) {
+            size_t index = work->next++;
+            char path[512];
+            memcpy(path, work->modules[index].path, sizeof(path));
+            work->busy++;
+            uv_mutex_unlock(&work->lock);
+
+            SerialBuffer code;
+            serial_buffer_init(&code);
+            if (path[0] && L) {
+                precompile_module(work, L, path, &code);
+            }
+
+            // The array may have moved while compiling
+            uv_mutex_lock(&work->lock);
+            work->modules[index].code = code;
+            if (--work->busy == 0 && work->next == work->count) {
+                uv_cond_broadcast(&work->wake);
+            }
+        } else if (work->busy == 0) {
+            break;
+        } else {
+            uv_cond_wait(&work->wake, &work->lock);
+        }
+    }
+    uv_mutex_unlock(&work->lock);
+
+    if (L) {
+        lua_close(L);
+    }
+}
+
+static int precompile_thread_count(void) {
+    uv_cpu_info_t *cpus;
+    int count = 0;
+    if (uv_cpu_info(&cpus, &count) == 0) {
+        uv_free_cpu_info(cpus, count);
+    }
+    return count > 0 ? count : 1;
+}
+
+int reflex_precompile(lua_State *L, const char *entry) {
+    // Loading the bytecode again costs more than compiling on one core
+    int count = precompile_thread_count() - 1;
+    ReflexFileMap source;
+    if (count < 1 || reflex_file_map(entry, &source) != 0) {
+        return 0;
+    }
+
+    Precompile work;
+    memset(&work, 0, sizeof(work));
+    uv_mutex_init(&work.lock);
+    uv_cond_init(&work.wake);
+    if (source.data) {
+        reflex_scan_requires(source.data, source.length, precompile_on_require, &work);
+    }
+    reflex_file_unmap(&source);
+
+    // The calling thread works too, the others help with what is left
+    uv_thread_t *threads = work.count > 1 ? (uv_thread_t*)calloc((size_t)count, sizeof(uv_thread_t)) : NULL;
+    int started = 0;
+    while (threads && started < count && uv_thread_create(&threads[started], precompile_main, &work) == 0) {
+        started++;
+    }
+    precompile_main(&work);
+    for (int i = 0; i < started; i++) {
+        uv_thread_join(&threads[i]);
+    }
+    free(threads);
+
+    int compiled = 0;
+    for (size_t i = 0; i < work.count; i++) {
+        PrecompileModule *module = &work.modules[i];
+        if (module->code.length > 0) {
+            reflex_require_add_compiled(L, module->name, module->code.data, module->code.length);
+            compiled++;
+        }
+        serial_buffer_free(&module->code);
+        free(module->name);
+    }
+    free(work.modules);
+    uv_cond_destroy(&work.wake);
+    uv_mutex_destroy(&work.lock);
+    return compiled;
+}
@@ -6,6 +6,15 @@
 #include "require.h"
 #include "version.h"
 #include "apis/reflex_logger_api.h"
+#include "apis/timer_api.h"
+#include "apis/async_api.h"
+#include "apis/fs_api.h"
+#include "apis/tcp_api.h"
+#include "apis/http_api.h"
+#include "apis/channel_api.h"
+#include "apis/worker_api.h"
+#include "apis/parallel_api.h"
+#include "output.h"
 
 // Get environment variable
 int env_get(lua_State *L) {
@@ -55,6 +64,15 @@ void define_reflex_builtin(LuaAPI *api) {
     register_reflex_metadata(api);
     register_environment_helper(api);
     define_process_api(api);
+    define_timer_api(api);
+    define_async_api(api);
+    define_fs_api(api);
+    define_tcp_api(api);
+    define_http_api(api);
+    define_channel_api(api);
+    define_worker_api(api);
+    define_parallel_api(api);
     reflex_require_init(api);
+    reflex_output_init(api);
     define_logger_api(api);
 }
\ No newline at end of file
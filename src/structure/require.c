@@ -1,68 +1,702 @@
 #include "require.h"
-#include "fs.h"
+#include "bytecode_cache.h"
+#include "bundle.h"
+#include "reflex_module.h"
+#include "logger.h"
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h> // For getcwd()
 
 #define DEFAULT_PACKAGE_PATH "./reflex_deps/?.lua"
+#define REQUIRE_WATCH_KEY "reflex.require.watch"
+#define REQUIRE_WATCHED_KEY "reflex.require.watched"
+#define REQUIRE_CHANGED_KEY "reflex.require.changed"
+#define REQUIRE_RELOAD_DELAY 50
+#ifdef _WIN32
+#define NATIVE_MODULE_SUFFIX ".dll"
+#else
+#define NATIVE_MODULE_SUFFIX ".so"
+#endif
+
+typedef struct {
+    ReflexHandle base;
+    uv_timer_t timer;      // Debounces the events of one save
+    lua_State *L;
+    int reload;            // Reload changed modules, not only forget their paths
+} RequireWatch;
+
+// One directory a module was found in. Its uservalue maps the file names
+// in it to the modules they were required as.
+typedef struct {
+    ReflexHandle base;
+    uv_fs_event_t event;
+    RequireWatch *watch;
+    int package_dir;       // Any `name.lua` in it is module `name`
+    char path[512];
+} RequireDirWatch;
+
+static void require_watch_file(lua_State *L, const char *name, const char *path);
 
 static char package_path[512];
+static char package_dir[512];   // Directory the loader looks in
 
 void reflex_set_package_path(const char *path) {
     snprintf(package_path, sizeof(package_path), "%s/reflex_deps/?.lua", path);
+    snprintf(package_dir, sizeof(package_dir), "%s/reflex_deps", path);
 }
 
-// Custom package loader function
-int reflex_package_loader(lua_State *L) {
-    const char *package_name = get_as_string(L, 1);
-    if (!package_name) {
-        lua_pushnil(L);
-        lua_pushstring(L, "Invalid package name");
-        return 2;
+// The directories default to reflex_deps in the working directory
+static void package_path_init(void) {
+    char cwd[256];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        reflex_set_package_path(cwd);
+    } else {
+        snprintf(package_path, sizeof(package_path), DEFAULT_PACKAGE_PATH);
+        snprintf(package_dir, sizeof(package_dir), "./reflex_deps");
     }
+}
 
-    char file_path[512];
-    snprintf(file_path, sizeof(file_path), "%s/%s.lua", package_path, package_name);
+static int module_file_path(const char *name, const char *suffix, char *path, size_t size) {
+    if (!package_dir[0]) {
+        package_path_init();
+    }
+    int length = snprintf(path, size, "%s/%s%s", package_dir, name, suffix);
+    return length > 0 && (size_t)length < size ? 0 : -1;
+}
 
-    char *script = fs_read(file_path);
-    if (!script) {
-        lua_pushnil(L);
-        lua_pushfstring(L, "Module '%s' not found in Reflex path: %s", package_name, file_path);
-        return 2;
+int reflex_module_path(const char *name, char *path, size_t size) {
+    return module_file_path(name, ".lua", path, size);
+}
+
+// Level of the long bracket opening at s[i], e.g. 1 for "[=[", or -1
+static int long_bracket_level(const char *s, size_t n, size_t i) {
+    if (s[i] != '[') {
+        return -1;
+    }
+    size_t j = i + 1;
+    while (j < n && s[j] == '=') {
+        j++;
+    }
+    return j < n && s[j] == '[' ? (int)(j - i - 1) : -1;
+}
+
+static size_t skip_long_bracket(const char *s, size_t n, size_t i, int level) {
+    i += (size_t)level + 2;
+    while (i < n) {
+        if (s[i] != ']') {
+            i++;
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < n && s[j] == '=') {
+            j++;
+        }
+        if ((int)(j - i - 1) == level && j < n && s[j] == ']') {
+            return j + 1;
+        }
+        i = j;
     }
+    return n;
+}
 
-    if (luaL_loadstring(L, script) || lua_pcall(L, 0, 1, 0)) {
-        const char *error_msg = lua_tostring(L, -1);
+static size_t skip_string(const char *s, size_t n, size_t i) {
+    char quote = s[i++];
+    while (i < n && s[i] != quote && s[i] != '\n') {
+        i += s[i] == '\\' ? 2 : 1;
+    }
+    return i + 1;
+}
+
+static size_t skip_space(const char *s, size_t n, size_t i) {
+    while (i < n && isspace((unsigned char)s[i])) {
+        i++;
+    }
+    return i;
+}
+
+// Reports the literal after `require` ending at s[i], returns where to go on
+static size_t scan_require_call(const char *s, size_t n, size_t i, RequireFound found, void *data) {
+    size_t j = skip_space(s, n, i);
+    int paren = j < n && s[j] == '(';
+    if (paren) {
+        j = skip_space(s, n, j + 1);
+    }
+    if (j >= n || (s[j] != '"' && s[j] != '\'')) {
+        return i;
+    }
+
+    size_t end = j + 1;
+    while (end < n && s[end] != s[j] && s[end] != '\\' && s[end] != '\n') {
+        end++;
+    }
+    if (end >= n || s[end] != s[j]) {
+        return i;
+    }
+
+    size_t close = skip_space(s, n, end + 1);
+    if (!paren || (close < n && s[close] == ')')) {
+        found(s + j + 1, end - j - 1, data);
+    }
+    return end + 1;
+}
+
+void reflex_scan_requires(const char *s, size_t n, RequireFound found, void *data) {
+    size_t i = 0;
+    while (i < n) {
+        char c = s[i];
+        if (c == '-' && i + 1 < n && s[i + 1] == '-') {
+            i += 2;
+            int level = i < n ? long_bracket_level(s, n, i) : -1;
+            if (level >= 0) {
+                i = skip_long_bracket(s, n, i, level);
+            } else {
+                while (i < n && s[i] != '\n') {
+                    i++;
+                }
+            }
+        } else if (c == '"' || c == '\'') {
+            i = skip_string(s, n, i);
+        } else if (c == '[') {
+            int level = long_bracket_level(s, n, i);
+            i = level >= 0 ? skip_long_bracket(s, n, i, level) : i + 1;
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            size_t start = i;
+            while (i < n && (isalnum((unsigned char)s[i]) || s[i] == '_')) {
+                i++;
+            }
+            // Fields and methods named require are not the global
+            int is_field = start > 0 && (s[start - 1] == '.' || s[start - 1] == ':');
+            if (i - start == 7 && memcmp(s + start, "require", 7) == 0 && !is_field) {
+                i = scan_require_call(s, n, i, found, data);
+            }
+        } else {
+            i++;
+        }
+    }
+}
+
+// Pushes the resolution cache: {resolved = {[name] = path or searcher},
+// missing = {[name] = message}} with the package.path and package.cpath it
+// was built for. A new one replaces it when either of them changed.
+static void require_cache_push(lua_State *L) {
+    static const char *paths[] = {"path", "cpath"};
+
+    lua_getglobal(L, "package");
+    int package = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY);
+
+    int fresh = lua_istable(L, -1);
+    for (int i = 0; i < 2 && fresh; i++) {
+        lua_getfield(L, package, paths[i]);
+        lua_getfield(L, -2, paths[i]);
+        fresh = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+    }
+
+    if (!fresh) {
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 4);
+        lua_newtable(L);
+        lua_setfield(L, -2, "resolved");
+        lua_newtable(L);
+        lua_setfield(L, -2, "missing");
+        for (int i = 0; i < 2; i++) {
+            lua_getfield(L, package, paths[i]);
+            lua_setfield(L, -2, paths[i]);
+        }
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY);
+    }
+    lua_remove(L, package);
+}
+
+void reflex_require_invalidate(lua_State *L, const char *name) {
+    if (!name) {
         lua_pushnil(L);
-        lua_pushstring(L, error_msg);
-        free(script);
-        return 2;
+        lua_setfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY);
+        return;
+    }
+
+    if (lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY) == LUA_TTABLE) {
+        static const char *tables[] = {"resolved", "missing"};
+        for (int i = 0; i < 2; i++) {
+            lua_getfield(L, -1, tables[i]);
+            lua_pushnil(L);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+}
+
+// Runs the module's reflex_module_init, kept in upvalue 1
+static int native_init(lua_State *L) {
+    ReflexModuleInit init = *(ReflexModuleInit*)lua_touserdata(L, lua_upvalueindex(1));
+
+    int top = lua_gettop(L);
+    int count = init(reflex_get_api(L));
+    if (count < 0) {
+        return luaL_error(L, "module '%s' failed to initialize", lua_tostring(L, 1));
+    }
+    return lua_gettop(L) - top < count ? lua_gettop(L) - top : count;
+}
+
+static int native_loader(lua_State *L) {
+    // The module gets the state's own LuaAPI, which it may keep. The
+    // helpers in lua_api.h work on api->L, so that is the requiring thread
+    // until the init returns or raises.
+    LuaAPI *api = reflex_get_api(L);
+    lua_State *main_thread = api->L;
+    api->L = L;
+
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, native_init, 1);
+    lua_insert(L, 1);
+    int status = lua_pcall(L, lua_gettop(L) - 1, LUA_MULTRET, 0);
+    api->L = main_thread;
+    if (status != LUA_OK) {
+        return lua_error(L);
+    }
+    return lua_gettop(L);
+}
+
+// Pushes a loader for the shared object at `path` and the path, returns 2,
+// or 0 with nothing pushed when there is no such file. The library stays
+// loaded for good, its functions may be referenced from anywhere.
+static int package_load_native(lua_State *L, const char *name, const char *path) {
+    if (access(path, F_OK) != 0) {
+        return 0;
+    }
+
+    uv_lib_t library;
+    if (uv_dlopen(path, &library) != 0) {
+        // The message belongs to the library, it is copied before closing
+        lua_pushfstring(L, "error loading module '%s' from file '%s':\n\t%s", name, path, uv_dlerror(&library));
+        uv_dlclose(&library);
+        return lua_error(L);
+    }
+
+    const int *abi = NULL;
+    ReflexModuleInit init = NULL;
+    if (uv_dlsym(&library, "reflex_module_abi", (void**)&abi) != 0 ||
+        uv_dlsym(&library, "reflex_module_init", (void**)&init) != 0) {
+        uv_dlclose(&library);
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\tno entry point, "
+            "define it with REFLEX_MODULE_INIT", name, path);
+    }
+    if (*abi != REFLEX_MODULE_ABI) {
+        int version = *abi;
+        uv_dlclose(&library);
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\tbuilt for module ABI %d, "
+            "this runtime has %d", name, path, version, REFLEX_MODULE_ABI);
     }
 
+    ReflexModuleInit *slot = (ReflexModuleInit*)lua_newuserdatauv(L, sizeof(ReflexModuleInit), 0);
+    *slot = init;
+    lua_pushcclosure(L, native_loader, 1);
+    lua_pushstring(L, path);
+    return 2;
+}
+
+// Pushes the chunk at `path` and the path for the loader, returns 2, or 0
+// with nothing pushed when there is no such file
+static int package_load(lua_State *L, const char *name, const char *path) {
+    size_t length = strlen(path);
+    size_t suffix = strlen(NATIVE_MODULE_SUFFIX);
+    if (length > suffix && strcmp(path + length - suffix, NATIVE_MODULE_SUFFIX) == 0) {
+        return package_load_native(L, name, path);
+    }
+
+    int status = reflex_load_cached(L, path, path);
+    if (status == LUA_ERRFILE) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    if (status != LUA_OK) {
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, path, lua_tostring(L, -1));
+    }
+    lua_pushstring(L, path);
+    return 2;
+}
+
+void reflex_require_add_compiled(lua_State *L, const char *name, const char *code, size_t length) {
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, REQUIRE_COMPILED_KEY);
+    lua_pushlstring(L, code, length);
+    lua_setfield(L, -2, name);
+    lua_pop(L, 1);
+}
+
+// Pushes the precompiled chunk of `name` and its path, returns 2 or 0. The
+// bytecode is used once, requiring the module again reads the file.
+static int package_load_compiled(lua_State *L, const char *name) {
+    if (lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_COMPILED_KEY) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    if (lua_getfield(L, -1, name) != LUA_TSTRING) {
+        lua_pop(L, 2);
+        return 0;
+    }
+
+    char path[512];
+    size_t length;
+    const char *code = lua_tolstring(L, -1, &length);
+    int status = reflex_module_path(name, path, sizeof(path)) == 0 ?
+        luaL_loadbufferx(L, code, length, path, "b") : LUA_ERRFILE;
+    lua_pushnil(L);
+    lua_setfield(L, -4, name);
+    if (status != LUA_OK) {
+        lua_pop(L, 3);
+        return 0;
+    }
+
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    lua_pushstring(L, path);
+    return 2;
+}
+
+// Searcher for everything on disk: Lua then native modules in reflex_deps,
+// then the stock Lua and C searchers kept in upvalue 1. Where a module was found, and that it
+// was not, is remembered so requiring the name again skips the search.
+static int package_searcher(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    int compiled = package_load_compiled(L, name);
+    if (compiled) {
+        return compiled;
+    }
+
+    require_cache_push(L);
+    lua_getfield(L, -1, "resolved");
+    int resolved = lua_gettop(L);
+    lua_getfield(L, -2, "missing");
+    int missing = lua_gettop(L);
+
+    if (lua_getfield(L, missing, name) == LUA_TSTRING) {
+        return 1;
+    }
+
+    // A file that is gone or a searcher that no longer finds it is searched again
+    int type = lua_getfield(L, resolved, name);
+    if (type == LUA_TSTRING) {
+        int found = package_load(L, name, lua_tostring(L, -1));
+        if (found) {
+            return found;
+        }
+    } else if (type == LUA_TNUMBER) {
+        lua_rawgeti(L, lua_upvalueindex(1), lua_tointeger(L, -1));
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 2);
+        if (lua_isfunction(L, -2)) {
+            return 2;
+        }
+    }
+    lua_settop(L, missing);
+
+    // Lua modules win over native ones of the same name
+    static const char *suffixes[] = {".lua", NATIVE_MODULE_SUFFIX};
+    for (int i = 0; i < 2; i++) {
+        char path[512];
+        if (module_file_path(name, suffixes[i], path, sizeof(path)) == 0) {
+            int found = package_load(L, name, path);
+            if (found) {
+                lua_pushstring(L, path);
+                lua_setfield(L, resolved, name);
+                require_watch_file(L, name, path);
+                return found;
+            }
+        }
+    }
+
+    // Collects the messages like require does, one line per searcher
+    int count = (int)lua_rawlen(L, lua_upvalueindex(1));
+    int parts = 0;
+    for (int i = 1; i <= count; i++) {
+        lua_rawgeti(L, lua_upvalueindex(1), i);
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 2);
+
+        if (lua_isfunction(L, -2)) {
+            // The Lua searcher names the file it found, the C ones are asked again
+            if (i == 1 && lua_type(L, -1) == LUA_TSTRING) {
+                require_watch_file(L, name, lua_tostring(L, -1));
+                lua_pushvalue(L, -1);
+            } else {
+                lua_pushinteger(L, i);
+            }
+            lua_setfield(L, resolved, name);
+            return 2;
+        }
+
+        lua_pop(L, 1);
+        if (lua_isstring(L, -1)) {
+            if (parts++ > 0) {
+                lua_pushliteral(L, "\n\t");
+                lua_insert(L, -2);
+                parts++;
+            }
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    // package.path already names reflex_deps for Lua modules
+    char native_path[512];
+    if (module_file_path(name, NATIVE_MODULE_SUFFIX, native_path, sizeof(native_path)) == 0) {
+        lua_pushfstring(L, parts > 0 ? "\n\tno file '%s'" : "no file '%s'", native_path);
+        parts++;
+    }
+
+    lua_concat(L, parts);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, missing, name);
+    return 1;
+}
+
+// reflex.modules.invalidate(name), forgets where the module was found, or
+// every module without a name
+static int modules_invalidate(lua_State *L) {
+    reflex_require_invalidate(L, luaL_optstring(L, 1, NULL));
+    return 0;
+}
+
+// Takes the module out of package.loaded, requires it again and runs the
+// new module's __reload hook. The old module is put back on any error.
+static int require_reload_protected(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
     lua_getglobal(L, "package");
     lua_getfield(L, -1, "loaded");
+    int loaded = lua_gettop(L);
+    lua_getfield(L, loaded, name);
+    int old = lua_gettop(L);
+
+    lua_pushnil(L);
+    lua_setfield(L, loaded, name);
+    reflex_require_invalidate(L, name);
+
+    lua_getglobal(L, "require");
     lua_pushvalue(L, 1);
-    lua_pushvalue(L, -4);
-    lua_settable(L, -3);
+    int status = lua_pcall(L, 1, 1, 0);
+    if (status == LUA_OK && lua_istable(L, -1)) {
+        if (lua_getfield(L, -1, "__reload") == LUA_TFUNCTION) {
+            lua_pushvalue(L, old);
+            status = lua_pcall(L, 1, 0, 0);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    if (status != LUA_OK) {
+        lua_pushvalue(L, old);
+        lua_setfield(L, loaded, name);
+        return lua_error(L);
+    }
+    return 1;
+}
+
+int reflex_require_reload(lua_State *L, const char *name) {
+    lua_pushcfunction(L, require_reload_protected);
+    lua_pushstring(L, name);
+    return lua_pcall(L, 1, 1, 0);
+}
 
+// reflex.modules.reload(name), returns the new module
+static int modules_reload(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    if (reflex_require_reload(L, name) != LUA_OK) {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+// Reloads the changed modules once the events of a save have settled
+static void require_on_settled(uv_timer_t *timer) {
+    RequireWatch *watch = (RequireWatch*)timer->data;
+    lua_State *L = watch->L;
+
+    if (lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_CHANGED_KEY) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, REQUIRE_CHANGED_KEY);
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        lua_pop(L, 1);
+        const char *name = lua_tostring(L, -1);
+        if (reflex_require_reload(L, name) != LUA_OK) {
+            fcoloredlog(stderr, COLOR_YELLOW, "Reloading module '%s' failed, keeping the old one: %s",
+                name, lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+// Pushes the module `filename` in the watched directory was required as,
+// or nil
+static void require_changed_module(lua_State *L, RequireDirWatch *dir, const char *filename) {
+    lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_WATCHED_KEY);
+    lua_getfield(L, -1, dir->path);
+    lua_getiuservalue(L, -1, 1);
+    if (lua_getfield(L, -1, filename) == LUA_TNIL && dir->package_dir) {
+        lua_pop(L, 1);
+        lua_pushlstring(L, filename, strlen(filename) - 4);
+    }
+    lua_replace(L, -4);
     lua_pop(L, 2);
+}
 
-    free(script);
+static void require_on_change(uv_fs_event_t *handle, const char *filename, int events, int status) {
+    (void)events;
+    RequireDirWatch *dir = (RequireDirWatch*)handle->data;
+    RequireWatch *watch = dir->watch;
+    if (status != 0) {
+        return;
+    }
+
+    lua_State *L = watch->L;
+    reflex_require_invalidate(L, NULL);
+
+    // Only loaded modules are reloaded, editors also touch backup and swap files
+    size_t length = filename ? strlen(filename) : 0;
+    if (!watch->reload || length <= 4 || strcmp(filename + length - 4, ".lua") != 0) {
+        return;
+    }
+    require_changed_module(L, dir, filename);
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaded");
+    lua_pushvalue(L, -3);
+    int is_loaded = lua_isstring(L, -1) && lua_rawget(L, -2) != LUA_TNIL;
+    lua_pop(L, 3);
+    if (!is_loaded) {
+        lua_pop(L, 1);
+        return;
+    }
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, REQUIRE_CHANGED_KEY);
+    lua_insert(L, -2);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    uv_timer_start(&watch->timer, require_on_settled, REQUIRE_RELOAD_DELAY, 0);
+}
+
+// Watches the directory at `path` once watching is on, pushes its watch
+// and returns 1, or 0 with nothing pushed
+static int require_watch_dir(lua_State *L, const char *path, size_t length, int package_dir) {
+    if (lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_WATCH_KEY) != LUA_TUSERDATA || length == 0) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    RequireWatch *watch = (RequireWatch*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, REQUIRE_WATCHED_KEY);
+    lua_pushlstring(L, path, length);
+    if (lua_rawget(L, -2) == LUA_TUSERDATA) {
+        lua_remove(L, -2);
+        RequireDirWatch *dir = (RequireDirWatch*)lua_touserdata(L, -1);
+        if (uv_is_active((uv_handle_t*)&dir->event)) {
+            return 1;
+        }
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_pop(L, 1);
+
+    // Anchored in the registry like the watch itself, also when starting fails
+    RequireDirWatch *dir = (RequireDirWatch*)lua_newuserdatauv(L, sizeof(RequireDirWatch), 1);
+    memset(dir, 0, sizeof(RequireDirWatch));
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+    lua_pushlstring(L, path, length);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    lua_remove(L, -2);
+
+    dir->watch = watch;
+    dir->package_dir = package_dir;
+    snprintf(dir->path, sizeof(dir->path), "%.*s", (int)length, path);
+    uv_fs_event_init(reflex_get_api(L)->loop, &dir->event);
+    dir->event.data = dir;
+    if (uv_fs_event_start(&dir->event, require_on_change, dir->path, 0) != 0) {
+        uv_close((uv_handle_t*)&dir->event, NULL);
+        lua_pop(L, 1);
+        return 0;
+    }
+
+    // Watching alone never keeps the process alive
+    uv_unref((uv_handle_t*)&dir->event);
     return 1;
 }
 
-void reflex_require_init(LuaAPI *api) {
+// Watches the directory of a module file found for `name`
+static void require_watch_file(lua_State *L, const char *name, const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *filename = slash ? slash + 1 : path;
+    if (!require_watch_dir(L, slash ? path : ".", slash ? (size_t)(slash - path) : 1, 0)) {
+        return;
+    }
+
+    lua_getiuservalue(L, -1, 1);
+    lua_pushstring(L, name);
+    lua_setfield(L, -2, filename);
+    lua_pop(L, 2);
+}
+
+int reflex_require_watch(LuaAPI *api, int reload) {
     lua_State *L = api->L;
+    if (lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_WATCH_KEY) != LUA_TNIL) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_pop(L, 1);
 
-    // Get current working directory
-    char cwd[256];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        snprintf(package_path, sizeof(package_path), "%s/reflex_deps/?.lua", cwd);
-    } else {
-        snprintf(package_path, sizeof(package_path), DEFAULT_PACKAGE_PATH);
+    if (!package_dir[0]) {
+        package_path_init();
     }
 
+    // Anchored in the registry so the handles outlive their close, the
+    // loop closes them with the state
+    RequireWatch *watch = (RequireWatch*)lua_newuserdatauv(L, sizeof(RequireWatch), 0);
+    lua_setfield(L, LUA_REGISTRYINDEX, REQUIRE_WATCH_KEY);
+    watch->base.close = NULL;
+    watch->L = L;
+    watch->reload = reload;
+    uv_timer_init(api->loop, &watch->timer);
+    watch->timer.data = watch;
+    uv_unref((uv_handle_t*)&watch->timer);
+
+    // reflex_deps itself, then every other directory a module was found in
+    // so far. Modules found later add theirs as they are resolved.
+    int status = UV_ENOENT;
+    if (require_watch_dir(L, package_dir, strlen(package_dir), 1)) {
+        lua_pop(L, 1);
+        status = 0;
+    }
+    require_cache_push(L);
+    lua_getfield(L, -1, "resolved");
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        if (lua_type(L, -1) == LUA_TSTRING && lua_type(L, -2) == LUA_TSTRING) {
+            require_watch_file(L, lua_tostring(L, -2), lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+    return status;
+}
+
+void reflex_require_init(LuaAPI *api) {
+    lua_State *L = api->L;
+
+    package_path_init();
+
     // Get package table
     lua_getglobal(L, "package");
 
@@ -78,16 +712,23 @@ void reflex_require_init(LuaAPI *api) {
     // Get package.searchers (or package.loaders in Lua 5.1)
     lua_getfield(L, -1, "searchers");
     if (lua_istable(L, -1)) {
-        int n = lua_rawlen(L, -1);
-        
-        // Move existing searchers up and insert Reflex loader at index 2
-        for (int i = n; i >= 2; i--) {
-            lua_rawgeti(L, -1, i);
-            lua_rawseti(L, -2, i + 1);
+        int searchers = lua_gettop(L);
+        int n = (int)lua_rawlen(L, searchers);
+
+        // The file searchers after package.preload move behind the Reflex
+        // searcher, which caches what they find
+        lua_createtable(L, n > 1 ? n - 1 : 0, 0);
+        for (int i = 2; i <= n; i++) {
+            lua_rawgeti(L, searchers, i);
+            lua_rawseti(L, -2, i - 1);
+            lua_pushnil(L);
+            lua_rawseti(L, searchers, i);
         }
+        lua_pushcclosure(L, package_searcher, 1);
+        lua_rawseti(L, searchers, 2);
 
-        lua_pushcfunction(L, reflex_package_loader);
-        lua_rawseti(L, -2, 2);
+        // Modules bundled into the executable come before any file
+        reflex_bundle_install_searcher(L, searchers);
     }
 
     lua_pop(L, 2);
@@ -96,4 +737,8 @@ void reflex_require_init(LuaAPI *api) {
     lua_getglobal(L, "package");
     lua_getfield(L, -1, "path");
     lua_pop(L, 2);
+
+    reflex_register_table_field(api, "reflex", "modules", REFLEX_TYPE_TABLE);
+    reflex_register_table_field(api, "reflex.modules", "invalidate", REFLEX_TYPE_FUNCTION, modules_invalidate);
+    reflex_register_table_field(api, "reflex.modules", "reload", REFLEX_TYPE_FUNCTION, modules_reload);
 }
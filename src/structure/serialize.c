@@ -0,0 +1,273 @@
+#include "serialize.h"
+#include "buffer.h"
+#include "apis/channel_api.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIAL_MAX_DEPTH 100
+
+enum {
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INTEGER,
+    TAG_NUMBER,
+    TAG_STRING,
+    TAG_TABLE,
+    TAG_END,     // Closes a table
+    TAG_CHANNEL  // Pointer to a channel, the data holds a reference on it
+};
+
+void serial_buffer_init(SerialBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->channels = 0;
+    buffer->error[0] = '\0';
+}
+
+void serial_buffer_free(SerialBuffer *buffer) {
+    free(buffer->data);
+    serial_buffer_init(buffer);
+}
+
+int serial_buffer_append(SerialBuffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *grown = (char*)realloc(buffer->data, capacity);
+        if (!grown) {
+            snprintf(buffer->error, sizeof(buffer->error), "not enough memory");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+static int serial_tag(SerialBuffer *buffer, uint8_t tag) {
+    return serial_buffer_append(buffer, &tag, 1);
+}
+
+static int serial_bytes(SerialBuffer *buffer, const char *data, size_t length) {
+    uint64_t size = (uint64_t)length;
+    if (serial_tag(buffer, TAG_STRING) != 0 || serial_buffer_append(buffer, &size, sizeof(size)) != 0) {
+        return -1;
+    }
+    return serial_buffer_append(buffer, data, length);
+}
+
+static int serial_value(lua_State *L, int index, SerialBuffer *buffer, int depth) {
+    switch (lua_type(L, index)) {
+        case LUA_TNIL:
+            return serial_tag(buffer, TAG_NIL);
+        case LUA_TBOOLEAN:
+            return serial_tag(buffer, lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index)) {
+                lua_Integer value = lua_tointeger(L, index);
+                if (serial_tag(buffer, TAG_INTEGER) != 0) return -1;
+                return serial_buffer_append(buffer, &value, sizeof(value));
+            } else {
+                lua_Number value = lua_tonumber(L, index);
+                if (serial_tag(buffer, TAG_NUMBER) != 0) return -1;
+                return serial_buffer_append(buffer, &value, sizeof(value));
+            }
+        case LUA_TSTRING: {
+            size_t length;
+            const char *data = lua_tolstring(L, index, &length);
+            return serial_bytes(buffer, data, length);
+        }
+        case LUA_TTABLE: {
+            if (depth >= SERIAL_MAX_DEPTH || !lua_checkstack(L, 3)) {
+                snprintf(buffer->error, sizeof(buffer->error), "table nesting is too deep (cycles cannot be sent)");
+                return -1;
+            }
+            if (serial_tag(buffer, TAG_TABLE) != 0) {
+                return -1;
+            }
+
+            index = lua_absindex(L, index);
+            lua_pushnil(L);
+            while (lua_next(L, index)) {
+                int top = lua_gettop(L);
+                if (serial_value(L, top - 1, buffer, depth + 1) != 0 || serial_value(L, top, buffer, depth + 1) != 0) {
+                    lua_pop(L, 2);
+                    return -1;
+                }
+                lua_pop(L, 1);
+            }
+            return serial_tag(buffer, TAG_END);
+        }
+        case LUA_TUSERDATA: {
+            BufferChunk *chunk = buffer_test(L, index);
+            if (chunk) {
+                return serial_bytes(buffer, chunk->data, chunk->length);
+            }
+
+            // Channels are shared, not copied
+            ReflexChannel *channel = reflex_channel_test(L, index);
+            if (channel) {
+                if (serial_tag(buffer, TAG_CHANNEL) != 0 || serial_buffer_append(buffer, &channel, sizeof(channel)) != 0) {
+                    return -1;
+                }
+                reflex_channel_retain(channel);
+                buffer->channels++;
+                return 0;
+            }
+        }
+        // fallthrough
+        default:
+            snprintf(buffer->error, sizeof(buffer->error), "cannot send a %s value", luaL_typename(L, index));
+            return -1;
+    }
+}
+
+int reflex_serialize(lua_State *L, int first, int last, SerialBuffer *buffer) {
+    for (int i = first; i <= last; i++) {
+        if (serial_value(L, i, buffer, 0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t offset;
+} SerialReader;
+
+static int serial_read(SerialReader *reader, void *out, size_t length) {
+    if (reader->length - reader->offset < length) {
+        return -1;
+    }
+    memcpy(out, reader->data + reader->offset, length);
+    reader->offset += length;
+    return 0;
+}
+
+// Pushes the next value, returns its tag or -1
+static int deserial_value(lua_State *L, SerialReader *reader, int depth) {
+    uint8_t tag;
+    if (serial_read(reader, &tag, 1) != 0) {
+        return -1;
+    }
+
+    switch (tag) {
+        case TAG_NIL:
+            lua_pushnil(L);
+            return tag;
+        case TAG_FALSE:
+        case TAG_TRUE:
+            lua_pushboolean(L, tag == TAG_TRUE);
+            return tag;
+        case TAG_INTEGER: {
+            lua_Integer value;
+            if (serial_read(reader, &value, sizeof(value)) != 0) return -1;
+            lua_pushinteger(L, value);
+            return tag;
+        }
+        case TAG_NUMBER: {
+            lua_Number value;
+            if (serial_read(reader, &value, sizeof(value)) != 0) return -1;
+            lua_pushnumber(L, value);
+            return tag;
+        }
+        case TAG_STRING: {
+            uint64_t length;
+            if (serial_read(reader, &length, sizeof(length)) != 0 || reader->length - reader->offset < length) {
+                return -1;
+            }
+            lua_pushlstring(L, reader->data + reader->offset, (size_t)length);
+            reader->offset += (size_t)length;
+            return tag;
+        }
+        case TAG_TABLE: {
+            if (depth >= SERIAL_MAX_DEPTH || !lua_checkstack(L, 3)) {
+                return -1;
+            }
+            lua_newtable(L);
+            while (1) {
+                int key = deserial_value(L, reader, depth + 1);
+                if (key == TAG_END) {
+                    lua_pop(L, 1);
+                    return tag;
+                }
+                if (key < 0 || key == TAG_NIL) {
+                    return -1;
+                }
+                int value = deserial_value(L, reader, depth + 1);
+                if (value < 0 || value == TAG_END) {
+                    return -1;
+                }
+                lua_rawset(L, -3);
+            }
+        }
+        case TAG_CHANNEL: {
+            ReflexChannel *channel;
+            if (serial_read(reader, &channel, sizeof(channel)) != 0) return -1;
+            reflex_channel_push(L, channel);
+            return tag;
+        }
+        case TAG_END:
+            lua_pushnil(L); // Keeps the stack shape for the caller to pop
+            return tag;
+        default:
+            return -1;
+    }
+}
+
+void serial_release_channels(const char *data, size_t length) {
+    SerialReader reader = { data, length, 0 };
+    uint8_t tag;
+
+    // Values are written in sequence, tables only add their tags around them
+    while (serial_read(&reader, &tag, 1) == 0) {
+        size_t skip = 0;
+        if (tag == TAG_INTEGER) {
+            skip = sizeof(lua_Integer);
+        } else if (tag == TAG_NUMBER) {
+            skip = sizeof(lua_Number);
+        } else if (tag == TAG_STRING) {
+            uint64_t size;
+            if (serial_read(&reader, &size, sizeof(size)) != 0) {
+                return;
+            }
+            skip = (size_t)size;
+        } else if (tag == TAG_CHANNEL) {
+            ReflexChannel *channel;
+            if (serial_read(&reader, &channel, sizeof(channel)) != 0) {
+                return;
+            }
+            reflex_channel_release(channel);
+        }
+        if (reader.length - reader.offset < skip) {
+            return;
+        }
+        reader.offset += skip;
+    }
+}
+
+int reflex_deserialize(lua_State *L, const char *data, size_t length) {
+    SerialReader reader = { data, length, 0 };
+    int top = lua_gettop(L);
+    int count = 0;
+
+    while (reader.offset < reader.length) {
+        int tag = lua_checkstack(L, 1) ? deserial_value(L, &reader, 0) : -1;
+        if (tag < 0 || tag == TAG_END) {
+            lua_settop(L, top);
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,207 @@
+#include "state_pool.h"
+#include "reflex_api.h"
+#include "require.h"
+#include "apis/reflex_logger_api.h"
+#include <stdlib.h>
+
+#define STATE_POOL_SNAPSHOT "reflex.pool.snapshot"
+#define STATE_POOL_REGISTRY "reflex.pool.registry"
+
+// Registry entries a unit of work changes that are not reachable from the
+// globals, restored along with them
+static const char *registry_keys[] = {
+    LOGGER_LEVEL_KEY,
+    REQUIRE_CACHE_KEY,
+    REQUIRE_COMPILED_KEY,
+};
+#define REGISTRY_KEY_COUNT (sizeof(registry_keys) / sizeof(registry_keys[0]))
+
+struct ReflexStatePool {
+    uv_mutex_t lock;
+    LuaAPI **idle;
+    int count;
+    int size;
+};
+
+// Records the entries and metatable of the table on top, and of every table
+// reachable from it, as snapshot[table] = { entries, metatable }
+static void snapshot_table(lua_State *L, int snapshot) {
+    int table = lua_gettop(L);
+    lua_pushvalue(L, table);
+    if (lua_rawget(L, snapshot) != LUA_TNIL) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pop(L, 1);
+
+    lua_createtable(L, 2, 0);
+    int record = lua_gettop(L);
+    lua_newtable(L);
+    int entries = lua_gettop(L);
+    lua_pushvalue(L, entries);
+    lua_rawseti(L, record, 1);
+    if (lua_getmetatable(L, table)) {
+        lua_rawseti(L, record, 2);
+    }
+    lua_pushvalue(L, table);
+    lua_pushvalue(L, record);
+    lua_rawset(L, snapshot);
+
+    lua_pushnil(L);
+    while (lua_next(L, table)) {
+        lua_pushvalue(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, entries);
+        if (lua_type(L, -1) == LUA_TTABLE && lua_checkstack(L, 8)) {
+            snapshot_table(L, snapshot);
+        }
+        lua_pop(L, 1);
+    }
+    lua_settop(L, table);
+}
+
+static void snapshot_take(lua_State *L) {
+    lua_newtable(L);
+    int snapshot = lua_gettop(L);
+    lua_pushglobaltable(L);
+    snapshot_table(L, snapshot);
+    lua_pop(L, 1);
+
+    lua_createtable(L, 0, REGISTRY_KEY_COUNT);
+    int registry = lua_gettop(L);
+    for (size_t i = 0; i < REGISTRY_KEY_COUNT; i++) {
+        if (lua_getfield(L, LUA_REGISTRYINDEX, registry_keys[i]) == LUA_TTABLE) {
+            snapshot_table(L, snapshot);
+        }
+        lua_setfield(L, registry, registry_keys[i]);
+    }
+    lua_setfield(L, LUA_REGISTRYINDEX, STATE_POOL_REGISTRY);
+    lua_setfield(L, LUA_REGISTRYINDEX, STATE_POOL_SNAPSHOT);
+}
+
+static void snapshot_restore(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, STATE_POOL_SNAPSHOT);
+    int snapshot = lua_gettop(L);
+
+    lua_pushnil(L);
+    while (lua_next(L, snapshot)) {
+        int record = lua_gettop(L);
+        int table = record - 1;
+        lua_rawgeti(L, record, 1);
+        int entries = lua_gettop(L);
+
+        // Clearing fields while traversing is allowed, adding is not
+        lua_pushnil(L);
+        while (lua_next(L, table)) {
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            if (lua_rawget(L, entries) == LUA_TNIL) {
+                lua_pushvalue(L, -2);
+                lua_pushnil(L);
+                lua_rawset(L, table);
+            }
+            lua_pop(L, 1);
+        }
+
+        lua_pushnil(L);
+        while (lua_next(L, entries)) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, table);
+        }
+
+        lua_rawgeti(L, record, 2);
+        lua_setmetatable(L, table);
+        lua_settop(L, table);
+    }
+    lua_pop(L, 1);
+
+    // Keys that were unset in the snapshot are unset again
+    lua_getfield(L, LUA_REGISTRYINDEX, STATE_POOL_REGISTRY);
+    for (size_t i = 0; i < REGISTRY_KEY_COUNT; i++) {
+        lua_getfield(L, -1, registry_keys[i]);
+        lua_setfield(L, LUA_REGISTRYINDEX, registry_keys[i]);
+    }
+    lua_pop(L, 1);
+}
+
+static LuaAPI* state_new(void) {
+    LuaAPI *api = reflex_new();
+    if (!api) {
+        return NULL;
+    }
+    define_reflex_builtin(api);
+    snapshot_take(api->L);
+    return api;
+}
+
+ReflexStatePool* reflex_state_pool_new(int size) {
+    ReflexStatePool *pool = (ReflexStatePool*)calloc(1, sizeof(ReflexStatePool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->idle = (LuaAPI**)calloc(size > 0 ? (size_t)size : 1, sizeof(LuaAPI*));
+    if (!pool->idle) {
+        free(pool);
+        return NULL;
+    }
+    uv_mutex_init(&pool->lock);
+    pool->size = size;
+
+    while (pool->count < size) {
+        LuaAPI *api = state_new();
+        if (!api) {
+            break;
+        }
+        pool->idle[pool->count++] = api;
+    }
+    return pool;
+}
+
+void reflex_state_pool_free(ReflexStatePool *pool) {
+    if (!pool) {
+        return;
+    }
+    for (int i = 0; i < pool->count; i++) {
+        reflex_free(pool->idle[i]);
+    }
+    uv_mutex_destroy(&pool->lock);
+    free(pool->idle);
+    free(pool);
+}
+
+LuaAPI* reflex_state_pool_acquire(ReflexStatePool *pool) {
+    LuaAPI *api = NULL;
+    uv_mutex_lock(&pool->lock);
+    if (pool->count > 0) {
+        api = pool->idle[--pool->count];
+    }
+    uv_mutex_unlock(&pool->lock);
+    return api ? api : state_new();
+}
+
+void reflex_state_pool_release(ReflexStatePool *pool, LuaAPI *api) {
+    lua_State *L = api->L;
+
+    // Work already done gets its callbacks. A state still holding timers,
+    // servers, sockets or tasks would run them in the next user's globals,
+    // and waiting for them could take forever, so it is not kept.
+    uv_run(api->loop, UV_RUN_NOWAIT);
+    int reusable = !uv_loop_alive(api->loop);
+    if (reusable) {
+        api->loop_error = 0;
+        lua_settop(L, 0);
+        snapshot_restore(L);
+    }
+
+    uv_mutex_lock(&pool->lock);
+    if (reusable && pool->count < pool->size) {
+        pool->idle[pool->count++] = api;
+        api = NULL;
+    }
+    uv_mutex_unlock(&pool->lock);
+
+    if (api) {
+        reflex_free(api);
+    }
+}
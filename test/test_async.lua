@@ -0,0 +1,29 @@
+--[[
+
+    Testing the async runtime
+
+    > `reflex.async` runs a function as a task on the event loop
+    > Awaiting bindings such as `reflex.sleep` suspend the task without blocking the loop.
+
+]]
+
+reflex.async(function(name)
+    print(name .. ": started")
+    reflex.sleep(100)
+    print(name .. ": woke up after 100ms")
+end, "slow")
+
+reflex.async(function(name)
+    print(name .. ": started")
+    reflex.sleep(20)
+    print(name .. ": woke up after 20ms")
+
+    -- Plain yields hand control back to the loop for one iteration
+    coroutine.yield()
+    print(name .. ": resumed after yield")
+end, "fast")
+
+reflex.async(function()
+    local ok, err = pcall(reflex.sleep, "not a number")
+    print("Caught error: " .. tostring(not ok))
+end)
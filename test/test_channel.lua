@@ -0,0 +1,34 @@
+--[[
+
+    Testing the channel api
+
+    > A channel can be sent to other states and written to from all of
+    > them, but only one state receives from it.
+    > `channel:send` returns false when the channel is full or closed,
+    > and needs at least one value.
+
+]]
+
+local channel = reflex.channel.new(256)
+
+for id = 1, 3 do
+    reflex.worker.spawn("worker_producer.lua", channel, id, 50)
+end
+
+reflex.async(function()
+    local totals = { 0, 0, 0 }
+    for _ = 1, 150 do
+        local id, i = channel:receive()
+        totals[id] = totals[id] + i
+    end
+    print("Totals: " .. table.concat(totals, ", "))
+
+    channel:send("last")
+    channel:close()
+    print("Sent after close: " .. tostring(channel:send("too late")))
+    print("Received: " .. tostring(channel:receive()))
+    print("Closed: " .. tostring(channel:receive()))
+end)
+
+-- An empty message would read as the end of the channel
+print("Empty send: " .. tostring(pcall(channel.send, channel)))
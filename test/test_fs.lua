@@ -0,0 +1,37 @@
+--[[
+
+    Testing the filesystem api
+
+    > Inside `reflex.async` every `fs` call runs on the libuv threadpool
+    > and resumes the task when it completes. Outside a task it runs synchronously.
+    > The threadpool size can be set with `--threadpool-size <n>`.
+
+]]
+
+local path = "fs_test_output.txt"
+
+reflex.async(function()
+    fs.writeFile(path, "Hello from the threadpool!\n")
+    print("Read back: " .. fs.readFile(path))
+
+    local fd = fs.open(path, "a")
+    fs.write(fd, "Appended line\n")
+    fs.close(fd)
+
+    local info = fs.stat(path)
+    print("Size: " .. info.size .. ", is file: " .. tostring(info.isFile))
+
+    local listed = false
+    for _, name in ipairs(fs.readdir(".")) do
+        listed = listed or name == path
+    end
+    print("Listed in directory: " .. tostring(listed))
+
+    local ok, err = pcall(fs.readFile, "does_not_exist.txt")
+    print("Missing file: " .. tostring(err))
+
+    os.remove(path)
+end)
+
+-- Synchronous fallback outside of a task
+print("Sync stat of current directory: " .. tostring(fs.stat(".").isDirectory))
@@ -0,0 +1,40 @@
+--[[
+
+    Testing the http api
+
+    > Every request runs its handler as a task. Connections are kept alive
+    > and pipelined requests are answered in order.
+    > Headers are only read from the raw request when the handler asks.
+
+]]
+
+local server = reflex.http.createServer(function(req, res)
+    if req.path == "/slow" then
+        reflex.sleep(20)
+    end
+
+    res:setHeader("Content-Type", "text/plain")
+    res:send(req.method .. " " .. req.path .. " from " .. tostring(req:header("user-agent")))
+end)
+server:listen(7071, "127.0.0.1")
+
+reflex.async(function()
+    local client = reflex.tcp.connect("127.0.0.1", 7071)
+
+    -- Two pipelined requests, the slow one must still be answered first
+    client:write(
+        "GET /slow HTTP/1.1\r\nUser-Agent: reflex-test\r\n\r\n",
+        "GET /fast HTTP/1.1\r\nUser-Agent: reflex-test\r\nConnection: close\r\n\r\n"
+    )
+
+    local received = {}
+    while true do
+        local data = client:read()
+        if not data then break end
+        received[#received + 1] = data:tostring()
+    end
+    print(table.concat(received))
+
+    client:close()
+    server:close()
+end)
@@ -3,6 +3,13 @@
     Testing the logger api.
 
     > Reflex has a logger api at `reflex#logger` which is a table containing logger methods.
+    > Records take an optional table of fields, written as key=value or,
+    > with setFormat("json"), as one JSON object per line.
+    > setLevel("warn") makes debug and info do nothing in this state.
+    > addFile appends the records to a file too, flush writes its block out.
+    > Labels are colored on a terminal only, files get plain ones.
+    > print and io.write come out after the records logged before them,
+    > also when stdout is a pipe (`reflex run test_logger.lua | cat`).
     > This will use a method to override the print method.
 
 ]]
@@ -12,6 +19,41 @@ reflex.logger.warn("Hello, World!")
 reflex.logger.error("Hello, World!")
 reflex.logger.debug("Hello, World!")
 
+reflex.logger.info("With fields", { user = "reflex", id = 1 })
+reflex.logger.setFormat("json")
+reflex.logger.info("Hello, World!", { user = "reflex", tags = { "a", "b" } })
+reflex.logger.setFormat("text")
+
+reflex.logger.setLevel("warn")
+assert(reflex.logger.getLevel() == "warn")
+reflex.logger.debug("Not written")
+reflex.logger.info("Not written")
+reflex.logger.warn("Written at warn")
+assert(not pcall(reflex.logger.setLevel, "verbose"))
+reflex.logger.setLevel("debug")
+
+local log_file = "logger_test_output.log"
+os.remove(log_file)
+reflex.logger.addFile(log_file, { flushInterval = 60000 })
+assert(not pcall(reflex.logger.addFile, log_file))
+reflex.logger.setStdout(false)
+reflex.logger.info("Written to the file", { id = 2 })
+reflex.logger.flush()
+reflex.logger.setStdout(true)
+
+local file = io.open(log_file, "r")
+local content = file:read("a")
+assert(content:find("INFO: Written to the file id=2", 1, true))
+assert(not content:find("\27", 1, true), "colors are for terminals only")
+file:close()
+os.remove(log_file)
+
+for i = 1, 3 do
+    reflex.logger.info("Logged " .. i)
+    print("Printed " .. i)
+    io.write("Written " .. i, "\n")
+end
+
 reflex.logger.overridePrint()
 
 print("Hello, World!")
\ No newline at end of file
@@ -0,0 +1,32 @@
+--[[
+
+    Testing the memory limit
+
+    > Run with `reflex run test_memory.lua --max-memory 16M`
+    > Allocations past the limit raise "not enough memory" like any other
+    > error; the state keeps working once the garbage is collected.
+
+]]
+
+local usage = process.memoryUsage()
+print("Limit: " .. tostring(usage.limit))
+print("Live below limit: " .. tostring(usage.live < (usage.limit or math.huge)))
+
+local ok, err = pcall(function()
+    local runaway = {}
+    for i = 1, 1e9 do
+        runaway[i] = "item " .. i
+    end
+end)
+print("Runaway table: " .. tostring(ok) .. ", " .. tostring(err))
+
+collectgarbage()
+usage = process.memoryUsage()
+print("Peak reached limit: " .. tostring(usage.peak > usage.limit * 0.9))
+print("Live after collect: " .. tostring(usage.live < usage.limit / 2))
+
+-- An uncaught memory error ends the script like any other error
+local again = {}
+for i = 1, 1e9 do
+    again[i] = i
+end
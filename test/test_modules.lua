@@ -0,0 +1,45 @@
+--[[
+
+    Testing the require resolution cache
+
+    > Where a module was found, and that it was not, is remembered until
+    > reflex.modules.invalidate is called or package.path changes
+    > reflex.modules.reload swaps package.loaded and calls __reload(old)
+
+]]
+
+local dir = os.tmpname()
+os.remove(dir)
+os.execute("mkdir -p " .. dir)
+package.path = dir .. "/?.lua;" .. package.path
+
+local function write(name, source)
+    local file = io.open(dir .. "/" .. name .. ".lua", "w")
+    file:write(source)
+    file:close()
+end
+
+local loads = 0
+_G.count_load = function() loads = loads + 1 end
+
+print("Missing: " .. tostring(pcall(require, "cached_mod")))
+write("cached_mod", "count_load() return { value = 42 }")
+print("Still missing: " .. tostring(pcall(require, "cached_mod")))
+
+reflex.modules.invalidate("cached_mod")
+local mod = require("cached_mod")
+print("Found: " .. mod.value .. ", loaded " .. loads .. " time(s)")
+
+package.loaded.cached_mod = nil
+require("cached_mod")
+print("Reloaded from the cache: " .. loads .. " time(s)")
+
+write("cached_mod", "local M = { value = 43 } function M.__reload(old) M.kept = old.value end return M")
+local reloaded = reflex.modules.reload("cached_mod")
+print("Reloaded: " .. reloaded.value .. ", kept " .. reloaded.kept .. ", swapped " .. tostring(package.loaded.cached_mod == reloaded))
+
+write("cached_mod", "return {")
+print("Broken reload: " .. tostring(pcall(reflex.modules.reload, "cached_mod")) .. ", kept " .. package.loaded.cached_mod.value)
+
+os.remove(dir .. "/cached_mod.lua")
+os.remove(dir)
@@ -0,0 +1,39 @@
+--[[
+
+    Testing the parallel api
+
+    > The function runs on a pool of worker states. Its upvalues are copied
+    > to the workers, global functions are the worker's own builtins.
+    > Inside a task the loop keeps running while the pool works.
+
+]]
+
+local numbers = {}
+for i = 1, 1000 do
+    numbers[i] = i
+end
+
+local offset = 1
+local squares = reflex.parallel.map(numbers, function(n, index)
+    return n * n + offset - (index - n)
+end)
+print("Squares: " .. #squares .. ", last " .. squares[1000])
+
+local sum = reflex.parallel.reduce(numbers, function(a, b) return a + b end)
+print("Sum: " .. sum)
+print("Sum with init: " .. reflex.parallel.reduce(numbers, function(a, b) return a + b end, 500))
+print("Empty: " .. #reflex.parallel.map({}, print) .. ", " .. tostring(reflex.parallel.reduce({}, print)))
+
+local ok, err = pcall(reflex.parallel.map, numbers, function(n)
+    if n == 500 then error("bad item") end
+    return n
+end)
+print("Error: " .. tostring(ok) .. ", " .. tostring(err:find("bad item") ~= nil))
+
+reflex.async(function()
+    local words = reflex.parallel.map({ "a", "b", "c" }, function(word)
+        return { word = string.upper(word) }
+    end)
+    print("Words: " .. words[1].word .. words[2].word .. words[3].word)
+end)
+print("Main continues")
@@ -0,0 +1,132 @@
+/*
+
+    Testing the state pool.
+
+    > Acquires a state, changes globals, builtin tables, the logger level and
+    > the module lookups, releases it and checks the state acquired next is
+    > the same one, back to how it was after the builtins were defined.
+    > A state left with a timer running is freed instead of being kept.
+    > Built and run by `make test_pool`.
+
+*/
+
+#include "lua_api.h"
+#include "reflex_api.h"
+#include "require.h"
+#include "state_pool.h"
+#include "apis/reflex_logger_api.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MARKER_KEY "test.state_pool.marker"
+
+static int failures = 0;
+
+static void check(int condition, const char *what) {
+    printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+static int run(LuaAPI *api, const char *chunk) {
+    if (luaL_dostring(api->L, chunk) != 0) {
+        fprintf(stderr, "%s\n", lua_tostring(api->L, -1));
+        lua_pop(api->L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+static lua_CFunction logger_function(lua_State *L, const char *name) {
+    lua_getglobal(L, "reflex");
+    lua_getfield(L, -1, "logger");
+    lua_getfield(L, -1, name);
+    lua_CFunction function = lua_tocfunction(L, -1);
+    lua_pop(L, 3);
+    return function;
+}
+
+// Marks the state in the registry, which the pool does not reset
+static void mark(LuaAPI *api) {
+    lua_pushboolean(api->L, 1);
+    lua_setfield(api->L, LUA_REGISTRYINDEX, MARKER_KEY);
+}
+
+static int marked(LuaAPI *api) {
+    int found = lua_getfield(api->L, LUA_REGISTRYINDEX, MARKER_KEY) != LUA_TNIL;
+    lua_pop(api->L, 1);
+    return found;
+}
+
+static void test_reset(void) {
+    ReflexStatePool *pool = reflex_state_pool_new(1);
+    LuaAPI *api = reflex_state_pool_acquire(pool);
+    lua_State *L = api->L;
+    mark(api);
+
+    lua_CFunction info = logger_function(L, "info");
+    char level[16];
+    lua_getfield(L, LUA_REGISTRYINDEX, LOGGER_LEVEL_KEY);
+    snprintf(level, sizeof(level), "%s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    check(run(api,
+        "counter = 1\n"
+        "table.insert = nil\n"
+        "string.shout = string.upper\n"
+        "reflex.logger.extra = true\n"
+        "reflex.logger.setLevel('error')\n"
+        "package.path = './missing/?.lua'\n"
+        "pcall(require, 'missing_module')\n"),
+        "changes the state");
+    lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY);
+    check(lua_istable(L, -1), "caches the failed lookup");
+    lua_pop(L, 1);
+    reflex_state_pool_release(pool, api);
+
+    api = reflex_state_pool_acquire(pool);
+    L = api->L;
+    check(marked(api), "hands out the released state again");
+    check(run(api,
+        "assert(counter == nil, 'global kept')\n"
+        "assert(table.insert, 'table.insert missing')\n"
+        "assert(string.shout == nil, 'string.shout kept')\n"
+        "assert(reflex.logger.extra == nil, 'reflex.logger.extra kept')\n"
+        "assert(package.path ~= './missing/?.lua', 'package.path kept')\n"),
+        "resets globals and builtin tables");
+    run(api, "return reflex.logger.getLevel()");
+    check(lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), level) == 0, "restores the logger level");
+    lua_pop(L, 1);
+    check(logger_function(L, "info") == info, "binds the logger functions of the level again");
+    lua_getfield(L, LUA_REGISTRYINDEX, REQUIRE_CACHE_KEY);
+    check(lua_isnil(L, -1), "forgets the module lookups");
+    lua_pop(L, 1);
+
+    reflex_state_pool_release(pool, api);
+    reflex_state_pool_free(pool);
+}
+
+static void test_busy(void) {
+    ReflexStatePool *pool = reflex_state_pool_new(1);
+    LuaAPI *api = reflex_state_pool_acquire(pool);
+    mark(api);
+    run(api, "reflex.timer.setTimeout(function() end, 60000)");
+    reflex_state_pool_release(pool, api);
+
+    api = reflex_state_pool_acquire(pool);
+    check(!marked(api), "frees a state with a timer running");
+    reflex_state_pool_release(pool, api);
+    reflex_state_pool_free(pool);
+}
+
+int main(void) {
+    test_reset();
+    test_busy();
+    if (failures) {
+        printf("%d failed\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
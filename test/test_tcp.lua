@@ -0,0 +1,33 @@
+--[[
+
+    Testing the tcp api
+
+    > Every accepted connection runs its handler in its own task.
+    > `socket:read()` returns a Buffer that points straight into the pooled
+    > read memory, `socket:write(...)` sends all its arguments in one batch.
+
+]]
+
+local server = reflex.tcp.createServer(function(socket)
+    while true do
+        local data = socket:read()
+        if not data then break end
+        socket:write("echo: ", data)
+    end
+    socket:close()
+end)
+server:listen(7070, "127.0.0.1")
+
+reflex.async(function()
+    local client = reflex.tcp.connect("127.0.0.1", 7070)
+    client:setNoDelay(true)
+
+    for i = 1, 3 do
+        client:write("message ", tostring(i))
+        local reply = client:read()
+        print("Received " .. #reply .. " bytes: " .. reply:tostring())
+    end
+
+    client:close()
+    server:close()
+end)
@@ -0,0 +1,30 @@
+--[[
+
+    Testing the timer api
+
+    > Timers live at `reflex.timer` and are driven by the event loop
+    > The process stays alive until every timer has fired or been cleared.
+
+]]
+
+local timer = reflex.timer
+
+timer.setTimeout(function()
+    print("Timeout fired after 100ms")
+end, 100)
+
+local ticks = 0
+local interval
+interval = timer.setInterval(function()
+    ticks = ticks + 1
+    print("Interval tick " .. ticks)
+
+    if ticks == 3 then
+        print("Clearing interval: " .. tostring(timer.clearTimer(interval)))
+    end
+end, 50)
+
+local cancelled = timer.setTimeout(function()
+    print("This should never print")
+end, 20)
+timer.clearTimer(cancelled)
@@ -0,0 +1,37 @@
+--[[
+
+    Testing the worker api
+
+    > `reflex.worker.spawn(script, ...)` runs a script on a new thread.
+    > Values are copied between the states, so only nil, booleans, numbers,
+    > strings and tables of those can be sent.
+    > A worker that closes its port early keeps running on its own, the
+    > parent's loop goes on meanwhile.
+
+]]
+
+local worker = reflex.worker.spawn("worker_square.lua", "squarer")
+
+reflex.async(function()
+    worker:send({ 1, 2, 3 })
+    worker:send({ 4, 5, 6 })
+    worker:close() -- The worker finishes once it received everything
+
+    while true do
+        local name, squares = worker:receive()
+        if not name then break end
+        print(name .. ": " .. table.concat(squares, ", "))
+    end
+    print("Worker finished")
+end)
+
+local lingering = reflex.worker.spawn("worker_linger.lua", 300)
+local spawned = process.hrtime()
+
+reflex.async(function()
+    assert(lingering:receive() == nil)
+    reflex.sleep(50)
+    local elapsed = (process.hrtime() - spawned) / 1e6
+    assert(elapsed < 250, "parent loop was blocked for " .. elapsed .. "ms")
+    print("Parent kept running while the worker lingered")
+end)
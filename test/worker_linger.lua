@@ -0,0 +1,13 @@
+--[[
+
+    Worker script used by `test_worker.lua`
+
+    > Closes its port to the parent right away and keeps running for a while,
+    > the parent must not wait for it on its loop.
+
+]]
+
+local ms = ...
+reflex.worker.parent:close()
+
+reflex.timer.setTimeout(function() end, ms)
@@ -0,0 +1,13 @@
+--[[
+
+    Worker script used by `test_channel.lua`
+
+    > Sends numbered messages into the channel it was given.
+
+]]
+
+local channel, id, count = ...
+
+for i = 1, count do
+    channel:send(id, i)
+end
@@ -0,0 +1,24 @@
+--[[
+
+    Worker script used by `test_worker.lua`
+
+    > Runs on its own thread with its own state and loop.
+    > `reflex.worker.parent` is the port back to the script that spawned it.
+
+]]
+
+local name = ...
+local parent = reflex.worker.parent
+
+reflex.async(function()
+    while true do
+        local numbers = parent:receive()
+        if not numbers then break end
+
+        local squares = {}
+        for i, n in ipairs(numbers) do
+            squares[i] = n * n
+        end
+        parent:send(name, squares)
+    end
+end)